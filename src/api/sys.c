@@ -94,8 +94,7 @@ static lox_val_t __assert(int arg_cnt, lox_val_t *args)
 	if (!arg_cnt || val_is_falsey(args[0])) {
 		if (arg_cnt > 1) {
 			lox_val_t err_msg = __to_str(1, &args[1]);
-			err_msg.type = VAL_ERR;
-			return err_msg;
+			return VAL_CREATE_ERR(VAL_AS_OBJ(err_msg));
 		}
 
 		return VAL_CREATE_ERR(LITERAL_OBJECT_STRING("Assert Error"));
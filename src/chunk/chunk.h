@@ -15,6 +15,41 @@
 //! @brief vm opcode typedef
 typedef uint8_t code_t;
 
+//! @brief number of previously written op offsets a chunk keeps track of
+#define CHUNK_PREV_OPS 4
+
+//! @brief number of classes a single property access site caches
+#define PROP_CACHE_WAYS 4
+
+//! @brief class to field index pair cached by a property access site
+struct prop_cache_entry {
+	const struct object_class *cls;
+	uint32_t idx;
+};
+
+/**
+ * @brief inline cache for a single property access site.
+ * Monomorphic sites hit the first entry. Polymorphic sites fill up to
+ * PROP_CACHE_WAYS entries, after which misses fall back to the class lookup
+ *
+ */
+struct prop_cache {
+	uint32_t name_idx;
+	uint32_t cnt;
+	struct prop_cache_entry entries[PROP_CACHE_WAYS];
+};
+
+/**
+ * @brief name given to a local slot, from the offset it was declared at
+ * onwards. Locals have no define op, so this is kept for debugging only
+ *
+ */
+struct chunk_local {
+	struct object_str *name;
+	uint32_t slot;
+	uint32_t start;
+};
+
 /**
  * @brief chunk struct definition. See chunk_func.h for usage
  * Created using chunk_new(). Must be freed after use by using chunk_free()
@@ -24,7 +59,21 @@ typedef struct __chunk {
 	list_t code;
 	list_t lines;
 	list_t consts;
+	//! @brief number of uses of each constant
+	list_t const_refs;
+	//! @brief open addressed index of the constants by value. Buckets hold
+	//! the constant offset plus one, so zero marks an empty bucket
+	struct {
+		uint32_t *buckets;
+		uint32_t cap;
+		uint32_t cnt;
+	} const_index;
+	list_t prop_caches;
+	//! @brief names of the local slots, in declaration order
+	list_t locals;
 	uint32_t prev_line;
+	size_t prev_ops[CHUNK_PREV_OPS];
+	size_t label;
 } chunk_t;
 
 #endif // __CLOX_CHUNK_H__
\ No newline at end of file
@@ -1,5 +1,7 @@
-#include "chunk.h"
+#include "chunk_func.h"
 #include "val/func/object_func.h"
+#include "util/map/map.h"
+#include "util/map/hash_util.h"
 
 #include <assert.h>
 #include <string.h>
@@ -12,14 +14,22 @@ struct line_encode {
 static struct line_encode __chunk_get_line_encode(chunk_t *chunk, size_t idx);
 static struct line_encode __line_encode_diff(uint32_t begin_pos,
 					     uint32_t end_pos);
+static uint32_t *__const_index_find(chunk_t *chunk, lox_val_t const_val);
+static void __const_index_rebuild(chunk_t *chunk, uint32_t cap);
 
 chunk_t chunk_new()
 {
 	return (chunk_t){
 		.code = list_of_type(code_t),
 		.consts = list_of_type(lox_val_t),
+		.const_refs = list_of_type(uint32_t),
+		.const_index = { .buckets = NULL, .cap = 0, .cnt = 0 },
 		.lines = list_of_type(struct line_encode),
+		.prop_caches = list_of_type(struct prop_cache),
+		.locals = list_of_type(struct chunk_local),
 		.prev_line = 0,
+		.prev_ops = { 0 },
+		.label = 0,
 	};
 }
 
@@ -36,6 +46,28 @@ void chunk_reserve_code(chunk_t *chunk, uint32_t count)
 	encoding->count += count;
 }
 
+void chunk_truncate_code(chunk_t *chunk, uint32_t count)
+{
+	assert(("Can not remove more code than was written",
+		count <= chunk->code.cnt));
+
+	list_pop_bulk(&chunk->code, count);
+
+	while (count) {
+		struct line_encode *encoding = list_peek(&chunk->lines);
+		uint32_t removed =
+			encoding->count < count ? encoding->count : count;
+
+		encoding->count -= removed;
+		count -= removed;
+
+		if (!encoding->count) {
+			chunk->prev_line -= encoding->offset;
+			list_pop(&chunk->lines);
+		}
+	}
+}
+
 void chunk_patch_code(chunk_t *chunk, size_t offset, const void *data,
 		      uint32_t count)
 {
@@ -78,7 +110,49 @@ size_t chunk_write_code_extended(chunk_t *chunk, code_t code, uint32_t line,
 
 size_t chunk_write_const(chunk_t *chunk, lox_val_t const_val)
 {
-	return list_push(&(chunk->consts), &const_val);
+	uint32_t index_cap = chunk->const_index.cap;
+
+	if (chunk->const_index.cnt + 1 > index_cap * MAP_MAX_LOAD) {
+		__const_index_rebuild(chunk, GROW_CAPACITY(index_cap));
+	}
+
+	uint32_t *bucket = __const_index_find(chunk, const_val);
+
+	if (*bucket) {
+		uint32_t *refs = list_get(&chunk->const_refs, *bucket - 1);
+		(*refs)++;
+
+		return *bucket - 1;
+	}
+
+	uint32_t refs = 1;
+	size_t offset = list_push(&chunk->consts, &const_val);
+	list_push(&chunk->const_refs, &refs);
+
+	*bucket = (uint32_t)offset + 1;
+	chunk->const_index.cnt++;
+
+	return offset;
+}
+
+void chunk_truncate_consts(chunk_t *chunk, size_t count)
+{
+	// buckets of removed constants are left behind, and skipped by lookups
+	// as the offset no longer holds their value
+	list_pop_bulk(&chunk->consts, count);
+	list_pop_bulk(&chunk->const_refs, count);
+}
+
+void chunk_release_const(chunk_t *chunk, size_t offset)
+{
+	uint32_t *refs = list_get(&chunk->const_refs, offset);
+	assert(("Constant has already been released", *refs));
+	(*refs)--;
+
+	while (list_size(&chunk->const_refs) &&
+	       !*(uint32_t *)list_peek(&chunk->const_refs)) {
+		chunk_truncate_consts(chunk, 1);
+	}
 }
 
 code_t chunk_get_code(chunk_t *chunk, size_t offset)
@@ -107,18 +181,127 @@ size_t chunk_get_line(chunk_t *chunk, size_t offset)
 	return line_cnt;
 }
 
+void chunk_get_lines(chunk_t *chunk, uint32_t *lines)
+{
+	uint32_t line = 0;
+
+	for (size_t idx = 0; idx < list_size(&chunk->lines); idx++) {
+		struct line_encode encoding =
+			__chunk_get_line_encode(chunk, idx);
+
+		line += encoding.offset;
+
+		for (uint32_t cnt = 0; cnt < encoding.count; cnt++) {
+			*lines++ = line;
+		}
+	}
+}
+
+void chunk_write_line_run(chunk_t *chunk, uint32_t line, uint32_t count)
+{
+	// lines are stored as the distance from the previous run
+	struct line_encode encoding = {
+		.offset = line - chunk->prev_line,
+		.count = count,
+	};
+
+	list_push(&chunk->lines, &encoding);
+	chunk->prev_line = line;
+}
+
+void chunk_replace_code(chunk_t *chunk, chunk_t *code_src)
+{
+	list_free(&chunk->code);
+	list_free(&chunk->lines);
+
+	chunk->code = code_src->code;
+	chunk->lines = code_src->lines;
+	chunk->prev_line = code_src->prev_line;
+	memset(chunk->prev_ops, 0, sizeof(chunk->prev_ops));
+	chunk->label = chunk_cur_instr(chunk);
+
+	code_src->code = list_of_type(code_t);
+	code_src->lines = list_of_type(struct line_encode);
+	chunk_free(code_src);
+}
+
 lox_val_t chunk_get_const(chunk_t *chunk, size_t offset)
 {
 	return *((lox_val_t *)list_get(&chunk->consts, offset));
 }
 
+size_t chunk_write_prop_cache(chunk_t *chunk, size_t name_idx)
+{
+	// the cached field index only depends on the class and name, so sites
+	// accessing the same name share a cache
+	for (size_t offset = 0; offset < list_size(&chunk->prop_caches);
+	     offset++) {
+		if (chunk_get_prop_cache(chunk, offset)->name_idx == name_idx) {
+			return offset;
+		}
+	}
+
+	struct prop_cache cache = {
+		.name_idx = (uint32_t)name_idx,
+		.cnt = 0,
+	};
+
+	return list_push(&chunk->prop_caches, &cache);
+}
+
+struct prop_cache *chunk_get_prop_cache(chunk_t *chunk, size_t offset)
+{
+	return (struct prop_cache *)list_get(&chunk->prop_caches, offset);
+}
+
+void chunk_write_local(chunk_t *chunk, struct object_str *name, uint32_t slot)
+{
+	struct chunk_local local = {
+		.name = name,
+		.slot = slot,
+		.start = (uint32_t)chunk_cur_instr(chunk),
+	};
+
+	list_push(&chunk->locals, &local);
+}
+
+struct object_str *chunk_get_local(chunk_t *chunk, uint32_t slot,
+				   size_t offset)
+{
+	struct object_str *name = NULL;
+
+	// later declarations reuse the slots of finished scopes
+	for (size_t idx = 0; idx < list_size(&chunk->locals); idx++) {
+		const struct chunk_local *local =
+			list_get(&chunk->locals, idx);
+
+		if (local->start > offset) {
+			break;
+		}
+
+		if (local->slot == slot) {
+			name = local->name;
+		}
+	}
+
+	return name;
+}
+
 void chunk_free(chunk_t *chunk)
 {
 	list_free(&chunk->code);
 	list_free(&chunk->lines);
 	list_free(&chunk->consts);
+	list_free(&chunk->const_refs);
+	reallocate(chunk->const_index.buckets,
+		   sizeof(uint32_t) * chunk->const_index.cap, 0);
+	chunk->const_index.buckets = NULL;
+	chunk->const_index.cap = chunk->const_index.cnt = 0;
+	list_free(&chunk->prop_caches);
+	list_free(&chunk->locals);
 	chunk->prev_line = 0;
 }
+
 static struct line_encode __chunk_get_line_encode(chunk_t *chunk, size_t idx)
 {
 	return *((struct line_encode *)list_get(&chunk->lines, idx));
@@ -133,4 +316,99 @@ static struct line_encode __line_encode_diff(uint32_t begin_pos,
 		.offset = end_pos - begin_pos,
 		.count = 1,
 	};
-}
\ No newline at end of file
+}
+
+/**
+ * @brief whether two constants are the same value. Numbers are compared by
+ * their bits, so -0 and 0 stay apart and NaNs can be shared
+ */
+static bool __const_is_same(lox_val_t a, lox_val_t b)
+{
+	if (VAL_TYPE(a) != VAL_TYPE(b)) {
+		return false;
+	}
+
+	switch (VAL_TYPE(a)) {
+	case VAL_NIL:
+		return true;
+
+	case VAL_BOOL:
+		return VAL_AS_BOOL(a) == VAL_AS_BOOL(b);
+
+	case VAL_NUMBER: {
+		lox_num_t a_num = VAL_AS_NUMBER(a);
+		lox_num_t b_num = VAL_AS_NUMBER(b);
+
+		return !memcmp(&a_num, &b_num, sizeof(lox_num_t));
+	}
+
+	case VAL_OBJ:
+		// strings are interned so are the same object
+		return VAL_AS_OBJ(a) == VAL_AS_OBJ(b);
+
+	default:
+		return false;
+	}
+}
+
+static hash_t __const_hash(lox_val_t const_val)
+{
+	switch (VAL_TYPE(const_val)) {
+	case VAL_NUMBER: {
+		lox_num_t num = VAL_AS_NUMBER(const_val);
+		return c_str_gen_hash((const char *)&num, sizeof(lox_num_t));
+	}
+
+	case VAL_OBJ: {
+		lox_obj_t *obj = VAL_AS_OBJ(const_val);
+		return c_str_gen_hash((const char *)&obj, sizeof(lox_obj_t *));
+	}
+
+	case VAL_BOOL:
+		return VAL_AS_BOOL(const_val) ? 1 : 2;
+
+	default:
+		return 0;
+	}
+}
+
+static uint32_t *__const_index_find(chunk_t *chunk, lox_val_t const_val)
+{
+	uint32_t mask = chunk->const_index.cap - 1;
+	uint32_t idx = __const_hash(const_val) & mask;
+
+	for (;;) {
+		uint32_t *bucket = &chunk->const_index.buckets[idx];
+
+		if (!*bucket || (*bucket <= list_size(&chunk->consts) &&
+				 __const_is_same(chunk_get_const(chunk,
+								 *bucket - 1),
+						 const_val))) {
+			return bucket;
+		}
+
+		idx = (idx + 1) & mask;
+	}
+}
+
+static void __const_index_rebuild(chunk_t *chunk, uint32_t cap)
+{
+	reallocate(chunk->const_index.buckets,
+		   sizeof(uint32_t) * chunk->const_index.cap, 0);
+
+	chunk->const_index.buckets = reallocate(NULL, 0, sizeof(uint32_t) * cap);
+	chunk->const_index.cap = cap;
+	chunk->const_index.cnt = 0;
+	memset(chunk->const_index.buckets, 0, sizeof(uint32_t) * cap);
+
+	// removed constants are dropped from the index here
+	for (size_t offset = 0; offset < list_size(&chunk->consts); offset++) {
+		uint32_t *bucket = __const_index_find(
+			chunk, chunk_get_const(chunk, offset));
+
+		if (!*bucket) {
+			*bucket = (uint32_t)offset + 1;
+			chunk->const_index.cnt++;
+		}
+	}
+}
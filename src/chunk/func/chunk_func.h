@@ -40,6 +40,14 @@ size_t chunk_cur_instr(const chunk_t *chunk);
  */
 void chunk_reserve_code(chunk_t *chunk, uint32_t count);
 
+/**
+ * @brief removes the given number of codes from the end of the chunk
+ *
+ * @param chunk the chunk
+ * @param count the number of codes to remove
+ */
+void chunk_truncate_code(chunk_t *chunk, uint32_t count);
+
 /**
  * @brief patches a previous op code with the given data and count
  *
@@ -75,14 +83,32 @@ size_t chunk_write_code_extended(chunk_t *chunk, code_t code, uint32_t line,
 				 const void *restrict data, size_t data_cnt);
 
 /**
- * @brief writes a const value to the chunk
+ * @brief writes a const value to the chunk. Identical constants share a
+ * single offset, so each value is only stored once
  *
  * @param chunk the chunk to write to
  * @param const_val the constant to write
- * @return size_t
+ * @return size_t the offset of the constant
  */
 size_t chunk_write_const(chunk_t *chunk, lox_val_t const_val);
 
+/**
+ * @brief releases a use of the constant at the given offset. Constants at
+ * the end of the table which are no longer used are removed
+ *
+ * @param chunk the chunk to write to
+ * @param offset the constant offset
+ */
+void chunk_release_const(chunk_t *chunk, size_t offset);
+
+/**
+ * @brief removes constants from the end of the table
+ *
+ * @param chunk the chunk to write to
+ * @param count the number of constants to remove
+ */
+void chunk_truncate_consts(chunk_t *chunk, size_t count);
+
 /**
  * @brief gets the code at the given ip
  *
@@ -101,6 +127,34 @@ code_t chunk_get_code(chunk_t *chunk, size_t offset);
  */
 size_t chunk_get_line(chunk_t *chunk, size_t offset);
 
+/**
+ * @brief gets the line of every instruction in the chunk
+ *
+ * @param chunk the chunk to read
+ * @param lines the array to fill. Must hold chunk_cur_instr() lines
+ */
+void chunk_get_lines(chunk_t *chunk, uint32_t *lines);
+
+/**
+ * @brief records the line of the next count bytes of code, without writing
+ * the code. Used when the code is written in bulk, such as when loading an
+ * image
+ *
+ * @param chunk the chunk to write to
+ * @param line the line of the code
+ * @param count the number of code bytes on the line
+ */
+void chunk_write_line_run(chunk_t *chunk, uint32_t line, uint32_t count);
+
+/**
+ * @brief replaces the code and lines of the chunk with those written to
+ * another chunk. The constants and property caches are kept
+ *
+ * @param chunk the chunk to replace the code of
+ * @param code_src the chunk holding the new code. Freed by the call
+ */
+void chunk_replace_code(chunk_t *chunk, chunk_t *code_src);
+
 /**
  * @brief gets the constant at the given offset
  *
@@ -110,4 +164,43 @@ size_t chunk_get_line(chunk_t *chunk, size_t offset);
  */
 lox_val_t chunk_get_const(chunk_t *chunk, size_t offset);
 
+/**
+ * @brief gets the property cache for a new property access site. Sites
+ * accessing the same property name share a cache
+ *
+ * @param chunk the chunk to write to
+ * @param name_idx the constant offset of the property name
+ * @return size_t the offset of the property cache
+ */
+size_t chunk_write_prop_cache(chunk_t *chunk, size_t name_idx);
+
+/**
+ * @brief gets the property cache at the given offset
+ *
+ * @param chunk the chunk to read
+ * @param offset the property cache offset
+ * @return struct prop_cache* the property cache
+ */
+struct prop_cache *chunk_get_prop_cache(chunk_t *chunk, size_t offset);
+
+/**
+ * @brief records the name of a local slot declared at the current instruction
+ *
+ * @param chunk the chunk to write to
+ * @param name the local name
+ * @param slot the local slot
+ */
+void chunk_write_local(chunk_t *chunk, struct object_str *name, uint32_t slot);
+
+/**
+ * @brief gets the name of a local slot at the given instruction
+ *
+ * @param chunk the chunk to read
+ * @param slot the local slot
+ * @param offset the instruction offset
+ * @return struct object_str* the local name, or NULL if the slot has none
+ */
+struct object_str *chunk_get_local(chunk_t *chunk, uint32_t slot,
+				   size_t offset);
+
 #endif //__CLOX_CHUNK_FUNC_H__
\ No newline at end of file
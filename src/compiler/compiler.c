@@ -1,15 +1,18 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <math.h>
 
 #include "util/common.h"
 #include "compiler.h"
 #include "compiler/parser/parser.h"
+#include "compiler/peephole/peephole.h"
 #include "ops/func/ops_func.h"
 #include "chunk/func/chunk_func.h"
 #include "val/func/val_func.h"
 #include "val/func/object_func.h"
 #include "util/dtoa.h"
+#include "util/mem/arena.h"
 
 #include "compiler/import.h"
 #include "api/sys.h"
@@ -18,6 +21,9 @@
 #include "debug/debug.h"
 #endif
 
+//! @brief name of the hidden range end local, which can't clash with an id
+#define RANGE_END_NAME "..end"
+
 // TODO(dmayor): place check to stop recursive classes
 // not possible due to flag being unset
 enum define_state {
@@ -25,19 +31,54 @@ enum define_state {
 	CLASS_DEFINE,
 };
 
+/**
+ * @brief class an expression is known to produce at compile time. Only valid
+ * while the code written since start is exactly that expression
+ *
+ */
+struct known_cls {
+	const lox_class_t *cls;
+	bool is_instance;
+	size_t start;
+	size_t end;
+};
+
+/**
+ * @brief local variable in scope. Its index in the compiler's locals is the
+ * stack slot it lives in
+ *
+ */
+struct local {
+	//! @brief interned name, so names are compared by pointer
+	const lox_str_t *name;
+	lookup_var_t var;
+	//! @brief depth of the scope the local was declared in
+	uint32_t depth;
+};
+
 struct compiler {
 	struct compiler *enclosing;
 	struct state *global_state;
 	parser_t *prsr;
+	//! @brief arena for state which dies once compiling ends
+	arena_t *arena;
 	struct {
-		list_t scopes;
-		uint32_t idx;
+		//! @brief locals in scope, innermost last
+		list_t locals;
+		//! @brief number of scopes open
+		uint32_t depth;
+		//! @brief fields of the class being declared, if any
+		lookup_t *fields;
 	} lookup;
 	list_t upvalues;
 	list_t captured_vals;
 	lox_fn_t *fn;
 	bool can_assign;
 	enum define_state define_state;
+	//! @brief class produced by the last expression parsed, if known
+	struct known_cls known;
+	//! @brief offset of the left operand of the infix rule being parsed
+	size_t infix_start;
 };
 
 typedef void (*parse_fn)(struct compiler *);
@@ -90,11 +131,17 @@ static lookup_var_t __compiler_find_name(struct compiler *compiler,
 static lookup_var_t __compiler_find_name_local(struct compiler *compiler,
 					       const char *name,
 					       size_t name_sz);
-static lookup_t *__compiler_cur_scope(struct compiler *);
+static struct local *__compiler_find_local(struct compiler *,
+					   const lox_str_t *, uint32_t);
 static lookup_var_t __compiler_resolve_upval(struct compiler *compiler,
 					     const char *name, size_t name_sz);
 static lookup_var_t __compiler_add_upvalue(struct compiler *compiler,
 					   lookup_var_t upval);
+static void __compiler_set_known(struct compiler *, size_t,
+				 const lox_class_t *, bool);
+static bool __compiler_is_known(struct compiler *, size_t);
+static void __compiler_set_var_class(struct compiler *, const char *, size_t,
+				     const lox_class_t *, bool);
 /* Forwards */
 
 static struct parse_rule PARSE_RULES[] = {
@@ -120,6 +167,7 @@ static struct parse_rule PARSE_RULES[] = {
 	[TKN_EQ_EQ] = { NULL, __parse_binary, PREC_EQUALITY },
 	[TKN_GREATER_EQ] = { NULL, __parse_binary, PREC_COMPARISON },
 	[TKN_LESS_EQ] = { NULL, __parse_binary, PREC_COMPARISON },
+	[TKN_DOT_DOT] = { NULL, NULL, PREC_NONE },
 	// Literals
 	[TKN_ID] = { __parse_var, NULL, PREC_NONE },
 	[TKN_STR] = { __parse_string, NULL, PREC_NONE },
@@ -151,7 +199,7 @@ static const struct parse_rule *__compiler_get_rule(enum tkn_type tkn)
 
 static struct compiler __compiler_new(struct compiler *enclosing,
 				      parser_t *prsr, struct state *state,
-				      lox_str_t *name)
+				      arena_t *arena, lox_str_t *name)
 {
 	lox_fn_t *fn = object_fn_new();
 	fn->name = name;
@@ -160,15 +208,19 @@ static struct compiler __compiler_new(struct compiler *enclosing,
 		.enclosing = enclosing,
 		.prsr = prsr,
 		.global_state = state,
+		.arena = arena,
 		.lookup = {
-			.scopes = list_of_type(lookup_t),
-			.idx = 0,
+			.locals = list_of_type_in(struct local, arena),
+			.depth = 0,
+			.fields = NULL,
 		},
-		.upvalues = list_of_type(lookup_var_t),
-		.captured_vals = list_of_type(uint32_t),
+		.upvalues = list_of_type_in(lookup_var_t, arena),
+		.captured_vals = list_of_type_in(uint32_t, arena),
 		.fn = fn,
 		.can_assign = false,
 		.define_state = DEFAULT_DEFINE,
+		.known = { .cls = NULL },
+		.infix_start = 0,
 	};
 }
 
@@ -189,8 +241,8 @@ static lox_fn_t *__compiler_run(struct compiler *compiler, bool is_main)
 		__parse_block(compiler);
 	}
 
-	// TODO: only push if no return was found - call to return leaves this as
-	// dead code
+	// left as dead code after an explicit return, which the peephole pass
+	// removes
 	OP_CONST_WRITE(compiler->fn, VAL_CREATE_NIL,
 		       compiler->prsr->previous.line);
 	OP_RETURN_WRITE(compiler->fn, compiler->prsr->previous.line);
@@ -200,6 +252,8 @@ static lox_fn_t *__compiler_run(struct compiler *compiler, bool is_main)
 
 		return NULL;
 	} else {
+		peephole_run(&compiler->fn->chunk);
+
 #ifdef DEBUG_PRINT_CODE
 		disassem_chunk(&compiler->fn->chunk,
 			       compiler->fn->name != NULL ?
@@ -219,11 +273,16 @@ lox_fn_t *compile(const char *src, struct state *state)
 {
 	parser_t prsr = parser_new(src);
 	uint32_t global_sz = lookup_get_size(&state->globals);
+	arena_t arena = arena_new();
 
-	struct compiler compiler = __compiler_new(NULL, &prsr, state, NULL);
+	struct compiler compiler =
+		__compiler_new(NULL, &prsr, state, &arena, NULL);
 
 	lox_fn_t *fn = __compiler_run(&compiler, true);
 
+	// the state of every function compiler goes at once
+	arena_free(&arena);
+
 	if (!fn) {
 		uint32_t new_global_sz = lookup_get_size(&state->globals);
 
@@ -254,14 +313,165 @@ static void __parse_grouping(struct compiler *compiler)
 		       "Expect ')' after expression.");
 }
 
+/**
+ * @brief evaluates a unary op over a constant at compile time, with the same
+ * semantics as the vm. Ops which would raise a runtime error aren't folded
+ *
+ * @param tkn_type the op token
+ * @param val the operand
+ * @param res set to the result
+ * @return true the op was folded
+ * @return false the op must be run by the vm
+ */
+static bool __fold_unary(enum tkn_type tkn_type, lox_val_t val, lox_val_t *res)
+{
+	switch (tkn_type) {
+	case TKN_MINUS:
+		if (!VAL_IS_NUMBER(val)) {
+			return false;
+		}
+		*res = VAL_CREATE_NUMBER(-VAL_AS_NUMBER(val));
+		return true;
+
+	case TKN_BANG:
+		*res = VAL_CREATE_BOOL(val_is_falsey(val));
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+/**
+ * @brief evaluates a binary op over two constants at compile time, with the
+ * same semantics as the vm. Concatenated strings are interned just as they
+ * are at runtime. Ops which would raise a runtime error aren't folded
+ *
+ * @param tkn_type the op token
+ * @param lhs the left operand
+ * @param rhs the right operand
+ * @param res set to the result
+ * @return true the op was folded
+ * @return false the op must be run by the vm
+ */
+static bool __fold_binary(enum tkn_type tkn_type, lox_val_t lhs, lox_val_t rhs,
+			  lox_val_t *res)
+{
+	if (tkn_type == TKN_EQ_EQ || tkn_type == TKN_BANG_EQ) {
+		*res = VAL_CREATE_BOOL(val_equals(lhs, rhs) ==
+				       (tkn_type == TKN_EQ_EQ));
+		return true;
+	}
+
+	if (tkn_type == TKN_PLUS && OBJECT_IS_STRING(lhs) &&
+	    OBJECT_IS_STRING(rhs)) {
+		*res = VAL_CREATE_OBJ(object_str_concat(OBJECT_AS_STRING(lhs),
+							OBJECT_AS_STRING(rhs)));
+		return true;
+	}
+
+	if (!VAL_IS_NUMBER(lhs) || !VAL_IS_NUMBER(rhs)) {
+		return false;
+	}
+
+	lox_num_t a = VAL_AS_NUMBER(lhs);
+	lox_num_t b = VAL_AS_NUMBER(rhs);
+
+	switch (tkn_type) {
+	case TKN_PLUS:
+		*res = VAL_CREATE_NUMBER(a + b);
+		break;
+	case TKN_MINUS:
+		*res = VAL_CREATE_NUMBER(a - b);
+		break;
+	case TKN_STAR:
+		*res = VAL_CREATE_NUMBER(a * b);
+		break;
+	case TKN_SLASH:
+		*res = VAL_CREATE_NUMBER(a / b);
+		break;
+	case TKN_MOD:
+		*res = VAL_CREATE_NUMBER(fmod(a, b));
+		break;
+	case TKN_GREATER:
+		*res = VAL_CREATE_BOOL(a > b);
+		break;
+	case TKN_GREATER_EQ:
+		*res = VAL_CREATE_BOOL(a >= b);
+		break;
+	case TKN_LESS:
+		*res = VAL_CREATE_BOOL(a < b);
+		break;
+	case TKN_LESS_EQ:
+		*res = VAL_CREATE_BOOL(a <= b);
+		break;
+	default:
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * @brief folds an and/or whose left operand is a constant. The constant
+ * decides which operand is the result, so the other one is never run
+ *
+ * @param compiler the compiler
+ * @param keep_lhs whether the left operand is the result
+ * @param prec the precedence of the right operand
+ */
+static void __fold_logical(struct compiler *compiler, bool keep_lhs,
+			   enum precedence prec)
+{
+	if (!keep_lhs) {
+		op_drop_consts(compiler->fn, 1);
+		__parse_precedence(compiler, prec);
+		return;
+	}
+
+	// the right operand is still compiled for its errors
+	struct op_mark mark = op_get_mark(compiler->fn);
+	__parse_precedence(compiler, prec);
+	op_rewind(compiler->fn, mark);
+}
+
+/**
+ * @brief writes a folded constant, using the literal ops where possible
+ *
+ * @param compiler the compiler
+ * @param val the folded constant
+ * @param line the line of the folded op
+ */
+static void __fold_write(struct compiler *compiler, lox_val_t val,
+			 uint32_t line)
+{
+	if (VAL_IS_NIL(val)) {
+		OP_NIL_WRITE(compiler->fn, line);
+	} else if (VAL_IS_BOOL(val) && VAL_AS_BOOL(val)) {
+		OP_TRUE_WRITE(compiler->fn, line);
+	} else if (VAL_IS_BOOL(val)) {
+		OP_FALSE_WRITE(compiler->fn, line);
+	} else {
+		OP_CONST_WRITE(compiler->fn, val, line);
+	}
+}
+
 static void __parse_unary(struct compiler *compiler)
 {
 	enum tkn_type tkn_type = compiler->prsr->previous.type;
 	uint32_t line_num = compiler->prsr->previous.line;
+	lox_val_t operand, folded;
 
 	// compile operand
 	__parse_precedence(compiler, PREC_UNARY);
 
+	if (op_prev_consts(compiler->fn, 1, &operand) &&
+	    __fold_unary(tkn_type, operand, &folded)) {
+		op_drop_consts(compiler->fn, 1);
+		__fold_write(compiler, folded, line_num);
+		return;
+	}
+
 	switch (tkn_type) {
 	case TKN_MINUS:
 		OP_NEGATE_WRITE(compiler->fn, line_num);
@@ -285,11 +495,19 @@ static void __parse_binary(struct compiler *compiler)
 {
 	enum tkn_type tkn_type = compiler->prsr->previous.type;
 	const struct parse_rule *rule = __compiler_get_rule(tkn_type);
+	lox_val_t operands[2], folded;
 	__parse_precedence(compiler, (enum precedence)(rule->prec + 1));
 
+	if (op_prev_consts(compiler->fn, 2, operands) &&
+	    __fold_binary(tkn_type, operands[0], operands[1], &folded)) {
+		op_drop_consts(compiler->fn, 2);
+		__fold_write(compiler, folded, compiler->prsr->previous.line);
+		return;
+	}
+
 	switch (tkn_type) {
 	case TKN_BANG_EQ:
-		OP_BANG_EQ_WRITE(compiler->fn, compiler->prsr->previous.line);
+		OP_NOT_EQUAL_WRITE(compiler->fn, compiler->prsr->previous.line);
 		break;
 	case TKN_EQ_EQ:
 		OP_EQUAL_WRITE(compiler->fn, compiler->prsr->previous.line);
@@ -340,7 +558,10 @@ static void __parse_precedence(struct compiler *compiler, enum precedence prec)
 		return;
 	}
 
+	size_t start = chunk_cur_instr(&compiler->fn->chunk);
+
 	compiler->can_assign = prec <= PREC_ASSIGNMENT;
+	compiler->known.cls = NULL;
 	prefix_rule(compiler);
 
 	while (prec <=
@@ -350,6 +571,7 @@ static void __parse_precedence(struct compiler *compiler, enum precedence prec)
 			__compiler_get_rule(compiler->prsr->previous.type)
 				->infix;
 
+		compiler->infix_start = start;
 		infix_rule(compiler);
 	}
 
@@ -420,8 +642,12 @@ static void __parse_var_decl(struct compiler *compiler)
 					 "Variables cannot be redefined.");
 	}
 
+	size_t start = chunk_cur_instr(&compiler->fn->chunk);
+	bool is_known = false;
+
 	if (parser_match(compiler->prsr, TKN_EQ)) {
 		__parse_expr(compiler);
+		is_known = __compiler_is_known(compiler, start);
 	} else {
 		OP_NIL_WRITE(compiler->fn, compiler->prsr->previous.line);
 	}
@@ -431,10 +657,17 @@ static void __parse_var_decl(struct compiler *compiler)
 
 	// if undef_var exists, set flags on object
 	// could have a list of pendings
-	if (parser_had_error(compiler->prsr)) {
-		OP_VAR_DEFINE_WRITE(compiler->fn, 0, def_ln);
-	} else {
+	if (!parser_had_error(compiler->prsr)) {
+		struct known_cls known = compiler->known;
+
 		__compiler_define_var(compiler, name, len, def_ln, is_mutable);
+
+		// fields are never initialized, so only variables keep a class
+		if (is_known && !is_mutable &&
+		    compiler->define_state != CLASS_DEFINE) {
+			__compiler_set_var_class(compiler, name, len, known.cls,
+						 known.is_instance);
+		}
 	}
 	// OP_POP_WRITE(compiler->fn, def_ln);
 }
@@ -501,7 +734,14 @@ static void __parse_var(struct compiler *compiler)
 
 		__compiler_set_var(compiler, var);
 	} else {
+		size_t start = chunk_cur_instr(&compiler->fn->chunk);
+
 		__compiler_get_var(compiler, var);
+
+		if (var.cls) {
+			__compiler_set_known(compiler, start, var.cls,
+					     lookup_var_is_instance(var));
+		}
 	}
 }
 
@@ -514,9 +754,8 @@ static void __parse_if_stmt(struct compiler *compiler)
 					"Expected '{' or 'if' after else.");
 	}
 
-	size_t if_jump = OP_JUMP_IF_FALSE_WRITE(compiler->fn,
-						compiler->prsr->previous.line);
-	OP_POP_WRITE(compiler->fn, compiler->prsr->previous.line);
+	size_t if_jump = OP_JUMP_IF_FALSE_POP_WRITE(
+		compiler->fn, compiler->prsr->previous.line);
 
 	__parse_decl(compiler);
 
@@ -527,7 +766,6 @@ static void __parse_if_stmt(struct compiler *compiler)
 		parser_error_at_current(compiler->prsr,
 					"Too much code to jump over");
 	}
-	OP_POP_WRITE(compiler->fn, compiler->prsr->previous.line);
 
 	if (parser_match(compiler->prsr, TKN_ELSE)) {
 		if (!parser_check(compiler->prsr, TKN_LEFT_BRACE) &&
@@ -548,6 +786,13 @@ static void __parse_if_stmt(struct compiler *compiler)
 
 static void __parse_and(struct compiler *compiler)
 {
+	lox_val_t lhs;
+
+	if (op_prev_consts(compiler->fn, 1, &lhs)) {
+		__fold_logical(compiler, val_is_falsey(lhs), PREC_AND);
+		return;
+	}
+
 	size_t end_jump = OP_JUMP_IF_FALSE_WRITE(compiler->fn,
 						 compiler->prsr->previous.line);
 	OP_POP_WRITE(compiler->fn, compiler->prsr->previous.line);
@@ -558,6 +803,13 @@ static void __parse_and(struct compiler *compiler)
 
 static void __parse_or(struct compiler *compiler)
 {
+	lox_val_t lhs;
+
+	if (op_prev_consts(compiler->fn, 1, &lhs)) {
+		__fold_logical(compiler, !val_is_falsey(lhs), PREC_OR);
+		return;
+	}
+
 	size_t else_jump = OP_JUMP_IF_FALSE_WRITE(
 		compiler->fn, compiler->prsr->previous.line);
 	size_t end_jump =
@@ -572,7 +824,7 @@ static void __parse_or(struct compiler *compiler)
 
 static void __parse_while_stmt(struct compiler *compiler)
 {
-	size_t loop_begin = chunk_cur_instr(&compiler->fn->chunk);
+	size_t loop_begin = op_loop_begin(compiler->fn);
 	__parse_expr(compiler);
 
 	if (!parser_check(compiler->prsr, TKN_LEFT_BRACE)) {
@@ -580,9 +832,8 @@ static void __parse_while_stmt(struct compiler *compiler)
 					"Expected '{' after condition.");
 	}
 
-	size_t exit_jump = OP_JUMP_IF_FALSE_WRITE(
+	size_t exit_jump = OP_JUMP_IF_FALSE_POP_WRITE(
 		compiler->fn, compiler->prsr->previous.line);
-	OP_POP_WRITE(compiler->fn, compiler->prsr->previous.line);
 
 	__parse_decl(compiler);
 
@@ -592,7 +843,6 @@ static void __parse_while_stmt(struct compiler *compiler)
 		parser_error_at_current(compiler->prsr,
 					"Too much code to jump over");
 	}
-	OP_POP_WRITE(compiler->fn, compiler->prsr->previous.line);
 
 	if (parser_match(compiler->prsr, TKN_ELSE)) {
 		__parse_stmnt(compiler);
@@ -614,52 +864,70 @@ static void __parse_for_stmt(struct compiler *compiler)
 	}
 
 	parser_consume(compiler->prsr, TKN_IN, "Expected 'in'");
-	parser_consume(compiler->prsr, TKN_NUM, "Expected range start");
-	// write start of range
-	double range_start = strtod(compiler->prsr->previous.start, NULL);
-	OP_CONST_WRITE(compiler->fn, VAL_CREATE_NUMBER(range_start),
-		       compiler->prsr->previous.line);
-	lookup_var_t glbl_idx =
+	// the counter takes the loop variable name, with the range end held in
+	// a hidden slot straight after it
+	__parse_expr(compiler);
+	lookup_var_t counter =
 		__compiler_define_var(compiler, name, len, def_ln, false);
 
-	parser_consume(compiler->prsr, TKN_DOT, "Expected range '..'");
-	parser_consume(compiler->prsr, TKN_DOT, "Expected range '..'");
-	parser_consume(compiler->prsr, TKN_NUM, "Expected range end");
-
-	//condition
-	double range_end = strtod(compiler->prsr->previous.start, NULL);
-
-	size_t inc_start = chunk_cur_instr(&compiler->fn->chunk);
-	OP_VAR_GET_WRITE(compiler->fn, glbl_idx.idx, def_ln);
-	OP_CONST_WRITE(compiler->fn, VAL_CREATE_NUMBER(range_end),
-		       compiler->prsr->previous.line);
-	//LESS_EQ
-	OP_LESS_WRITE(compiler->fn, compiler->prsr->previous.line);
-	size_t exit_jump = OP_JUMP_IF_FALSE_WRITE(compiler->fn, def_ln);
-	OP_POP_WRITE(compiler->fn, def_ln);
+	parser_consume(compiler->prsr, TKN_DOT_DOT, "Expected range '..'");
+	__parse_expr(compiler);
+	__compiler_define_var(compiler, RANGE_END_NAME,
+			      sizeof(RANGE_END_NAME) - 1, def_ln, false);
+
+	// the fused range ops address the counter with a single byte, so loops
+	// with later counters test and step it with the generic ops instead
+	bool fused = counter.idx < UINT8_MAX;
+	long loop_begin = 0;
+	long exit_jump;
+
+	if (fused) {
+		exit_jump = OP_FOR_RANGE_INIT_WRITE(compiler->fn, counter.idx,
+						    def_ln);
+	} else {
+		loop_begin = op_loop_begin(compiler->fn);
+		OP_VAR_GET_WRITE(compiler->fn, counter.idx, def_ln);
+		OP_VAR_GET_WRITE(compiler->fn, counter.idx + 1, def_ln);
+		OP_LESS_WRITE(compiler->fn, def_ln);
+		exit_jump = OP_JUMP_IF_FALSE_POP_WRITE(compiler->fn, def_ln);
+	}
 
 	if (!parser_check(compiler->prsr, TKN_LEFT_BRACE)) {
 		parser_error_at_current(compiler->prsr, "Expected left brace");
 	}
-	// TODO: stop new var from being created and use old var
+	// the fused step jumps back to the body, skipping the entry check
+	if (fused) {
+		loop_begin = op_loop_begin(compiler->fn);
+	}
+	// each iteration gets its own copy of the counter to capture
 	__compiler_begin_scope(compiler);
-	OP_VAR_GET_WRITE(compiler->fn, glbl_idx.idx,
+	OP_VAR_GET_WRITE(compiler->fn, counter.idx,
 			 compiler->prsr->previous.line);
 	__compiler_define_var(compiler, name, len, def_ln, false);
 	__parse_decl(compiler);
 	__compiler_end_scope(compiler);
 
-	OP_VAR_GET_WRITE(compiler->fn, glbl_idx.idx,
-			 compiler->prsr->previous.line);
-	OP_CONST_WRITE(compiler->fn, VAL_CREATE_NUMBER(1),
-		       compiler->prsr->previous.line);
-	OP_ADD_WRITE(compiler->fn, compiler->prsr->previous.line);
-	__compiler_set_var(compiler, glbl_idx);
-	OP_POP_WRITE(compiler->fn, compiler->prsr->previous.line);
-	OP_LOOP_WRITE(compiler->fn, inc_start, compiler->prsr->previous.line);
+	bool looped;
 
-	op_patch_jump(compiler->fn, exit_jump);
-	OP_POP_WRITE(compiler->fn, compiler->prsr->previous.line);
+	if (fused) {
+		looped = OP_FOR_RANGE_WRITE(compiler->fn, counter.idx,
+					    loop_begin,
+					    compiler->prsr->previous.line);
+	} else {
+		uint32_t line = compiler->prsr->previous.line;
+
+		OP_VAR_GET_WRITE(compiler->fn, counter.idx, line);
+		OP_CONST_WRITE(compiler->fn, VAL_CREATE_NUMBER(1), line);
+		OP_ADD_WRITE(compiler->fn, line);
+		__compiler_set_var(compiler, counter);
+		OP_POP_WRITE(compiler->fn, line);
+		looped = OP_LOOP_WRITE(compiler->fn, loop_begin, line);
+	}
+
+	if (!looped || !op_patch_jump(compiler->fn, exit_jump)) {
+		parser_error_at_current(compiler->prsr,
+					"Too much code to jump over");
+	}
 	__compiler_end_scope(compiler);
 }
 
@@ -695,8 +963,9 @@ static void __parse_fn_decl(struct compiler *compiler)
 static void __parse_fn(struct compiler *compiler, lox_str_t *name)
 {
 	uint8_t arity = 0;
-	struct compiler new_comp = __compiler_new(compiler, compiler->prsr,
-						  compiler->global_state, name);
+	struct compiler new_comp =
+		__compiler_new(compiler, compiler->prsr, compiler->global_state,
+			       compiler->arena, name);
 
 	__compiler_begin_scope(&new_comp);
 	parser_consume(new_comp.prsr, TKN_LEFT_PAREN,
@@ -750,17 +1019,33 @@ static void __parse_fn(struct compiler *compiler, lox_str_t *name)
 		lookup_var_t lookup_var =
 			*(lookup_var_t *)list_get(&new_comp.upvalues, i);
 
-		OP_UPVALUE_DEFINE_WRITE(compiler->fn, lookup_var.idx,
-					lookup_var_is_global(lookup_var) ? 0 :
-									   1,
+		uint8_t flags =
+			lookup_var_is_upval(lookup_var) ? 0 : UPVAL_LOCAL_FLAG;
+
+		if (!lookup_var_is_mutable(lookup_var)) {
+			flags |= UPVAL_COPY_FLAG;
+		}
+
+		OP_UPVALUE_DEFINE_WRITE(compiler->fn, lookup_var.idx, flags,
 					compiler->prsr->previous.line);
 	}
 }
 
 static void __parse_call(struct compiler *compiler)
 {
+	size_t start = compiler->infix_start;
+	const lox_class_t *cls = __compiler_is_known(compiler, start) &&
+						 !compiler->known.is_instance ?
+					 compiler->known.cls :
+					 NULL;
+
 	uint8_t args = __parse_arglist(compiler);
 	OP_CALL_WRITE(compiler->fn, args, compiler->prsr->previous.line);
+
+	// calling a class always gives a new instance of it
+	if (cls) {
+		__compiler_set_known(compiler, start, cls, true);
+	}
 }
 
 // TODO: as soon as reached, exit function compile
@@ -781,16 +1066,24 @@ static void __parse_return_stmt(struct compiler *compiler)
 
 static void __compiler_begin_scope(struct compiler *compiler)
 {
-	lookup_t new_scope = lookup_new();
-	list_push(&compiler->lookup.scopes, &new_scope);
+	compiler->lookup.depth++;
 }
 
 static void __compiler_end_scope(struct compiler *compiler)
 {
-	lookup_t *cur_scope = __compiler_cur_scope(compiler);
-	uint32_t scope_sz = lookup_get_size(cur_scope);
+	const struct local *locals =
+		(const struct local *)compiler->lookup.locals.data;
+	uint32_t local_cnt = (uint32_t)list_size(&compiler->lookup.locals);
+	uint32_t scope_sz = 0;
+
+	while (scope_sz < local_cnt &&
+	       locals[local_cnt - scope_sz - 1].depth == compiler->lookup.depth) {
+		scope_sz++;
+	}
+
+	uint32_t popped = scope_sz;
 
-	for (uint32_t i = compiler->lookup.idx - 1;
+	for (uint32_t i = local_cnt - 1;
 	     scope_sz > 0 && list_size(&compiler->captured_vals) != 0;
 	     i--, scope_sz--) {
 		uint32_t escaped_val =
@@ -810,9 +1103,8 @@ static void __compiler_end_scope(struct compiler *compiler)
 		OP_POP_COUNT_WRITE(compiler->fn, scope_sz,
 				   compiler->prsr->previous.line);
 	}
-	compiler->lookup.idx -= lookup_get_size(cur_scope);
-	lookup_free(cur_scope);
-	list_pop(&compiler->lookup.scopes);
+	list_set_cnt(&compiler->lookup.locals, local_cnt - popped);
+	compiler->lookup.depth--;
 }
 
 static lookup_var_t __compiler_define_var(struct compiler *compiler,
@@ -822,9 +1114,15 @@ static lookup_var_t __compiler_define_var(struct compiler *compiler,
 	// TODO: split in to two functions
 	var_flags_t flags = mutable ? LOOKUP_VAR_MUTABLE : LOOKUP_VAR_IMMUTABLE;
 	lookup_var_t new_var;
-
-	if (compiler->enclosing == NULL &&
-	    list_size(&compiler->lookup.scopes) == 0) {
+	const lox_str_t *local_name = NULL;
+
+	if (compiler->lookup.fields) {
+		// fields are indexed from the start of the instance, not the
+		// stack
+		new_var = lookup_define(compiler->lookup.fields, name, len,
+					lookup_get_size(compiler->lookup.fields),
+					flags);
+	} else if (compiler->enclosing == NULL && compiler->lookup.depth == 0) {
 		flags |= LOOKUP_VAR_GLOBAL;
 
 		new_var = lookup_define(
@@ -835,14 +1133,23 @@ static lookup_var_t __compiler_define_var(struct compiler *compiler,
 		assert(("created variable is invalid",
 			lookup_var_is_valid(new_var)));
 	} else {
-		lookup_t *cur_scope = __compiler_cur_scope(compiler);
-		uint32_t prev_sz = lookup_get_size(cur_scope);
-
-		new_var = lookup_define(cur_scope, name, len,
-					compiler->lookup.idx, flags);
-
-		if (lookup_get_size(cur_scope) > prev_sz) {
-			compiler->lookup.idx++;
+		local_name = object_str_new(name, len);
+		new_var = (lookup_var_t){
+			.idx = (uint32_t)list_size(&compiler->lookup.locals),
+			.var_flags = flags | LOOKUP_VAR_DECLARED |
+				     LOOKUP_VAR_DEFINED,
+			.cls = NULL,
+		};
+
+		struct local local = {
+			.name = local_name,
+			.var = new_var,
+			.depth = compiler->lookup.depth,
+		};
+		list_push(&compiler->lookup.locals, &local);
+
+		if (compiler->fn->max_slots < new_var.idx + 1) {
+			compiler->fn->max_slots = new_var.idx + 1;
 		}
 	}
 
@@ -854,7 +1161,10 @@ static lookup_var_t __compiler_define_var(struct compiler *compiler,
 	} else if (lookup_var_is_upval(new_var)) {
 		assert(("upval vars should never be defined", 0));
 	} else {
-		OP_VAR_DEFINE_WRITE(compiler->fn, new_var.idx, line);
+		// the value is already in the local's slot, so only the name is
+		// kept
+		chunk_write_local(&compiler->fn->chunk,
+				  (struct object_str *)local_name, new_var.idx);
 	}
 
 	return new_var;
@@ -876,7 +1186,10 @@ static void __compiler_set_var(struct compiler *compiler, lookup_var_t var)
 
 static void __compiler_get_var(struct compiler *compiler, lookup_var_t var)
 {
-	if (lookup_var_is_upval(var)) {
+	if (lookup_var_is_upval(var) && !lookup_var_is_mutable(var)) {
+		OP_UPVALUE_COPY_GET_WRITE(compiler->fn, var.idx,
+					  compiler->prsr->previous.line);
+	} else if (lookup_var_is_upval(var)) {
 		OP_UPVALUE_GET_WRITE(compiler->fn, var.idx,
 				     compiler->prsr->previous.line);
 	} else if (lookup_var_is_global(var)) {
@@ -891,13 +1204,17 @@ static void __compiler_get_var(struct compiler *compiler, lookup_var_t var)
 static bool __compiler_has_defined(struct compiler *compiler, const char *name,
 				   size_t len)
 {
-	if (list_size(&compiler->lookup.scopes) == 0) {
+	if (compiler->lookup.fields) {
+		return lookup_has_name(compiler->lookup.fields, name, len);
+	}
+
+	if (compiler->lookup.depth == 0) {
 		return lookup_has_name(&compiler->global_state->globals, name,
 				       len);
 	}
 
-	const lookup_t *cur_scope = __compiler_cur_scope(compiler);
-	return lookup_has_name(cur_scope, name, len);
+	return __compiler_find_local(compiler, object_str_new(name, len),
+				     compiler->lookup.depth) != NULL;
 }
 
 static void __parse_class_decl(struct compiler *compiler)
@@ -920,7 +1237,7 @@ static void __parse_class_decl(struct compiler *compiler)
 		       compiler->prsr->previous.line);
 	/*lookup_var_t var =*/__compiler_define_var(
 		compiler, name, len, compiler->prsr->previous.line, false);
-	list_push(&compiler->lookup.scopes, &cls->field_lookup);
+	compiler->lookup.fields = &cls->field_lookup.table;
 
 	parser_consume(compiler->prsr, TKN_LEFT_BRACE,
 		       "Expected '{' before class body");
@@ -941,17 +1258,44 @@ static void __parse_class_decl(struct compiler *compiler)
 	parser_consume(compiler->prsr, TKN_RIGHT_BRACE,
 		       "Expected '}' after class body");
 	compiler->define_state = DEFAULT_DEFINE;
-	cls->field_lookup.table = *__compiler_cur_scope(compiler);
-	list_pop(&compiler->lookup.scopes);
+	compiler->lookup.fields = NULL;
+
+	// the field layout is only known once the body is finished
+	__compiler_set_var_class(compiler, name, len, cls, false);
 }
 
 static void __parse_dot(struct compiler *compiler)
 {
+	bool is_instance = __compiler_is_known(compiler, compiler->infix_start) &&
+			   compiler->known.is_instance;
+	const lox_class_t *cls = is_instance ? compiler->known.cls : NULL;
+
 	parser_consume(compiler->prsr, TKN_ID, "Expecting a property name");
 	token_t name_tkn = compiler->prsr->previous;
+
+	// receivers of a known class index their fields directly. Anything else
+	// looks the name up at runtime
+	lookup_var_t field =
+		cls ? lookup_find_name(&cls->field_lookup.table, name_tkn.start,
+				       name_tkn.len) :
+		      LOOKUP_VAR_TYPE_INVALID;
+
+	if (lookup_var_is_defined(field)) {
+		if (compiler->can_assign &&
+		    parser_match(compiler->prsr, TKN_EQ)) {
+			__parse_expr(compiler);
+			OP_FIELD_SET_WRITE(compiler->fn, field.idx,
+					   name_tkn.line);
+		} else {
+			OP_FIELD_GET_WRITE(compiler->fn, field.idx,
+					   name_tkn.line);
+		}
+
+		return;
+	}
+
 	lox_str_t *prop_name = object_str_new(name_tkn.start, name_tkn.len);
 
-	// TODO: need to make this compile-time - Currently fails will be runtime
 	if (compiler->can_assign && parser_match(compiler->prsr, TKN_EQ)) {
 		__parse_expr(compiler);
 
@@ -1033,24 +1377,14 @@ static lookup_var_t __compiler_find_name(struct compiler *compiler,
 static lookup_var_t __compiler_find_name_local(struct compiler *compiler,
 					       const char *name, size_t name_sz)
 {
-	lookup_var_t var = LOOKUP_VAR_TYPE_INVALID;
-
-	if (list_size(&compiler->lookup.scopes) == 0) {
-		return var;
+	if (list_size(&compiler->lookup.locals) == 0) {
+		return LOOKUP_VAR_TYPE_INVALID;
 	}
 
-	for (size_t i = list_size(&compiler->lookup.scopes); i != 0; i--) {
-		const lookup_t *cur_scope =
-			list_get(&compiler->lookup.scopes, i - 1);
-
-		var = lookup_find_name(cur_scope, name, name_sz);
-
-		if (lookup_var_is_valid(var)) {
-			return var;
-		}
-	}
+	const struct local *local = __compiler_find_local(
+		compiler, object_str_new(name, name_sz), 0);
 
-	return var;
+	return local ? local->var : LOOKUP_VAR_TYPE_INVALID;
 }
 
 static lookup_var_t __compiler_resolve_upval(struct compiler *compiler,
@@ -1063,7 +1397,12 @@ static lookup_var_t __compiler_resolve_upval(struct compiler *compiler,
 	lookup_var_t local =
 		__compiler_find_name_local(compiler->enclosing, name, name_sz);
 	if (lookup_var_is_valid(local)) {
-		list_push(&compiler->enclosing->captured_vals, &local.idx);
+		// immutable locals are copied in to the closure, so only mutable
+		// ones need closing once they leave scope
+		if (lookup_var_is_mutable(local)) {
+			list_push(&compiler->enclosing->captured_vals,
+				  &local.idx);
+		}
 		return __compiler_add_upvalue(compiler, local);
 	}
 
@@ -1079,32 +1418,117 @@ static lookup_var_t __compiler_resolve_upval(struct compiler *compiler,
 static lookup_var_t __compiler_add_upvalue(struct compiler *compiler,
 					   lookup_var_t upval)
 {
-	upval.var_flags |= LOOKUP_VAR_UPVAL;
-	upval.var_flags |= LOOKUP_VAR_LOCAL;
-
 	uint32_t upval_cnt = (uint32_t)list_size(&compiler->upvalues);
 
+	// enclosing locals and enclosing upvalues are indexed separately
 	for (uint32_t i = 0; i < upval_cnt; i++) {
 		lookup_var_t local_upval =
 			*(lookup_var_t *)list_get(&compiler->upvalues, i);
 
 		if (local_upval.idx == upval.idx &&
-		    !lookup_var_is_global(upval)) {
+		    lookup_var_is_upval(local_upval) ==
+			    lookup_var_is_upval(upval)) {
 			return (lookup_var_t){
 				.idx = i,
 				.var_flags = local_upval.var_flags |
-					     LOOKUP_VAR_GLOBAL,
+					     LOOKUP_VAR_UPVAL,
 			};
 		}
 	}
 
 	list_push(&compiler->upvalues, &upval);
 	upval.idx = upval_cnt;
+	upval.var_flags |= LOOKUP_VAR_UPVAL;
 
 	return upval;
 }
 
-static lookup_t *__compiler_cur_scope(struct compiler *compiler)
+/**
+ * @brief finds the innermost local in scope with the given name
+ *
+ * @param compiler the compiler
+ * @param name the interned name
+ * @param depth the outermost scope depth to search
+ * @return struct local* the local, or NULL if none is in scope
+ */
+static struct local *__compiler_find_local(struct compiler *compiler,
+					   const lox_str_t *name,
+					   uint32_t depth)
 {
-	return (lookup_t *)list_peek(&compiler->lookup.scopes);
+	struct local *locals = (struct local *)compiler->lookup.locals.data;
+
+	for (size_t i = list_size(&compiler->lookup.locals); i != 0; i--) {
+		if (locals[i - 1].depth < depth) {
+			break;
+		}
+
+		if (locals[i - 1].name == name) {
+			return &locals[i - 1];
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * @brief records the class the expression just written is known to produce
+ *
+ * @param compiler the compiler
+ * @param start the offset the expression starts at
+ * @param cls the known class
+ * @param is_instance whether the expression gives an instance of the class,
+ * rather than the class itself
+ */
+static void __compiler_set_known(struct compiler *compiler, size_t start,
+				 const lox_class_t *cls, bool is_instance)
+{
+	compiler->known = (struct known_cls){
+		.cls = cls,
+		.is_instance = is_instance,
+		.start = start,
+		.end = chunk_cur_instr(&compiler->fn->chunk),
+	};
+}
+
+/**
+ * @brief whether the class of the expression just written is known
+ *
+ * @param compiler the compiler
+ * @param start the offset the expression starts at
+ * @return true if the known class belongs to the whole expression
+ */
+static bool __compiler_is_known(struct compiler *compiler, size_t start)
+{
+	return compiler->known.cls && compiler->known.start == start &&
+	       compiler->known.end == chunk_cur_instr(&compiler->fn->chunk);
+}
+
+/**
+ * @brief records the class a variable in the current scope is known to hold
+ *
+ * @param compiler the compiler
+ * @param name the variable name
+ * @param len the name length
+ * @param cls the known class
+ * @param is_instance whether the variable holds an instance of the class
+ */
+static void __compiler_set_var_class(struct compiler *compiler,
+				     const char *name, size_t len,
+				     const lox_class_t *cls, bool is_instance)
+{
+	if (compiler->lookup.depth == 0) {
+		lookup_set_class(&compiler->global_state->globals, name, len,
+				 cls, is_instance);
+		return;
+	}
+
+	struct local *local = __compiler_find_local(
+		compiler, object_str_new(name, len), compiler->lookup.depth);
+
+	if (local) {
+		local->var.cls = cls;
+		local->var.var_flags &= ~LOOKUP_VAR_INSTANCE;
+		local->var.var_flags |= is_instance ? LOOKUP_VAR_INSTANCE :
+						      LOOKUP_VAR_CLASS;
+	}
 }
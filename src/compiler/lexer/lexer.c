@@ -83,7 +83,8 @@ token_t lexer_next_token(lexer_t *lexer)
 	case ',':
 		return TOKEN(lexer, TKN_COMMA);
 	case '.':
-		return TOKEN(lexer, TKN_DOT);
+		return TOKEN(lexer, __lexer_match_char(lexer, '.') ? TKN_DOT_DOT :
+								     TKN_DOT);
 	case '-':
 		return TOKEN(lexer, TKN_MINUS);
 	case '+':
@@ -32,6 +32,7 @@ enum tkn_type {
 	TKN_EQ_EQ, // ==
 	TKN_LESS_EQ, // <=
 	TKN_GREATER_EQ, // >=
+	TKN_DOT_DOT, // ..
 	// Literals
 	TKN_ID, // {variable name}
 	TKN_STR, // "..."
@@ -0,0 +1,437 @@
+#include "peephole.h"
+#include "chunk/func/chunk_func.h"
+#include "ops/ops.h"
+
+#include <assert.h>
+#include <string.h>
+
+//! @brief most jumps followed when threading a single jump
+#define PEEPHOLE_MAX_HOPS 8
+
+//! @brief op found while walking the chunk
+struct peep_op {
+	size_t offset;
+	//! @brief offset jumped to. Only set for jumps
+	size_t target;
+	code_t code;
+	uint8_t len;
+	bool is_jump;
+	bool removed;
+};
+
+//! @brief state of a single pass over a chunk
+struct peephole {
+	const code_t *code;
+	size_t code_cnt;
+	struct peep_op *ops;
+	size_t op_cnt;
+	//! @brief op index of each op offset
+	size_t *op_at;
+	//! @brief whether each offset is jumped to
+	bool *is_target;
+	//! @brief line of each offset
+	uint32_t *lines;
+};
+
+static bool __op_is_jump(code_t code);
+static bool __op_is_exit(code_t code);
+static bool __op_is_pure_push(code_t code);
+static void __thread_jumps(struct peephole *pass);
+static void __mark_targets(struct peephole *pass);
+static bool __remove_dead(struct peephole *pass);
+static void __remove_push_pops(struct peephole *pass);
+static void __remove_empty_jumps(struct peephole *pass);
+static void __write_ops(struct peephole *pass, chunk_t *out);
+static void __remap_locals(struct peephole *pass, chunk_t *chunk);
+static size_t __write_pops(struct peephole *pass, chunk_t *out, size_t idx,
+			   uint32_t line);
+
+void peephole_run(chunk_t *chunk)
+{
+	size_t code_cnt = chunk_cur_instr(chunk);
+
+	if (!code_cnt) {
+		return;
+	}
+
+	struct peephole pass = {
+		.code = (const code_t *)chunk->code.data,
+		.code_cnt = code_cnt,
+		.op_at = reallocate(NULL, 0, sizeof(size_t) * (code_cnt + 1)),
+		.is_target = reallocate(NULL, 0, sizeof(bool) * (code_cnt + 1)),
+		.lines = reallocate(NULL, 0, sizeof(uint32_t) * code_cnt),
+	};
+	list_t ops = list_of_type(struct peep_op);
+
+	chunk_get_lines(chunk, pass.lines);
+
+	for (size_t offset = 0; offset < code_cnt;) {
+		struct peep_op op = {
+			.offset = offset,
+			.code = pass.code[offset],
+			.len = op_len(pass.code[offset]),
+			.is_jump = __op_is_jump(pass.code[offset]),
+		};
+
+		assert(("Unknown op in chunk", op.len != 0));
+
+		if (op.is_jump) {
+			int16_t jump;
+
+			memcpy(&jump, pass.code + offset + op.len - 2, 2);
+			op.target = offset + op.len + jump;
+		}
+
+		pass.op_at[offset] = list_push(&ops, &op);
+		offset += op.len;
+	}
+
+	pass.ops = (struct peep_op *)ops.data;
+	pass.op_cnt = list_size(&ops);
+
+	__thread_jumps(&pass);
+
+	// removing dead jumps can leave the code they jumped to dead as well
+	do {
+		__mark_targets(&pass);
+	} while (__remove_dead(&pass));
+
+	__remove_push_pops(&pass);
+	__remove_empty_jumps(&pass);
+
+	chunk_t out = chunk_new();
+
+	__write_ops(&pass, &out);
+	__remap_locals(&pass, chunk);
+	chunk_replace_code(chunk, &out);
+
+	reallocate(pass.op_at, sizeof(size_t) * (code_cnt + 1), 0);
+	reallocate(pass.is_target, sizeof(bool) * (code_cnt + 1), 0);
+	reallocate(pass.lines, sizeof(uint32_t) * code_cnt, 0);
+	list_free(&ops);
+}
+
+/**
+ * @brief retargets jumps which land on an OP_JUMP to where that jump goes.
+ * A jump is only threaded while its distance fits in the current layout, as
+ * the pass only ever shrinks the code
+ *
+ * @param pass the pass state
+ */
+static void __thread_jumps(struct peephole *pass)
+{
+	for (size_t idx = 0; idx < pass->op_cnt; idx++) {
+		struct peep_op *op = &pass->ops[idx];
+
+		if (!op->is_jump) {
+			continue;
+		}
+
+		long op_end = (long)(op->offset + op->len);
+
+		for (int hops = 0; hops < PEEPHOLE_MAX_HOPS; hops++) {
+			if (op->target >= pass->code_cnt ||
+			    pass->code[op->target] != OP_JUMP) {
+				break;
+			}
+
+			size_t next = pass->ops[pass->op_at[op->target]].target;
+			long dist = (long)next - op_end;
+
+			if (next == op->target || dist > INT16_MAX ||
+			    dist < INT16_MIN) {
+				break;
+			}
+
+			op->target = next;
+		}
+	}
+}
+
+//! @brief marks the offset every kept jump lands on
+static void __mark_targets(struct peephole *pass)
+{
+	memset(pass->is_target, 0, sizeof(bool) * (pass->code_cnt + 1));
+
+	for (size_t idx = 0; idx < pass->op_cnt; idx++) {
+		if (pass->ops[idx].is_jump && !pass->ops[idx].removed) {
+			pass->is_target[pass->ops[idx].target] = true;
+		}
+	}
+}
+
+/**
+ * @brief removes the ops following an exit up until the next jump target.
+ * This drops the implicit nil return written after an explicit return
+ *
+ * @param pass the pass state
+ * @return bool whether any ops were removed
+ */
+static bool __remove_dead(struct peephole *pass)
+{
+	bool dead = false;
+	bool changed = false;
+
+	for (size_t idx = 0; idx < pass->op_cnt; idx++) {
+		struct peep_op *op = &pass->ops[idx];
+
+		if (pass->is_target[op->offset]) {
+			dead = false;
+		}
+
+		if (dead) {
+			changed |= !op->removed;
+			op->removed = true;
+		} else {
+			dead = __op_is_exit(op->code);
+		}
+	}
+
+	return changed;
+}
+
+/**
+ * @brief removes values which are pushed and then popped straight away, such
+ * as a local read as an expression statement
+ *
+ * @param pass the pass state
+ */
+static void __remove_push_pops(struct peephole *pass)
+{
+	for (size_t idx = 0; idx + 1 < pass->op_cnt; idx++) {
+		struct peep_op *push = &pass->ops[idx];
+		struct peep_op *pop = &pass->ops[idx + 1];
+
+		if (push->removed || pop->removed || pop->code != OP_POP ||
+		    !__op_is_pure_push(push->code) ||
+		    pass->is_target[pop->offset]) {
+			continue;
+		}
+
+		push->removed = pop->removed = true;
+		idx++;
+	}
+}
+
+//! @brief removes jumps which land on the op they would fall through to
+static void __remove_empty_jumps(struct peephole *pass)
+{
+	for (size_t idx = 0; idx < pass->op_cnt; idx++) {
+		struct peep_op *op = &pass->ops[idx];
+
+		if (op->removed || op->code != OP_JUMP ||
+		    op->target <= op->offset) {
+			continue;
+		}
+
+		size_t next = idx + 1;
+
+		while (next < pass->op_cnt && pass->ops[next].removed &&
+		       pass->ops[next].offset < op->target) {
+			next++;
+		}
+
+		size_t next_offset = next < pass->op_cnt ?
+					     pass->ops[next].offset :
+					     pass->code_cnt;
+
+		if (next_offset == op->target) {
+			op->removed = true;
+		}
+	}
+}
+
+/**
+ * @brief writes the kept ops to a new chunk and patches the jumps.
+ * Removed ops map to the next op written, so jumps to them land where they
+ * would have fallen through to
+ *
+ * @param pass the pass state
+ * @param out the chunk to write to
+ */
+static void __write_ops(struct peephole *pass, chunk_t *out)
+{
+	// op indexes are not needed once the ops are written
+	size_t *new_offsets = pass->op_at;
+
+	for (size_t idx = 0; idx < pass->op_cnt; idx++) {
+		struct peep_op *op = &pass->ops[idx];
+
+		new_offsets[op->offset] = chunk_cur_instr(out);
+
+		if (op->removed) {
+			continue;
+		}
+
+		if (op->code == OP_POP || op->code == OP_POP_COUNT) {
+			idx = __write_pops(pass, out, idx, pass->lines[op->offset]);
+			continue;
+		}
+
+		for (size_t byte = op->offset; byte < op->offset + op->len;
+		     byte++) {
+			chunk_write_code(out, pass->code[byte], pass->lines[byte]);
+		}
+	}
+	new_offsets[pass->code_cnt] = chunk_cur_instr(out);
+
+	for (size_t idx = 0; idx < pass->op_cnt; idx++) {
+		struct peep_op *op = &pass->ops[idx];
+
+		if (op->removed || !op->is_jump) {
+			continue;
+		}
+
+		size_t op_end = new_offsets[op->offset] + op->len;
+		long jump = (long)new_offsets[op->target] - (long)op_end;
+
+		assert(("Threaded jump must fit", jump >= INT16_MIN &&
+							   jump <= INT16_MAX));
+
+		int16_t short_jump = (int16_t)jump;
+
+		chunk_patch_code(out, op_end - 2, &short_jump, 2);
+	}
+}
+
+/**
+ * @brief moves the start of each local name to where its op was written.
+ * A start within an op, left by a later fusion, moves to the next op
+ *
+ * @param pass the pass state, after the ops are written
+ * @param chunk the chunk the locals belong to
+ */
+static void __remap_locals(struct peephole *pass, chunk_t *chunk)
+{
+	size_t *new_offsets = pass->op_at;
+	size_t idx = 0;
+
+	// locals are mostly declared in code order, so the walk rarely restarts
+	for (size_t local = 0; local < list_size(&chunk->locals); local++) {
+		struct chunk_local *cur = list_get(&chunk->locals, local);
+
+		if (idx && pass->ops[idx - 1].offset >= cur->start) {
+			idx = 0;
+		}
+
+		while (idx < pass->op_cnt && pass->ops[idx].offset < cur->start) {
+			idx++;
+		}
+
+		size_t offset = idx < pass->op_cnt ? pass->ops[idx].offset :
+						     pass->code_cnt;
+
+		cur->start = (uint32_t)new_offsets[offset];
+	}
+}
+
+/**
+ * @brief writes a run of pops as few ops as possible. The run ends at the
+ * first op which is jumped to
+ *
+ * @param pass the pass state
+ * @param out the chunk to write to
+ * @param idx the index of the first pop
+ * @param line the line of the first pop
+ * @return size_t the index of the last op in the run
+ */
+static size_t __write_pops(struct peephole *pass, chunk_t *out, size_t idx,
+			   uint32_t line)
+{
+	size_t *new_offsets = pass->op_at;
+	uint32_t cnt = 0;
+	size_t last = idx;
+
+	for (size_t cur = idx; cur < pass->op_cnt; cur++) {
+		struct peep_op *op = &pass->ops[cur];
+
+		if (cur != idx && pass->is_target[op->offset]) {
+			break;
+		}
+
+		if (op->removed) {
+			new_offsets[op->offset] = chunk_cur_instr(out);
+			continue;
+		}
+
+		if (op->code == OP_POP) {
+			cnt++;
+		} else if (op->code == OP_POP_COUNT) {
+			cnt += pass->code[op->offset + 1];
+		} else {
+			break;
+		}
+
+		new_offsets[op->offset] = chunk_cur_instr(out);
+		last = cur;
+	}
+
+	while (cnt) {
+		uint32_t written = cnt > UINT8_MAX ? UINT8_MAX : cnt;
+
+		if (written == 1) {
+			chunk_write_code(out, OP_POP, line);
+		} else {
+			chunk_write_code(out, OP_POP_COUNT, line);
+			chunk_write_code(out, (code_t)written, line);
+		}
+
+		cnt -= written;
+	}
+
+	return last;
+}
+
+/**
+ * @brief whether the op holds a jump offset as its last two bytes
+ *
+ * @param code the op code
+ * @return bool whether the op jumps
+ */
+static bool __op_is_jump(code_t code)
+{
+	switch (code) {
+	case OP_JUMP:
+	case OP_JUMP_IF_FALSE:
+	case OP_JUMP_IF_FALSE_POP:
+	case OP_JUMP_IF_NOT_EQUAL:
+	case OP_JUMP_IF_NOT_GREATER:
+	case OP_JUMP_IF_NOT_LESS:
+	case OP_JUMP_IF_NOT_GREATER_EQ:
+	case OP_JUMP_IF_NOT_LESS_EQ:
+	case OP_JUMP_IF_EQUAL:
+	case OP_JUMP_IF_NOT_EQUAL_REG:
+	case OP_JUMP_IF_NOT_GREATER_REG:
+	case OP_JUMP_IF_NOT_LESS_REG:
+	case OP_JUMP_IF_NOT_GREATER_EQ_REG:
+	case OP_JUMP_IF_NOT_LESS_EQ_REG:
+	case OP_JUMP_IF_EQUAL_REG:
+	case OP_FOR_RANGE_INIT:
+	case OP_FOR_RANGE:
+		return true;
+	default:
+		return false;
+	}
+}
+
+//! @brief whether the op never falls through to the next op
+static bool __op_is_exit(code_t code)
+{
+	return code == OP_RETURN || code == OP_TAIL_CALL || code == OP_JUMP;
+}
+
+//! @brief whether the op only pushes a single value
+static bool __op_is_pure_push(code_t code)
+{
+	switch (code) {
+	case OP_NIL:
+	case OP_TRUE:
+	case OP_FALSE:
+	case OP_CONSTANT:
+	case OP_VAR_GET:
+	case OP_UPVALUE_COPY_GET:
+		return true;
+	default:
+		return false;
+	}
+}
@@ -0,0 +1,23 @@
+/**
+ * @file peephole.h
+ * @author Dylan Mayor
+ * @brief header file for the peephole pass run over finished chunks
+ *
+ * The compiler writes code in a single pass, so can't see what comes after
+ * each op. Once a chunk is finished, the pass removes unreachable code and
+ * values which are pushed only to be popped, merges pops and threads jumps
+ * which land on other jumps. Line information is kept for every op left.
+ */
+#ifndef __CLOX_COMPILER_PEEPHOLE_H__
+#define __CLOX_COMPILER_PEEPHOLE_H__
+
+#include "chunk/chunk.h"
+
+/**
+ * @brief runs the peephole pass over a finished chunk
+ *
+ * @param chunk the chunk to optimize
+ */
+void peephole_run(chunk_t *chunk);
+
+#endif // __CLOX_COMPILER_PEEPHOLE_H__
@@ -5,20 +5,38 @@
 #include "val/func/val_func.h"
 #include "chunk/func/chunk_func.h"
 
-static size_t __simple_instr(const char *, size_t);
-static size_t __const_instr(const char *, chunk_t *, uint32_t);
-static size_t __const_long_instr(const char *, chunk_t *, uint32_t);
-static size_t __closure_instr(const char *, chunk_t *, uint32_t);
-static size_t __closure_long_instr(const char *, chunk_t *, uint32_t);
-static size_t __var_instr(const char *, chunk_t *, uint32_t);
-static size_t __upval_def_instr(const char *, chunk_t *, uint32_t);
-static size_t __upval_def_long_instr(const char *, chunk_t *, uint32_t);
-static size_t __var_long_instr(const char *, chunk_t *, uint32_t);
-static size_t __pop_count_instr(const char *, chunk_t *, uint32_t);
-static size_t __jump_instr(const char *, chunk_t *, uint32_t);
+static void __simple_instr(const char *);
+static void __const_instr(const char *, chunk_t *, uint32_t);
+static void __const_long_instr(const char *, chunk_t *, uint32_t);
+static void __prop_instr(const char *, chunk_t *, uint32_t);
+static void __prop_long_instr(const char *, chunk_t *, uint32_t);
+static void __closure_instr(const char *, chunk_t *, uint32_t);
+static void __closure_long_instr(const char *, chunk_t *, uint32_t);
+static void __var_instr(const char *, chunk_t *, uint32_t);
+static void __print_prop(const char *name, chunk_t *chunk, uint32_t cache_pos)
+{
+	const struct prop_cache *cache = chunk_get_prop_cache(chunk, cache_pos);
+
+	printf(" %-20s | #%04d $ '", name, cache_pos);
+	val_print(chunk_get_const(chunk, cache->name_idx));
+	putchar('\'');
+	puts("");
+}
+
+static void __var_long_instr(const char *, chunk_t *, uint32_t);
+static void __var_const_instr(const char *, chunk_t *, uint32_t);
+static void __local_instr(const char *, chunk_t *, uint32_t);
+static void __local_long_instr(const char *, chunk_t *, uint32_t);
+static void __reg_instr(const char *, chunk_t *, uint32_t);
+static void __reg_jump_instr(const char *, chunk_t *, uint32_t);
+static void __pop_count_instr(const char *, chunk_t *, uint32_t);
+static void __jump_instr(const char *, chunk_t *, uint32_t);
+static void __range_instr(const char *, chunk_t *, uint32_t);
 static uint32_t __get_ext_pos(chunk_t *, uint32_t);
-static size_t __call_instr(const char *, chunk_t *, size_t);
+static void __call_instr(const char *, chunk_t *, size_t);
 static void __print_const(const char *, lox_val_t, uint32_t);
+static void __print_prop(const char *, chunk_t *, uint32_t);
+static void __print_local(chunk_t *, uint32_t, uint32_t);
 
 void disassem_chunk(chunk_t *chnk, const char *name)
 {
@@ -47,61 +65,131 @@ size_t disassem_inst(chunk_t *chunk, size_t offset)
 	switch (instruction) {
 	case OP_PROPERTY_GET:
 	case OP_PROPERTY_SET:
-	case OP_CONSTANT:
-		return __const_instr(op_name(instruction), chunk, offset);
+	case OP_PROPERTY_SET_POP:
+		__prop_instr(op_name(instruction), chunk, offset);
+		break;
 
 	case OP_PROPERTY_GET_LONG:
 	case OP_PROPERTY_SET_LONG:
+		__prop_long_instr(op_name(instruction), chunk, offset);
+		break;
+
+	case OP_CONSTANT:
+		__const_instr(op_name(instruction), chunk, offset);
+		break;
+
 	case OP_CONSTANT_LONG:
-		return __const_long_instr(op_name(instruction), chunk, offset);
+		__const_long_instr(op_name(instruction), chunk, offset);
+		break;
 
 	case OP_CLOSURE:
-		return __closure_instr(op_name(instruction), chunk, offset);
+		__closure_instr(op_name(instruction), chunk, offset);
+		break;
 
 	case OP_CLOSURE_LONG:
-		return __closure_long_instr(op_name(instruction), chunk,
-					    offset);
+		__closure_long_instr(op_name(instruction), chunk, offset);
+		break;
 
 	case OP_UPVALUE_DEFINE:
-		return __upval_def_instr(op_name(instruction), chunk, offset);
+		__var_instr(op_name(instruction), chunk, offset);
+		break;
 
 	case OP_UPVALUE_DEFINE_LONG:
-		return __upval_def_long_instr(op_name(instruction), chunk,
-					      offset);
+		__var_long_instr(op_name(instruction), chunk, offset);
+		break;
 
 	case OP_POP_COUNT:
-		return __pop_count_instr(op_name(instruction), chunk, offset);
+		__pop_count_instr(op_name(instruction), chunk, offset);
+		break;
 
 	case OP_JUMP:
-		return __jump_instr(op_name(instruction), chunk, offset);
+		__jump_instr(op_name(instruction), chunk, offset);
+		break;
 
 	case OP_JUMP_IF_FALSE:
-		return __jump_instr(op_name(instruction), chunk, offset);
+	case OP_JUMP_IF_FALSE_POP:
+	case OP_JUMP_IF_NOT_EQUAL:
+	case OP_JUMP_IF_NOT_GREATER:
+	case OP_JUMP_IF_NOT_LESS:
+	case OP_JUMP_IF_NOT_GREATER_EQ:
+	case OP_JUMP_IF_NOT_LESS_EQ:
+	case OP_JUMP_IF_EQUAL:
+		__jump_instr(op_name(instruction), chunk, offset);
+		break;
+
+	case OP_JUMP_IF_NOT_EQUAL_REG:
+	case OP_JUMP_IF_NOT_GREATER_REG:
+	case OP_JUMP_IF_NOT_LESS_REG:
+	case OP_JUMP_IF_NOT_GREATER_EQ_REG:
+	case OP_JUMP_IF_NOT_LESS_EQ_REG:
+	case OP_JUMP_IF_EQUAL_REG:
+		__reg_jump_instr(op_name(instruction), chunk, offset);
+		break;
+
+	case OP_FOR_RANGE_INIT:
+	case OP_FOR_RANGE:
+		__range_instr(op_name(instruction), chunk, offset);
+		break;
 
 	case OP_CALL:
-		return __call_instr(op_name(instruction), chunk, offset);
+	case OP_TAIL_CALL:
+		__call_instr(op_name(instruction), chunk, offset);
+		break;
 
 	case OP_PROPERTY_DEFINE:
 	case OP_UPVALUE_SET:
 	case OP_UPVALUE_GET:
+	case OP_UPVALUE_COPY_GET:
 	case OP_GLOBAL_DEFINE:
 	case OP_GLOBAL_SET:
+	case OP_GLOBAL_SET_POP:
 	case OP_GLOBAL_GET:
+	case OP_FIELD_GET:
+	case OP_FIELD_SET:
+	case OP_FIELD_SET_POP:
+		__var_instr(op_name(instruction), chunk, offset);
+		break;
+
+	case OP_ADD_REG:
+	case OP_SUBTRACT_REG:
+	case OP_MULTIPLY_REG:
+	case OP_DIVIDE_REG:
+	case OP_MOD_REG:
+	case OP_EQUAL_REG:
+	case OP_GREATER_REG:
+	case OP_LESS_REG:
+	case OP_GREATER_EQ_REG:
+	case OP_LESS_EQ_REG:
+	case OP_NOT_EQUAL_REG:
+		__reg_instr(op_name(instruction), chunk, offset);
+		break;
+
+	case OP_VAR_GET_CONST:
+		__var_const_instr(op_name(instruction), chunk, offset);
+		break;
+
 	case OP_VAR_SET:
+	case OP_VAR_SET_POP:
 	case OP_VAR_GET:
-	case OP_VAR_DEFINE:
-		return __var_instr(op_name(instruction), chunk, offset);
+		__local_instr(op_name(instruction), chunk, offset);
+		break;
+
+	case OP_VAR_SET_LONG:
+	case OP_VAR_GET_LONG:
+		__local_long_instr(op_name(instruction), chunk, offset);
+		break;
 
 	case OP_PROPERTY_DEFINE_LONG:
 	case OP_UPVALUE_GET_LONG:
 	case OP_UPVALUE_SET_LONG:
-	case OP_VAR_DEFINE_LONG:
-	case OP_VAR_SET_LONG:
+	case OP_UPVALUE_COPY_GET_LONG:
 	case OP_GLOBAL_DEFINE_LONG:
 	case OP_GLOBAL_SET_LONG:
 	case OP_GLOBAL_GET_LONG:
-	case OP_VAR_GET_LONG:
-		return __var_long_instr(op_name(instruction), chunk, offset);
+	case OP_FIELD_GET_LONG:
+	case OP_FIELD_SET_LONG:
+		__var_long_instr(op_name(instruction), chunk, offset);
+		break;
 
 	case OP_CLOSE_UPVALUE:
 	case OP_RETURN:
@@ -109,110 +197,203 @@ size_t disassem_inst(chunk_t *chunk, size_t offset)
 	case OP_TRUE:
 	case OP_FALSE:
 	case OP_ADD:
+	case OP_ADD_NUM:
+	case OP_ADD_STR:
 	case OP_SUBTRACT:
 	case OP_DIVIDE:
 	case OP_MULTIPLY:
 	case OP_NEGATE:
 	case OP_NOT:
 	case OP_EQUAL:
+	case OP_EQUAL_NUM:
 	case OP_GREATER:
 	case OP_LESS:
+	case OP_GREATER_EQ:
+	case OP_LESS_EQ:
+	case OP_NOT_EQUAL:
 	case OP_POP:
 	case OP_MOD:
 	case OP_NOP:
-		return __simple_instr(op_name(instruction), offset);
+		__simple_instr(op_name(instruction));
+		break;
 
 	default:
 		printf("Unknown opcode %u\n", instruction);
 		return offset + 1;
 	}
+
+	return offset + op_len(instruction);
 }
 
-static size_t __call_instr(const char *name, chunk_t *chunk, size_t offset)
+static void __call_instr(const char *name, chunk_t *chunk, size_t offset)
 {
 	printf(" %-20s | %04d\n", name, chunk_get_code(chunk, offset + 1));
-
-	return offset + 2;
 }
 
-static size_t __simple_instr(const char *name, size_t offset)
+static void __simple_instr(const char *name)
 {
 	printf(" %s\n", name);
-
-	return offset + 1;
 }
 
-static size_t __const_instr(const char *name, chunk_t *chunk, uint32_t offset)
+static void __const_instr(const char *name, chunk_t *chunk, uint32_t offset)
 {
 	code_t const_pos = chunk_get_code(chunk, offset + 1);
 	__print_const(name, chunk_get_const(chunk, const_pos), const_pos);
-
-	return offset + 2;
 }
 
-static size_t __const_long_instr(const char *name, chunk_t *chunk,
+static void __const_long_instr(const char *name, chunk_t *chunk,
 				 uint32_t offset)
 {
 	uint32_t const_pos = __get_ext_pos(chunk, offset);
 	__print_const(name, chunk_get_const(chunk, const_pos), const_pos);
+}
 
-	return offset + 4;
+static void __prop_instr(const char *name, chunk_t *chunk, uint32_t offset)
+{
+	__print_prop(name, chunk, chunk_get_code(chunk, offset + 1));
+}
+
+static void __prop_long_instr(const char *name, chunk_t *chunk,
+				uint32_t offset)
+{
+	__print_prop(name, chunk, __get_ext_pos(chunk, offset));
 }
 
-static size_t __closure_instr(const char *name, chunk_t *chunk, uint32_t offset)
+static void __closure_instr(const char *name, chunk_t *chunk, uint32_t offset)
 {
 	code_t const_pos = chunk_get_code(chunk, offset + 1);
 	__print_const(name, chunk_get_const(chunk, const_pos), const_pos);
-
-	return offset + 2;
 }
 
-static size_t __closure_long_instr(const char *name, chunk_t *chunk,
+static void __closure_long_instr(const char *name, chunk_t *chunk,
 				   uint32_t offset)
 {
 	uint32_t const_pos = __get_ext_pos(chunk, offset);
 	__print_const(name, chunk_get_const(chunk, const_pos), const_pos);
-
-	return offset + 4;
 }
 
-static size_t __var_instr(const char *name, chunk_t *chunk, uint32_t offset)
+static void __var_instr(const char *name, chunk_t *chunk, uint32_t offset)
 {
 	code_t var_pos = chunk_get_code(chunk, offset + 1);
 	printf(" %-20s |  %04d | ", name, var_pos);
 	puts("");
-
-	return offset + 2;
 }
 
-static size_t __var_long_instr(const char *name, chunk_t *chunk,
+static void __var_long_instr(const char *name, chunk_t *chunk,
 			       uint32_t offset)
 {
 	uint32_t var_pos = __get_ext_pos(chunk, offset);
 	printf(" %-20s |  %04d | ", name, var_pos);
 	puts("");
+}
+
+static void __var_const_instr(const char *name, chunk_t *chunk,
+				uint32_t offset)
+{
+	code_t var_pos = chunk_get_code(chunk, offset + 1);
+	code_t const_pos = chunk_get_code(chunk, offset + 2);
+
+	printf(" %-20s |  %04d | @%04d $ '", name, var_pos, const_pos);
+	val_print(chunk_get_const(chunk, const_pos));
+	putchar('\'');
+	__print_local(chunk, var_pos, offset);
+	puts("");
+}
+
+static void __local_instr(const char *name, chunk_t *chunk, uint32_t offset)
+{
+	code_t var_pos = chunk_get_code(chunk, offset + 1);
+	printf(" %-20s |  %04d |", name, var_pos);
+	__print_local(chunk, var_pos, offset);
+	puts("");
+}
+
+static void __local_long_instr(const char *name, chunk_t *chunk,
+				 uint32_t offset)
+{
+	uint32_t var_pos = __get_ext_pos(chunk, offset);
+	printf(" %-20s |  %04d |", name, var_pos);
+	__print_local(chunk, var_pos, offset);
+	puts("");
+}
+
+//! @brief prints the name of the local in a slot, if the chunk kept it
+static void __print_local(chunk_t *chunk, uint32_t slot, uint32_t offset)
+{
+	struct object_str *local = chunk_get_local(chunk, slot, offset);
+
+	if (local) {
+		printf(" '%.*s'", (int)local->len, local->chars);
+	}
+}
+
+static void __print_reg_operand(chunk_t *chunk, code_t operand)
+{
+	if (operand & REG_CONST_FLAG) {
+		printf("@%04d $ '", operand & ~REG_CONST_FLAG);
+		val_print(chunk_get_const(chunk, operand & ~REG_CONST_FLAG));
+		putchar('\'');
+	} else {
+		printf("%04d", operand);
+	}
+}
+
+static void __reg_instr(const char *name, chunk_t *chunk, uint32_t offset)
+{
+	code_t dest = chunk_get_code(chunk, offset + 1);
+
+	printf(" %-20s | ", name);
+
+	if (dest == REG_DEST_PUSH) {
+		printf("push");
+	} else {
+		printf("%04d", dest);
+	}
 
-	return offset + 2;
+	printf(" <- ");
+	__print_reg_operand(chunk, chunk_get_code(chunk, offset + 2));
+	printf(", ");
+	__print_reg_operand(chunk, chunk_get_code(chunk, offset + 3));
+	puts("");
 }
 
-static size_t __pop_count_instr(const char *name, chunk_t *chunk,
+static void __reg_jump_instr(const char *name, chunk_t *chunk,
+			       uint32_t offset)
+{
+	int16_t jump_pos = *((int16_t *)list_get(&chunk->code, offset + 3));
+
+	printf(" %-20s | ", name);
+	__print_reg_operand(chunk, chunk_get_code(chunk, offset + 1));
+	printf(", ");
+	__print_reg_operand(chunk, chunk_get_code(chunk, offset + 2));
+	printf(" | *%04d -> *%04d ", offset, offset + 5 + jump_pos);
+	puts("");
+}
+
+static void __pop_count_instr(const char *name, chunk_t *chunk,
 				uint32_t offset)
 {
 	code_t pop_cnt = chunk_get_code(chunk, offset + 1);
 	printf(" %-20s |  %04d", name, pop_cnt);
 	puts("");
-
-	return offset + 2;
 }
 
-static size_t __jump_instr(const char *name, chunk_t *chunk, uint32_t offset)
+static void __jump_instr(const char *name, chunk_t *chunk, uint32_t offset)
 {
 	int16_t jump_pos = *((int16_t *)list_get(&chunk->code, offset + 1));
 
 	printf(" %-20s | *%04d -> *%04d ", name, offset, offset + 3 + jump_pos);
 	puts("");
+}
 
-	return offset + 3;
+static void __range_instr(const char *name, chunk_t *chunk, uint32_t offset)
+{
+	code_t counter = chunk_get_code(chunk, offset + 1);
+	int16_t jump_pos = *((int16_t *)list_get(&chunk->code, offset + 2));
+
+	printf(" %-20s |  %04d | *%04d -> *%04d ", name, counter, offset,
+	       offset + 4 + jump_pos);
+	puts("");
 }
 
 static uint32_t __get_ext_pos(chunk_t *chunk, uint32_t offset)
@@ -229,15 +410,3 @@ static void __print_const(const char *name, lox_val_t const_val,
 	putchar('\'');
 	puts("");
 }
-
-static size_t __upval_def_instr(const char *name, chunk_t *chunk,
-				uint32_t offset)
-{
-	return __var_instr(name, chunk, offset) + 1;
-}
-
-static size_t __upval_def_long_instr(const char *name, chunk_t *chunk,
-				     uint32_t offset)
-{
-	return __var_long_instr(name, chunk, offset) + 1;
-}
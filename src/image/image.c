@@ -0,0 +1,1070 @@
+#include "image.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "api/sys.h"
+#include "chunk/func/chunk_func.h"
+#include "ops/ops.h"
+#include "util/list/list.h"
+#include "util/map/hash_util.h"
+#include "util/string/string_util.h"
+#include "val/func/object_func.h"
+#include "val/func/val_func.h"
+
+//! @brief number of ops known to this build
+#define X(op, width) +1
+static const uint32_t IMAGE_OP_CNT = 0
+#include "ops/ops_table.h"
+	;
+#undef X
+
+//! @brief tags of the constant kinds an image can hold
+enum image_tag {
+	IMAGE_TAG_NIL,
+	IMAGE_TAG_FALSE,
+	IMAGE_TAG_TRUE,
+	IMAGE_TAG_NUMBER,
+	IMAGE_TAG_STRING,
+	IMAGE_TAG_FN,
+	IMAGE_TAG_NATIVE,
+	IMAGE_TAG_CLASS,
+};
+
+//! @brief size of a function table entry, the record offset and checksum
+#define IMAGE_TABLE_ENTRY_SZ (sizeof(uint32_t) * 2)
+
+//! @brief lookup entry writer, called for each variable of a lookup table
+struct lookup_writer {
+	struct map_for_each_entry for_each;
+	list_t *out;
+};
+
+//! @brief functions of a program, in the order of the function table
+struct image_fns {
+	//! @brief the functions, each followed by the functions it holds
+	list_t fns;
+	//! @brief number of functions each function holds, itself included
+	list_t sizes;
+};
+
+//! @brief loaded image. Kept for as long as its functions can be loaded
+struct image {
+	uint8_t *buf;
+	size_t buf_sz;
+	uint32_t fn_cnt;
+	const uint8_t *fn_table;
+	//! @brief number of globals, which global operands must be below
+	uint32_t global_cnt;
+};
+
+//! @brief state of the code check of a loaded function
+struct code_check {
+	lox_fn_t *fn;
+	const code_t *code;
+	size_t code_cnt;
+	uint32_t global_cnt;
+	//! @brief offsets jumped to, checked once every op start is known
+	list_t targets;
+};
+
+//! @brief position within an image being loaded
+struct image_reader {
+	struct image *image;
+	size_t pos;
+	//! @brief set once a read runs past the end or finds bad data
+	bool failed;
+};
+
+static void __write_u8(list_t *out, uint8_t val);
+static void __write_u32(list_t *out, uint32_t val);
+static void __patch_u32(list_t *out, size_t pos, uint32_t val);
+static void __write_str(list_t *out, const char *chars, size_t len);
+static void __write_lookup(list_t *out, lookup_t *lookup);
+static void __write_lookup_var(struct map_entry, struct map_for_each_entry *);
+static uint32_t __collect_fns(struct image_fns *fns, lox_fn_t *fn);
+static bool __write_fn(list_t *out, struct image_fns *fns, size_t idx);
+static bool __write_val(list_t *out, lox_val_t val, uint32_t fn_idx);
+static const char *__native_name(native_fn fn);
+
+static uint8_t __read_u8(struct image_reader *reader);
+static uint32_t __read_u32(struct image_reader *reader);
+static uint32_t __get_u32(const uint8_t *bytes);
+static uint8_t *__read_bytes(struct image_reader *reader, size_t cnt);
+static lox_str_t *__read_str(struct image_reader *reader);
+static void __read_lookup(struct image_reader *reader, lookup_t *lookup);
+static struct image_reader __fn_reader(struct image *image, uint32_t idx,
+					size_t *end);
+static lox_fn_t *__read_fn(struct image *image, uint32_t idx);
+static void __read_chunk(struct image_reader *reader, chunk_t *chunk);
+static lox_val_t __read_val(struct image_reader *reader);
+static native_fn __native_fn(const lox_str_t *name);
+
+static bool __check_code(lox_fn_t *fn, uint32_t global_cnt);
+static size_t __check_op(struct code_check *check, size_t offset);
+static size_t __check_closure(struct code_check *check, size_t offset,
+			      size_t len, uint32_t idx);
+static size_t __check_jump(struct code_check *check, size_t offset,
+			   size_t len);
+static bool __check_slot(struct code_check *check, uint32_t slot);
+static bool __check_const(struct code_check *check, uint32_t idx);
+static bool __check_reg(struct code_check *check, code_t operand);
+static bool __op_is_exit(code_t code);
+
+bool image_is_image(const uint8_t *buf, size_t buf_sz)
+{
+	return buf_sz >= IMAGE_MAGIC_SZ &&
+	       memcmp(buf, IMAGE_MAGIC, IMAGE_MAGIC_SZ) == 0;
+}
+
+bool image_save(const char *path, lox_fn_t *main, struct state *state)
+{
+	list_t out = list_of_type(uint8_t);
+	struct image_fns fns = {
+		.fns = list_of_type(lox_fn_t *),
+		.sizes = list_of_type(uint32_t),
+	};
+	uint32_t fn_cnt = __collect_fns(&fns, main);
+
+	list_push_bulk(&out, IMAGE_MAGIC, IMAGE_MAGIC_SZ);
+	__write_u32(&out, IMAGE_VERSION);
+	__write_u32(&out, IMAGE_OP_CNT);
+	__write_u32(&out, fn_cnt);
+
+	// the table is filled in as the records are written
+	size_t table_pos =
+		list_push_bulk(&out, NULL, IMAGE_TABLE_ENTRY_SZ * fn_cnt);
+	__write_lookup(&out, &state->globals);
+
+	bool saved = true;
+
+	for (uint32_t idx = 0; idx < fn_cnt && saved; idx++) {
+		size_t entry = table_pos + IMAGE_TABLE_ENTRY_SZ * idx;
+		size_t pos = list_size(&out);
+
+		saved = __write_fn(&out, &fns, idx);
+		__patch_u32(&out, entry, (uint32_t)pos);
+		__patch_u32(&out, entry + sizeof(uint32_t),
+			    c_str_gen_hash((const char *)list_get(&out, pos),
+					   list_size(&out) - pos));
+	}
+
+	if (saved) {
+		FILE *file = fopen(path, "wb");
+
+		saved = file &&
+			fwrite(out.data, 1, list_size(&out), file) ==
+				list_size(&out);
+
+		if (file && fclose(file) != 0) {
+			saved = false;
+		}
+
+		if (!saved) {
+			fprintf(stderr, "Could not write image \"%s\".\n",
+				path);
+		}
+	}
+
+	list_free(&out);
+	list_free(&fns.fns);
+	list_free(&fns.sizes);
+
+	return saved;
+}
+
+lox_fn_t *image_load(uint8_t *buf, size_t buf_sz, struct state *state,
+		     struct image **loaded)
+{
+	if (!image_is_image(buf, buf_sz)) {
+		fprintf(stderr, "Not a lox image.\n");
+		return NULL;
+	}
+
+	struct image *image = reallocate(NULL, 0, sizeof(struct image));
+	*image = (struct image){ .buf = buf, .buf_sz = buf_sz };
+
+	struct image_reader reader = {
+		.image = image,
+		.pos = IMAGE_MAGIC_SZ,
+		.failed = false,
+	};
+	uint32_t version = __read_u32(&reader);
+	uint32_t op_cnt = __read_u32(&reader);
+
+	if (version != IMAGE_VERSION || op_cnt != IMAGE_OP_CNT) {
+		fprintf(stderr,
+			"Image was written by an incompatible version.\n");
+		image_free(image);
+		return NULL;
+	}
+
+	image->fn_cnt = __read_u32(&reader);
+	image->fn_table = __read_bytes(
+		&reader, IMAGE_TABLE_ENTRY_SZ * (size_t)image->fn_cnt);
+	__read_lookup(&reader, &state->globals);
+	image->global_cnt = lookup_get_size(&state->globals);
+
+	lox_fn_t *main = NULL;
+
+	if (!reader.failed && image->fn_cnt) {
+		main = __read_fn(image, 0);
+	}
+
+	if (!main || !image_load_fn(main)) {
+		fprintf(stderr, "Image is corrupt.\n");
+		image_free(image);
+		return NULL;
+	}
+
+	*loaded = image;
+
+	return main;
+}
+
+bool image_load_fn(lox_fn_t *fn)
+{
+	struct image *image = fn->image;
+	size_t end;
+	struct image_reader reader = __fn_reader(image, fn->image_idx, &end);
+	const uint8_t *entry =
+		image->fn_table + IMAGE_TABLE_ENTRY_SZ * fn->image_idx;
+
+	// the whole record is checked before any of it is trusted
+	if (reader.failed ||
+	    c_str_gen_hash((const char *)image->buf + reader.pos,
+			   end - reader.pos) !=
+		    __get_u32(entry + sizeof(uint32_t))) {
+		return false;
+	}
+
+	// the header was read when the function was first referenced
+	__read_u32(&reader);
+	__read_u32(&reader);
+	__read_u32(&reader);
+	if (__read_u8(&reader)) {
+		__read_bytes(&reader, __read_u32(&reader));
+	}
+
+	__read_chunk(&reader, &fn->chunk);
+	fn->image = NULL;
+
+	return !reader.failed && reader.pos == end &&
+	       __check_code(fn, image->global_cnt);
+}
+
+void image_free(struct image *image)
+{
+	reallocate(image, sizeof(struct image), 0);
+}
+
+static void __write_u8(list_t *out, uint8_t val)
+{
+	list_push(out, &val);
+}
+
+static void __write_u32(list_t *out, uint32_t val)
+{
+	uint8_t bytes[] = { val, val >> 8, val >> 16, val >> 24 };
+
+	list_push_bulk(out, bytes, sizeof(bytes));
+}
+
+static void __patch_u32(list_t *out, size_t pos, uint32_t val)
+{
+	uint8_t bytes[] = { val, val >> 8, val >> 16, val >> 24 };
+
+	memcpy(list_get(out, pos), bytes, sizeof(bytes));
+}
+
+static void __write_str(list_t *out, const char *chars, size_t len)
+{
+	__write_u32(out, (uint32_t)len);
+	list_push_bulk(out, chars, len);
+}
+
+static void __write_lookup(list_t *out, lookup_t *lookup)
+{
+	struct lookup_writer writer = {
+		.for_each = { .func = &__write_lookup_var },
+		.out = out,
+	};
+
+	__write_u32(out, lookup_get_size(lookup));
+	map_entries_for_each(&lookup->table,
+			     (struct map_for_each_entry *)&writer);
+}
+
+static void __write_lookup_var(struct map_entry entry,
+			       struct map_for_each_entry *for_each)
+{
+	struct lookup_writer *writer = (struct lookup_writer *)for_each;
+	struct string *name = (struct string *)entry.key;
+	const lookup_var_t *var = (const lookup_var_t *)entry.value;
+
+	__write_str(writer->out, string_get_cstring(name),
+		    string_get_len(name));
+	__write_u32(writer->out, var->idx);
+	// known classes are only needed while compiling
+	__write_u8(writer->out, var->var_flags & ~LOOKUP_VAR_INSTANCE);
+}
+
+/**
+ * @brief lists a function and the functions held in its constants, depth
+ * first, so the functions held by each function directly follow it
+ *
+ * @param fns the functions found so far
+ * @param fn the function to add
+ * @return uint32_t the number of functions added
+ */
+static uint32_t __collect_fns(struct image_fns *fns, lox_fn_t *fn)
+{
+	size_t idx = list_push(&fns->fns, &fn);
+	uint32_t size = 1;
+
+	list_push(&fns->sizes, &size);
+
+	for (size_t cnst = 0; cnst < list_size(&fn->chunk.consts); cnst++) {
+		lox_val_t val = chunk_get_const(&fn->chunk, cnst);
+
+		if (VAL_IS_OBJ(val) && OBJECT_IS_FN(val)) {
+			size += __collect_fns(fns, OBJECT_AS_FN(val));
+		}
+	}
+
+	*(uint32_t *)list_get(&fns->sizes, idx) = size;
+
+	return size;
+}
+
+/**
+ * @brief writes the record of a function
+ *
+ * @param out the image being written
+ * @param fns the functions of the program
+ * @param idx the index of the function to write
+ * @return true the function was written
+ * @return false a constant can not be stored in an image
+ */
+static bool __write_fn(list_t *out, struct image_fns *fns, size_t idx)
+{
+	lox_fn_t *fn = *(lox_fn_t **)list_get(&fns->fns, idx);
+	chunk_t *chunk = &fn->chunk;
+	size_t code_cnt = chunk_cur_instr(chunk);
+
+	__write_u32(out, (uint32_t)fn->arity);
+	__write_u32(out, fn->upval_cnt);
+	__write_u32(out, fn->max_slots);
+	__write_u8(out, fn->name != NULL);
+	if (fn->name) {
+		__write_str(out, fn->name->chars, fn->name->len);
+	}
+
+	__write_u32(out, (uint32_t)code_cnt);
+	list_push_bulk(out, chunk->code.data, code_cnt);
+
+	// lines are written as runs of code on the same line
+	uint32_t *lines = reallocate(NULL, 0, sizeof(uint32_t) * code_cnt);
+	list_t runs = list_of_type(uint32_t);
+
+	chunk_get_lines(chunk, lines);
+	for (size_t offset = 0; offset < code_cnt;) {
+		uint32_t run = 1;
+
+		while (offset + run < code_cnt &&
+		       lines[offset + run] == lines[offset]) {
+			run++;
+		}
+
+		list_push(&runs, &lines[offset]);
+		list_push(&runs, &run);
+		offset += run;
+	}
+
+	__write_u32(out, (uint32_t)list_size(&runs) / 2);
+	for (size_t idx = 0; idx < list_size(&runs); idx++) {
+		__write_u32(out, *(uint32_t *)list_get(&runs, idx));
+	}
+	list_free(&runs);
+	reallocate(lines, sizeof(uint32_t) * code_cnt, 0);
+
+	// functions held in the constants follow this one in the table
+	uint32_t fn_idx = (uint32_t)idx + 1;
+
+	__write_u32(out, (uint32_t)list_size(&chunk->consts));
+	for (size_t cnst = 0; cnst < list_size(&chunk->consts); cnst++) {
+		lox_val_t val = chunk_get_const(chunk, cnst);
+
+		if (!__write_val(out, val, fn_idx)) {
+			return false;
+		}
+
+		if (VAL_IS_OBJ(val) && OBJECT_IS_FN(val)) {
+			fn_idx += *(uint32_t *)list_get(&fns->sizes, fn_idx);
+		}
+	}
+
+	__write_u32(out, (uint32_t)list_size(&chunk->prop_caches));
+	for (size_t cache = 0; cache < list_size(&chunk->prop_caches);
+	     cache++) {
+		__write_u32(out, chunk_get_prop_cache(chunk, cache)->name_idx);
+	}
+
+	__write_u32(out, (uint32_t)list_size(&chunk->locals));
+	for (size_t local_idx = 0; local_idx < list_size(&chunk->locals);
+	     local_idx++) {
+		const struct chunk_local *local =
+			list_get(&chunk->locals, local_idx);
+
+		__write_str(out, local->name->chars, local->name->len);
+		__write_u32(out, local->slot);
+		__write_u32(out, local->start);
+	}
+
+	return true;
+}
+
+/**
+ * @brief writes a constant
+ *
+ * @param out the image being written
+ * @param val the constant
+ * @param fn_idx the table index of the constant, if it is a function
+ * @return true the constant was written
+ * @return false the constant can not be stored in an image
+ */
+static bool __write_val(list_t *out, lox_val_t val, uint32_t fn_idx)
+{
+	if (VAL_IS_NIL(val)) {
+		__write_u8(out, IMAGE_TAG_NIL);
+	} else if (VAL_IS_BOOL(val)) {
+		__write_u8(out, VAL_AS_BOOL(val) ? IMAGE_TAG_TRUE :
+						   IMAGE_TAG_FALSE);
+	} else if (VAL_IS_NUMBER(val)) {
+		lox_num_t num = VAL_AS_NUMBER(val);
+		uint64_t bits;
+
+		memcpy(&bits, &num, sizeof(bits));
+		__write_u8(out, IMAGE_TAG_NUMBER);
+		__write_u32(out, (uint32_t)bits);
+		__write_u32(out, (uint32_t)(bits >> 32));
+	} else if (VAL_IS_OBJ(val) && OBJECT_IS_STRING(val)) {
+		const lox_str_t *str = OBJECT_AS_STRING(val);
+
+		__write_u8(out, IMAGE_TAG_STRING);
+		__write_str(out, str->chars, str->len);
+	} else if (VAL_IS_OBJ(val) && OBJECT_IS_FN(val)) {
+		__write_u8(out, IMAGE_TAG_FN);
+		__write_u32(out, fn_idx);
+	} else if (VAL_IS_OBJ(val) && OBJECT_IS_NATIVE(val)) {
+		const char *name = __native_name(OBJECT_AS_NATIVE(val)->fn);
+
+		if (!name) {
+			fprintf(stderr, "Native function is not a sys import.\n");
+			return false;
+		}
+
+		__write_u8(out, IMAGE_TAG_NATIVE);
+		__write_str(out, name, strlen(name));
+	} else if (VAL_IS_OBJ(val) && OBJECT_IS_CLASS(val)) {
+		lox_class_t *cls = OBJECT_AS_CLASS(val);
+
+		__write_u8(out, IMAGE_TAG_CLASS);
+		__write_str(out, cls->name->chars, cls->name->len);
+		__write_lookup(out, &cls->field_lookup.table);
+	} else {
+		fprintf(stderr, "Constant can not be stored in an image.\n");
+		return false;
+	}
+
+	return true;
+}
+
+static const char *__native_name(native_fn fn)
+{
+	struct import_list imports = sys_get_import_list();
+
+	for (size_t idx = 0; idx < imports.import_cnt; idx++) {
+		if (imports.import_arr[idx].fn == fn) {
+			return imports.import_arr[idx].fn_name;
+		}
+	}
+
+	return NULL;
+}
+
+static uint8_t __read_u8(struct image_reader *reader)
+{
+	const uint8_t *bytes = __read_bytes(reader, 1);
+
+	return bytes ? *bytes : 0;
+}
+
+static uint32_t __read_u32(struct image_reader *reader)
+{
+	const uint8_t *bytes = __read_bytes(reader, 4);
+
+	return bytes ? __get_u32(bytes) : 0;
+}
+
+static uint32_t __get_u32(const uint8_t *bytes)
+{
+	return (uint32_t)bytes[0] | (uint32_t)bytes[1] << 8 |
+	       (uint32_t)bytes[2] << 16 | (uint32_t)bytes[3] << 24;
+}
+
+/**
+ * @brief reads a number of bytes from the image
+ *
+ * @param reader the image reader
+ * @param cnt the number of bytes
+ * @return uint8_t* the bytes, or NULL if the image is too short
+ */
+static uint8_t *__read_bytes(struct image_reader *reader, size_t cnt)
+{
+	if (reader->failed || reader->image->buf_sz - reader->pos < cnt) {
+		reader->failed = true;
+		return NULL;
+	}
+
+	uint8_t *bytes = reader->image->buf + reader->pos;
+	reader->pos += cnt;
+
+	return bytes;
+}
+
+static lox_str_t *__read_str(struct image_reader *reader)
+{
+	uint32_t len = __read_u32(reader);
+	const uint8_t *chars = __read_bytes(reader, len);
+
+	return chars ? object_str_new((const char *)chars, len) : NULL;
+}
+
+static void __read_lookup(struct image_reader *reader, lookup_t *lookup)
+{
+	uint32_t var_cnt = __read_u32(reader);
+
+	for (uint32_t cnt = 0; cnt < var_cnt && !reader->failed; cnt++) {
+		lox_str_t *name = __read_str(reader);
+		uint32_t idx = __read_u32(reader);
+		var_flags_t flags = __read_u8(reader);
+
+		if (!name) {
+			return;
+		}
+
+		if (flags & LOOKUP_VAR_DEFINED) {
+			lookup_define(lookup, name->chars, name->len, idx,
+				      flags);
+		} else {
+			lookup_declare(lookup, name->chars, name->len, idx,
+				       flags);
+		}
+	}
+}
+
+/**
+ * @brief gets a reader at the record of a function. Records are written
+ * back to back, so each ends where the next begins
+ *
+ * @param image the image
+ * @param idx the index of the function
+ * @param end set to the end of the record
+ * @return struct image_reader the reader, failed if the index is invalid
+ */
+static struct image_reader __fn_reader(struct image *image, uint32_t idx,
+				       size_t *end)
+{
+	struct image_reader reader = {
+		.image = image,
+		.pos = 0,
+		.failed = idx >= image->fn_cnt,
+	};
+
+	*end = 0;
+	if (!reader.failed) {
+		const uint8_t *entry =
+			image->fn_table + IMAGE_TABLE_ENTRY_SZ * idx;
+
+		reader.pos = __get_u32(entry);
+		*end = idx + 1 < image->fn_cnt ?
+			       __get_u32(entry + IMAGE_TABLE_ENTRY_SZ) :
+			       image->buf_sz;
+		reader.failed = reader.pos > *end || *end > image->buf_sz;
+	}
+
+	return reader;
+}
+
+/**
+ * @brief reads the header of a function. Its chunk is left in the image
+ * until image_load_fn() is called
+ *
+ * @param image the image
+ * @param idx the index of the function
+ * @return lox_fn_t* the function, or NULL if the record is invalid
+ */
+static lox_fn_t *__read_fn(struct image *image, uint32_t idx)
+{
+	size_t end;
+	struct image_reader reader = __fn_reader(image, idx, &end);
+	lox_fn_t *fn = object_fn_new();
+
+	fn->arity = (int)__read_u32(&reader);
+	fn->upval_cnt = __read_u32(&reader);
+	fn->max_slots = __read_u32(&reader);
+	if (__read_u8(&reader)) {
+		fn->name = __read_str(&reader);
+	}
+
+	fn->image = image;
+	fn->image_idx = idx;
+
+	return reader.failed ? NULL : fn;
+}
+
+/**
+ * @brief reads a chunk. The code is used in place
+ *
+ * @param reader the image reader, at the start of the chunk
+ * @param chunk the chunk to load in to
+ */
+static void __read_chunk(struct image_reader *reader, chunk_t *chunk)
+{
+	uint32_t code_cnt = __read_u32(reader);
+	uint8_t *code = __read_bytes(reader, code_cnt);
+
+	if (code) {
+		list_free(&chunk->code);
+		chunk->code = list_borrow(sizeof(code_t), code, code_cnt);
+	}
+
+	uint32_t run_cnt = __read_u32(reader);
+	uint32_t lined = 0;
+
+	for (uint32_t idx = 0; idx < run_cnt && !reader->failed; idx++) {
+		uint32_t line = __read_u32(reader);
+		uint32_t count = __read_u32(reader);
+
+		chunk_write_line_run(chunk, line, count);
+		lined += count;
+	}
+
+	// every byte of code needs a line for errors to be reported
+	if (lined != code_cnt) {
+		reader->failed = true;
+	}
+
+	uint32_t const_cnt = __read_u32(reader);
+
+	for (uint32_t idx = 0; idx < const_cnt && !reader->failed; idx++) {
+		lox_val_t val = __read_val(reader);
+
+		// pushed as is, as offsets in the code must not change
+		list_push(&chunk->consts, &val);
+	}
+
+	uint32_t cache_cnt = __read_u32(reader);
+
+	for (uint32_t idx = 0; idx < cache_cnt && !reader->failed; idx++) {
+		struct prop_cache cache = {
+			.name_idx = __read_u32(reader),
+			.cnt = 0,
+		};
+
+		// caches are looked up by the name constant they hold
+		if (cache.name_idx >= list_size(&chunk->consts) ||
+		    !VAL_IS_OBJ(chunk_get_const(chunk, cache.name_idx)) ||
+		    !OBJECT_IS_STRING(chunk_get_const(chunk, cache.name_idx))) {
+			reader->failed = true;
+		}
+
+		list_push(&chunk->prop_caches, &cache);
+	}
+
+	uint32_t local_cnt = __read_u32(reader);
+
+	for (uint32_t idx = 0; idx < local_cnt && !reader->failed; idx++) {
+		struct chunk_local local = {
+			.name = __read_str(reader),
+			.slot = __read_u32(reader),
+			.start = __read_u32(reader),
+		};
+
+		list_push(&chunk->locals, &local);
+	}
+}
+
+static lox_val_t __read_val(struct image_reader *reader)
+{
+	switch (__read_u8(reader)) {
+	case IMAGE_TAG_NIL:
+		return VAL_CREATE_NIL;
+
+	case IMAGE_TAG_FALSE:
+		return VAL_CREATE_BOOL(false);
+
+	case IMAGE_TAG_TRUE:
+		return VAL_CREATE_BOOL(true);
+
+	case IMAGE_TAG_NUMBER: {
+		uint64_t bits = __read_u32(reader);
+		bits |= (uint64_t)__read_u32(reader) << 32;
+
+		lox_num_t num;
+		memcpy(&num, &bits, sizeof(num));
+
+		return VAL_CREATE_NUMBER(num);
+	}
+
+	case IMAGE_TAG_STRING: {
+		lox_str_t *str = __read_str(reader);
+
+		return str ? VAL_CREATE_OBJ(str) : VAL_CREATE_NIL;
+	}
+
+	case IMAGE_TAG_FN: {
+		lox_fn_t *fn = __read_fn(reader->image, __read_u32(reader));
+
+		if (!fn) {
+			reader->failed = true;
+			return VAL_CREATE_NIL;
+		}
+
+		return VAL_CREATE_OBJ(fn);
+	}
+
+	case IMAGE_TAG_NATIVE: {
+		lox_str_t *name = __read_str(reader);
+		native_fn fn = name ? __native_fn(name) : NULL;
+
+		if (!fn) {
+			reader->failed = true;
+			return VAL_CREATE_NIL;
+		}
+
+		return VAL_CREATE_OBJ(object_native_fn_new(fn));
+	}
+
+	case IMAGE_TAG_CLASS: {
+		lox_str_t *name = __read_str(reader);
+
+		if (!name) {
+			return VAL_CREATE_NIL;
+		}
+
+		lox_class_t *cls = object_class_new(name);
+		__read_lookup(reader, &cls->field_lookup.table);
+
+		return VAL_CREATE_OBJ(cls);
+	}
+
+	default:
+		reader->failed = true;
+		return VAL_CREATE_NIL;
+	}
+}
+
+static native_fn __native_fn(const lox_str_t *name)
+{
+	struct import_list imports = sys_get_import_list();
+
+	for (size_t idx = 0; idx < imports.import_cnt; idx++) {
+		const struct native_import *import = &imports.import_arr[idx];
+
+		if (import->name_sz == name->len &&
+		    memcmp(import->fn_name, name->chars, name->len) == 0) {
+			return import->fn;
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * @brief checks the code of a loaded function only uses the constants,
+ * caches, slots, upvalues and globals it has. Every op must end within the
+ * code, jumps must land on the start of an op and the last op must not fall
+ * through past the end. The types of the values ops work on are not checked
+ *
+ * @param fn the loaded function
+ * @param global_cnt the number of globals
+ * @return true the code can be run
+ * @return false the code is invalid
+ */
+static bool __check_code(lox_fn_t *fn, uint32_t global_cnt)
+{
+	struct code_check check = {
+		.fn = fn,
+		.code = fn->chunk.code.data,
+		.code_cnt = chunk_cur_instr(&fn->chunk),
+		.global_cnt = global_cnt,
+		.targets = list_of_type(size_t),
+	};
+	bool *is_op = reallocate(NULL, 0, sizeof(bool) * check.code_cnt);
+	bool valid = check.code_cnt != 0;
+	size_t last = 0;
+
+	memset(is_op, 0, sizeof(bool) * check.code_cnt);
+
+	for (size_t offset = 0; valid && offset < check.code_cnt;) {
+		size_t len = __check_op(&check, offset);
+
+		is_op[offset] = true;
+		last = offset;
+		valid = len != 0;
+		offset += len;
+	}
+
+	valid = valid && __op_is_exit(check.code[last]);
+
+	for (size_t idx = 0; valid && idx < list_size(&check.targets); idx++) {
+		valid = is_op[*(size_t *)list_get(&check.targets, idx)];
+	}
+
+	reallocate(is_op, sizeof(bool) * check.code_cnt, 0);
+	list_free(&check.targets);
+
+	return valid;
+}
+
+/**
+ * @brief checks an op and its operands
+ *
+ * @param check the code check
+ * @param offset the offset of the op
+ * @return size_t the length of the op, or zero if it is invalid
+ */
+static size_t __check_op(struct code_check *check, size_t offset)
+{
+	const code_t *op = check->code + offset;
+	size_t len = op_len(*op);
+	size_t cache_cnt = list_size(&check->fn->chunk.prop_caches);
+	uint32_t ext = 0;
+
+	if (!len || len > check->code_cnt - offset) {
+		return 0;
+	}
+
+	if (len > EXT_CODE_SZ) {
+		memcpy(&ext, op + 1, EXT_CODE_SZ);
+	}
+
+	switch (*op) {
+	case OP_CONSTANT:
+		return __check_const(check, op[1]) ? len : 0;
+
+	case OP_CONSTANT_LONG:
+		return __check_const(check, ext) ? len : 0;
+
+	case OP_CLOSURE:
+		return __check_closure(check, offset, len, op[1]);
+
+	case OP_CLOSURE_LONG:
+		return __check_closure(check, offset, len, ext);
+
+	case OP_VAR_GET:
+	case OP_VAR_SET:
+	case OP_VAR_SET_POP:
+		return __check_slot(check, op[1]) ? len : 0;
+
+	case OP_VAR_GET_LONG:
+	case OP_VAR_SET_LONG:
+		return __check_slot(check, ext) ? len : 0;
+
+	case OP_VAR_GET_CONST:
+		return __check_slot(check, op[1]) &&
+				       __check_const(check, op[2]) ?
+			       len :
+			       0;
+
+	case OP_GLOBAL_DEFINE:
+	case OP_GLOBAL_GET:
+	case OP_GLOBAL_SET:
+	case OP_GLOBAL_SET_POP:
+		return op[1] < check->global_cnt ? len : 0;
+
+	case OP_GLOBAL_DEFINE_LONG:
+	case OP_GLOBAL_GET_LONG:
+	case OP_GLOBAL_SET_LONG:
+		return ext < check->global_cnt ? len : 0;
+
+	case OP_UPVALUE_GET:
+	case OP_UPVALUE_SET:
+	case OP_UPVALUE_COPY_GET:
+		return op[1] < check->fn->upval_cnt ? len : 0;
+
+	case OP_UPVALUE_GET_LONG:
+	case OP_UPVALUE_SET_LONG:
+	case OP_UPVALUE_COPY_GET_LONG:
+		return ext < check->fn->upval_cnt ? len : 0;
+
+	case OP_PROPERTY_GET:
+	case OP_PROPERTY_SET:
+	case OP_PROPERTY_SET_POP:
+		return op[1] < cache_cnt ? len : 0;
+
+	case OP_PROPERTY_GET_LONG:
+	case OP_PROPERTY_SET_LONG:
+		return ext < cache_cnt ? len : 0;
+
+	case OP_JUMP:
+	case OP_JUMP_IF_FALSE:
+	case OP_JUMP_IF_FALSE_POP:
+	case OP_JUMP_IF_NOT_EQUAL:
+	case OP_JUMP_IF_NOT_GREATER:
+	case OP_JUMP_IF_NOT_LESS:
+	case OP_JUMP_IF_NOT_GREATER_EQ:
+	case OP_JUMP_IF_NOT_LESS_EQ:
+	case OP_JUMP_IF_EQUAL:
+		return __check_jump(check, offset, len);
+
+	case OP_ADD_REG:
+	case OP_SUBTRACT_REG:
+	case OP_MULTIPLY_REG:
+	case OP_DIVIDE_REG:
+	case OP_MOD_REG:
+	case OP_EQUAL_REG:
+	case OP_GREATER_REG:
+	case OP_LESS_REG:
+	case OP_GREATER_EQ_REG:
+	case OP_LESS_EQ_REG:
+	case OP_NOT_EQUAL_REG:
+		return (op[1] == REG_DEST_PUSH || __check_slot(check, op[1])) &&
+				       __check_reg(check, op[2]) &&
+				       __check_reg(check, op[3]) ?
+			       len :
+			       0;
+
+	case OP_JUMP_IF_NOT_EQUAL_REG:
+	case OP_JUMP_IF_NOT_GREATER_REG:
+	case OP_JUMP_IF_NOT_LESS_REG:
+	case OP_JUMP_IF_NOT_GREATER_EQ_REG:
+	case OP_JUMP_IF_NOT_LESS_EQ_REG:
+	case OP_JUMP_IF_EQUAL_REG:
+		return __check_reg(check, op[1]) && __check_reg(check, op[2]) ?
+			       __check_jump(check, offset, len) :
+			       0;
+
+	// the counter is followed by the range end
+	case OP_FOR_RANGE_INIT:
+	case OP_FOR_RANGE:
+		return __check_slot(check, op[1] + 1) ?
+			       __check_jump(check, offset, len) :
+			       0;
+
+	// upvalue defines are only valid as operands of a closure
+	case OP_UPVALUE_DEFINE:
+	case OP_UPVALUE_DEFINE_LONG:
+		return 0;
+
+	// the rest have no operands, or ones which are counts or are only used
+	// by the compiler
+	default:
+		return len;
+	}
+}
+
+/**
+ * @brief checks a closure op. It must hold a function and be followed by an
+ * upvalue define for each of the function's upvalues
+ *
+ * @param check the code check
+ * @param offset the offset of the op
+ * @param len the length of the op, without its upvalue defines
+ * @param idx the constant index of the function
+ * @return size_t the length of the op and its defines, or zero if invalid
+ */
+static size_t __check_closure(struct code_check *check, size_t offset,
+			      size_t len, uint32_t idx)
+{
+	if (!__check_const(check, idx)) {
+		return 0;
+	}
+
+	lox_val_t val = chunk_get_const(&check->fn->chunk, idx);
+
+	if (!VAL_IS_OBJ(val) || !OBJECT_IS_FN(val)) {
+		return 0;
+	}
+
+	size_t define_len = op_len(OP_UPVALUE_DEFINE);
+
+	// the vm only reads the short define
+	for (uint32_t upval = 0; upval < OBJECT_AS_FN(val)->upval_cnt;
+	     upval++) {
+		const code_t *define = check->code + offset + len;
+
+		if (check->code_cnt - offset - len < define_len ||
+		    define[0] != OP_UPVALUE_DEFINE ||
+		    define[2] & ~(UPVAL_LOCAL_FLAG | UPVAL_COPY_FLAG)) {
+			return 0;
+		}
+
+		if (define[2] & UPVAL_LOCAL_FLAG ?
+			    !__check_slot(check, define[1]) :
+			    define[1] >= check->fn->upval_cnt) {
+			return 0;
+		}
+
+		len += define_len;
+	}
+
+	return len;
+}
+
+/**
+ * @brief checks a jump op, recording its target to be checked once every op
+ * start is known
+ *
+ * @param check the code check
+ * @param offset the offset of the op
+ * @param len the length of the op, ending with its jump offset
+ * @return size_t the length of the op, or zero if it is invalid
+ */
+static size_t __check_jump(struct code_check *check, size_t offset,
+			   size_t len)
+{
+	int16_t jump;
+
+	memcpy(&jump, check->code + offset + len - 2, sizeof(jump));
+
+	long target = (long)(offset + len) + jump;
+
+	if (target < 0 || (size_t)target >= check->code_cnt) {
+		return 0;
+	}
+
+	size_t at = (size_t)target;
+
+	list_push(&check->targets, &at);
+
+	return len;
+}
+
+//! @brief whether a frame slot is one of the function's locals
+static bool __check_slot(struct code_check *check, uint32_t slot)
+{
+	return slot < check->fn->max_slots;
+}
+
+//! @brief whether a constant index is in the chunk
+static bool __check_const(struct code_check *check, uint32_t idx)
+{
+	return idx < list_size(&check->fn->chunk.consts);
+}
+
+//! @brief whether a register operand names a local or a constant
+static bool __check_reg(struct code_check *check, code_t operand)
+{
+	return operand & REG_CONST_FLAG ?
+		       __check_const(check, operand & ~REG_CONST_FLAG) :
+		       __check_slot(check, operand);
+}
+
+//! @brief whether the op never falls through to the next op
+static bool __op_is_exit(code_t code)
+{
+	return code == OP_RETURN || code == OP_TAIL_CALL || code == OP_JUMP;
+}
@@ -0,0 +1,108 @@
+/**
+ * @file image.h
+ * @author Dylan Mayor
+ * @brief header file for saving and loading compiled lox programs
+ *
+ * An image holds the compiled main function, every function and constant
+ * it reaches, and the global name table, so a program can be run again
+ * without compiling its source. Integers are stored little endian.
+ *
+ * Images are built to be mapped and run in place. The code of each chunk
+ * is used straight from the image, and only the main function is loaded
+ * up front. Every other function is loaded when its first closure is
+ * made, so starting a program costs the same whatever its size.
+ *
+ * The layout is a header, a function table, the globals, then a record
+ * for each function:
+ *  - header: the magic "LOXC", the format version, the number of ops the
+ *    writer knew and the number of functions. Images are only loaded by
+ *    builds with the same ops
+ *  - function table: the offset of each function record and a checksum
+ *    of it, checked when the function is loaded. The main function is
+ *    first
+ *  - globals: a count, then the name, index and flags of each global
+ *  - function: the arity, upvalue count, most local slots in use and
+ *    name, then its chunk. A chunk is its code, its line runs, its
+ *    constants, the name offset of each property cache and its local slot
+ *    names. Function constants are the index of the function in the table
+ *
+ * Strings are a length followed by the characters. Native functions are
+ * stored by name and looked up in the sys imports when loaded.
+ *
+ * Before a function is run its code is checked to only use the constants,
+ * caches, locals, upvalues and globals it has and to only jump to ops
+ * within it. The types of the values its ops work on and how deep they
+ * take the stack are not checked, so images are trusted input: the
+ * checksums catch damaged files, not ones written to break the vm.
+ */
+#ifndef __CLOX_IMAGE_H__
+#define __CLOX_IMAGE_H__
+
+#include "util/common.h"
+#include "state/state.h"
+#include "val/val.h"
+
+//! @brief magic bytes every image begins with
+#define IMAGE_MAGIC "LOXC"
+//! @brief size of the image magic
+#define IMAGE_MAGIC_SZ (sizeof(IMAGE_MAGIC) - 1)
+//! @brief format version written to and expected in image headers
+#define IMAGE_VERSION 1
+
+struct image;
+
+/**
+ * @brief whether a buffer holds an image, rather than lox source
+ *
+ * @param buf the buffer
+ * @param buf_sz the buffer size
+ * @return true the buffer starts with the image magic
+ * @return false the buffer is not an image
+ */
+bool image_is_image(const uint8_t *buf, size_t buf_sz);
+
+/**
+ * @brief saves a compiled program to an image file
+ *
+ * @param path the path of the image to write
+ * @param main the compiled main function
+ * @param state the state the program was compiled against
+ * @return true the image was written
+ * @return false the file could not be written
+ */
+bool image_save(const char *path, lox_fn_t *main, struct state *state);
+
+/**
+ * @brief loads a compiled program from an image. The globals of the image
+ * are defined in the state. Code is run from the buffer in place, and may be
+ * rewritten as it is run, so the buffer must be writable and outlive the
+ * program. A private file mapping only copies the pages which are written
+ *
+ * @param buf the image contents
+ * @param buf_sz the image size
+ * @param state the state to load the globals in to
+ * @param loaded set to the loaded image, which must be freed with
+ * image_free() once the program has run
+ * @return lox_fn_t* the main function, or NULL if the image is invalid
+ */
+lox_fn_t *image_load(uint8_t *buf, size_t buf_sz, struct state *state,
+		     struct image **loaded);
+
+/**
+ * @brief loads the chunk of a function which is still held in its image
+ *
+ * @param fn the function, with fn->image set
+ * @return true the chunk was loaded
+ * @return false the function record is invalid
+ */
+bool image_load_fn(lox_fn_t *fn);
+
+/**
+ * @brief frees a loaded image. Functions which are still to be loaded from
+ * it can no longer be loaded
+ *
+ * @param image the image to free
+ */
+void image_free(struct image *image);
+
+#endif // __CLOX_IMAGE_H__
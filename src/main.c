@@ -2,11 +2,21 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
 
 #include "util/common.h"
 #include "vm/virt.h"
+#include "compiler/compiler.h"
+#include "image/image.h"
 #include "util/string/string_util.h"
 
+//! @brief flag to compile a script to an image without running it
+#define COMPILE_ONLY_FLAG "--compile-only"
+//! @brief flag naming the image written by COMPILE_ONLY_FLAG
+#define OUTPUT_FLAG "-o"
+
 enum exit_code {
 	EXIT_OK = 0,
 	EXIT_HELP = 64,
@@ -17,7 +27,9 @@ enum exit_code {
 
 static void __run_repl(vm_t *vm);
 static void __run_file(vm_t *vm, const char *path);
-static char *__read_file(const char *path);
+static void __compile_file(vm_t *vm, const char *path, const char *out_path);
+static char *__read_file(const char *path, size_t *file_sz);
+static uint8_t *__map_file(const char *path, size_t *file_sz);
 static void __proc_cmd(const char *cmd, const size_t cmd_sz, vm_t *vm);
 static void __program_quit(enum exit_code);
 
@@ -29,8 +41,13 @@ int main(int argc, const char *argv[])
 		__run_repl(&virt);
 	} else if (argc == 2) {
 		__run_file(&virt, argv[1]);
+	} else if (argc == 5 && strcmp(argv[1], COMPILE_ONLY_FLAG) == 0 &&
+		   strcmp(argv[2], OUTPUT_FLAG) == 0) {
+		__compile_file(&virt, argv[4], argv[3]);
 	} else {
-		fprintf(stderr, "Usage: clox[path]\n");
+		fprintf(stderr, "Usage: clox[path]\n"
+				"       clox " COMPILE_ONLY_FLAG " " OUTPUT_FLAG
+				" out.loxc path\n");
 		__program_quit(EXIT_HELP);
 	}
 
@@ -115,9 +132,31 @@ static void __proc_cmd(const char *cmd, const size_t cmd_sz, vm_t *vm)
 
 static void __run_file(vm_t *vm, const char *path)
 {
-	char *src = __read_file(path);
+	size_t file_sz;
+	uint8_t *image = __map_file(path, &file_sz);
+	enum vm_res result;
+	struct image *loaded = NULL;
+
+	// images skip the compiler entirely and are run in place
+	if (image && image_is_image(image, file_sz)) {
+		lox_fn_t *fn = image_load(image, file_sz, &vm->state, &loaded);
 
-	enum vm_res result = vm_interpret(vm, src);
+		if (!fn) {
+			__program_quit(EXIT_FILE_ERROR);
+		}
+
+		result = vm_interpret_fn(vm, fn);
+	} else {
+		if (image) {
+			munmap(image, file_sz);
+			image = NULL;
+		}
+
+		char *src = __read_file(path, &file_sz);
+
+		result = vm_interpret(vm, src);
+		free(src);
+	}
 
 	if (result == INTERPRET_COMPILE_ERROR) {
 		__program_quit(EXIT_COMPILE_ERROR);
@@ -127,10 +166,30 @@ static void __run_file(vm_t *vm, const char *path)
 		__program_quit(EXIT_RUNTIME_ERROR);
 	}
 
+	if (image) {
+		image_free(loaded);
+		munmap(image, file_sz);
+	}
+}
+
+static void __compile_file(vm_t *vm, const char *path, const char *out_path)
+{
+	size_t src_sz;
+	char *src = __read_file(path, &src_sz);
+	lox_fn_t *fn = compile(src, &vm->state);
+
+	if (!fn) {
+		__program_quit(EXIT_COMPILE_ERROR);
+	}
+
+	if (!image_save(out_path, fn, &vm->state)) {
+		__program_quit(EXIT_FILE_ERROR);
+	}
+
 	free(src);
 }
 
-static char *__read_file(const char *path)
+static char *__read_file(const char *path, size_t *file_sz)
 {
 	FILE *file = fopen(path, "rb");
 
@@ -140,23 +199,60 @@ static char *__read_file(const char *path)
 	}
 
 	fseek(file, 0L, SEEK_END);
-	size_t file_sz = ftell(file);
+	*file_sz = ftell(file);
 	rewind(file);
 
-	char *file_buf = (char *)malloc(file_sz + 1);
-	size_t bytes_rd = fread(file_buf, sizeof(char), file_sz, file);
+	char *file_buf = (char *)malloc(*file_sz + 1);
+	size_t bytes_rd = fread(file_buf, sizeof(char), *file_sz, file);
 
-	if (bytes_rd < file_sz) {
+	if (bytes_rd < *file_sz) {
 		fprintf(stderr, "Could not read file \"%s\".\n", path);
 	}
 
 	file_buf[bytes_rd] = '\0';
+	*file_sz = bytes_rd;
 
 	fclose(file);
 
 	return file_buf;
 }
 
+/**
+ * @brief maps a file in to memory. The mapping is private, so pages are only
+ * copied when they are written to
+ *
+ * @param path the file path
+ * @param file_sz set to the file size
+ * @return uint8_t* the mapped file, or NULL if it can not be mapped
+ */
+static uint8_t *__map_file(const char *path, size_t *file_sz)
+{
+	int fd = open(path, O_RDONLY);
+
+	if (fd < 0) {
+		return NULL;
+	}
+
+	off_t sz = lseek(fd, 0, SEEK_END);
+	void *map = MAP_FAILED;
+
+	// empty files can not be mapped
+	if (sz > 0) {
+		map = mmap(NULL, (size_t)sz, PROT_READ | PROT_WRITE,
+			   MAP_PRIVATE, fd, 0);
+	}
+
+	close(fd);
+
+	if (map == MAP_FAILED) {
+		return NULL;
+	}
+
+	*file_sz = (size_t)sz;
+
+	return map;
+}
+
 static void __program_quit(enum exit_code code)
 {
 	exit(code);
@@ -8,15 +8,201 @@
 #define __CLOX_COMPILER_OPS_FUNC_H__
 
 #include <assert.h>
+#include <string.h>
 
 #include "ops.h"
 #include "chunk/chunk.h"
 #include "chunk/func/chunk_func.h"
+#include "val/func/val_func.h"
+
+//! @brief size of an op with a single byte operand
+#define SHORT_OP_SZ 2
+
+// register ops are formed unless the stack-only instruction set is requested
+#ifndef STACK_OPS_ONLY
+#define REGISTER_OPS
+#endif
+
+static inline void __op_begin(chunk_t *chunk)
+{
+	for (size_t op = CHUNK_PREV_OPS - 1; op > 0; op--) {
+		chunk->prev_ops[op] = chunk->prev_ops[op - 1];
+	}
+
+	chunk->prev_ops[0] = chunk_cur_instr(chunk);
+}
+
+/**
+ * @brief checks whether a previously written op can be fused with the ops
+ * written after it. Ops are never fused across a jump target
+ *
+ * @param chunk the chunk being written
+ * @param back how many ops back to check. Zero is the last written op
+ * @param op_sz the expected size of the op and its operands
+ * @return true the op has the expected size and nothing jumps past it
+ * @return false the ops must be kept separate
+ */
+static inline bool __op_prev_fits(chunk_t *chunk, size_t back, size_t op_sz)
+{
+	size_t op_offset = chunk->prev_ops[back];
+	size_t op_end = back ? chunk->prev_ops[back - 1] :
+			       chunk_cur_instr(chunk);
+
+	return chunk->label <= op_offset && op_offset + op_sz == op_end;
+}
+
+static inline bool __op_prev_is(chunk_t *chunk, size_t back, op_code_t op,
+				size_t op_sz)
+{
+	return __op_prev_fits(chunk, back, op_sz) &&
+	       chunk_get_code(chunk, chunk->prev_ops[back]) == op;
+}
+
+static inline void __op_fuse(chunk_t *chunk, op_code_t fused_op)
+{
+	code_t fused_code = (code_t)fused_op;
+	chunk_patch_code(chunk, chunk->prev_ops[0], &fused_code, 1);
+}
+
+#ifdef REGISTER_OPS
+//! @brief size of a register op with its destination and both operands
+#define REG_OP_SZ 4
+
+static inline bool __op_is_reg(code_t code)
+{
+	switch (code) {
+	case OP_ADD_REG:
+	case OP_SUBTRACT_REG:
+	case OP_MULTIPLY_REG:
+	case OP_DIVIDE_REG:
+	case OP_MOD_REG:
+	case OP_EQUAL_REG:
+	case OP_GREATER_REG:
+	case OP_LESS_REG:
+	case OP_GREATER_EQ_REG:
+	case OP_LESS_EQ_REG:
+	case OP_NOT_EQUAL_REG:
+		return true;
+	default:
+		return false;
+	}
+}
+
+static inline bool __reg_operand(chunk_t *chunk, size_t offset, code_t flag,
+				 code_t *operand)
+{
+	code_t idx = chunk_get_code(chunk, offset);
+
+	if (idx > REG_OPERAND_MAX) {
+		return false;
+	}
+
+	*operand = idx | flag;
+	return true;
+}
+
+/**
+ * @brief rewrites the operand loads written before a binary op into a single
+ * register op, which reads the frame slots and constants directly. The loads
+ * take up as much code as the register op, so they are rewritten in place
+ *
+ * @param chunk the chunk being written
+ * @param reg_op the register form of the binary op
+ * @param line the line of the binary op
+ * @return true the register op was written
+ * @return false the operands are not loads and the stack op must be written
+ */
+static inline bool __reg_op_write(chunk_t *chunk, op_code_t reg_op,
+				  uint32_t line)
+{
+	code_t reg_code[REG_OP_SZ] = { reg_op, REG_DEST_PUSH };
+	size_t reg_offset;
+
+	if (__op_prev_is(chunk, 0, OP_VAR_GET_CONST, SHORT_OP_SZ + 1)) {
+		reg_offset = chunk->prev_ops[0];
+
+		if (!__reg_operand(chunk, reg_offset + 1, 0, &reg_code[2]) ||
+		    !__reg_operand(chunk, reg_offset + 2, REG_CONST_FLAG,
+				   &reg_code[3])) {
+			return false;
+		}
+
+		chunk_patch_code(chunk, reg_offset, reg_code, REG_OP_SZ - 1);
+		chunk_write_code(chunk, reg_code[3], line);
+	} else if (__op_prev_is(chunk, 0, OP_VAR_GET, SHORT_OP_SZ) &&
+		   (__op_prev_is(chunk, 1, OP_VAR_GET, SHORT_OP_SZ) ||
+		    __op_prev_is(chunk, 1, OP_CONSTANT, SHORT_OP_SZ))) {
+		reg_offset = chunk->prev_ops[1];
+		code_t lhs_flag = chunk_get_code(chunk, reg_offset) ==
+						  OP_CONSTANT ?
+					  REG_CONST_FLAG :
+					  0;
+
+		if (!__reg_operand(chunk, reg_offset + 1, lhs_flag,
+				   &reg_code[2]) ||
+		    !__reg_operand(chunk, chunk->prev_ops[0] + 1, 0,
+				   &reg_code[3])) {
+			return false;
+		}
+
+		chunk_patch_code(chunk, reg_offset, reg_code, REG_OP_SZ);
+	} else {
+		return false;
+	}
+
+	chunk->prev_ops[0] = chunk->prev_ops[1] = reg_offset;
+	return true;
+}
+
+/**
+ * @brief retargets a register op followed by a local assignment statement
+ * so the result is written straight into the local's slot
+ *
+ * @param chunk the chunk being written
+ * @return true the assignment was folded into the register op
+ * @return false the assignment does not follow a register op
+ */
+static inline bool __reg_dest_write(chunk_t *chunk)
+{
+	if (!__op_prev_is(chunk, 0, OP_VAR_SET, SHORT_OP_SZ) ||
+	    !__op_prev_fits(chunk, 1, REG_OP_SZ)) {
+		return false;
+	}
+
+	size_t reg_offset = chunk->prev_ops[1];
+	code_t dest = chunk_get_code(chunk, chunk->prev_ops[0] + 1);
+
+	if (!__op_is_reg(chunk_get_code(chunk, reg_offset)) ||
+	    chunk_get_code(chunk, reg_offset + 1) != REG_DEST_PUSH ||
+	    dest == REG_DEST_PUSH) {
+		return false;
+	}
+
+	chunk_patch_code(chunk, reg_offset + 1, &dest, 1);
+	chunk_truncate_code(chunk, SHORT_OP_SZ);
+	chunk->prev_ops[0] = reg_offset;
+
+	return true;
+}
+#else
+static inline bool __reg_op_write(chunk_t *chunk, op_code_t reg_op,
+				  uint32_t line)
+{
+	return false;
+}
+
+static inline bool __reg_dest_write(chunk_t *chunk)
+{
+	return false;
+}
+#endif // REGISTER_OPS
 
 static inline void __extended_op(chunk_t *chunk, op_code_t short_op,
 				 op_code_t long_op, uint32_t offset,
 				 uint32_t line)
 {
+	__op_begin(chunk);
+
 	if (offset <= UINT8_MAX) {
 		chunk_write_code(chunk, (code_t)short_op, line);
 		chunk_write_code(chunk, (code_t)offset, line);
@@ -31,6 +217,7 @@ static inline void __extended_op(chunk_t *chunk, op_code_t short_op,
 static inline long __jump_instr_write(chunk_t *chunk, code_t jump_code,
 				      uint32_t line)
 {
+	__op_begin(chunk);
 	chunk_write_code(chunk, jump_code, line);
 	chunk_reserve_code(chunk, 2);
 
@@ -46,15 +233,190 @@ static inline bool op_patch_jump(lox_fn_t *fn, long offset)
 	}
 
 	chunk_patch_code(&fn->chunk, offset, &jump, 2);
+	fn->chunk.label = chunk_cur_instr(&fn->chunk);
 
 	return true;
 }
 
+/**
+ * @brief marks the current instruction as the start of a loop
+ *
+ * @param fn the function being written
+ * @return long the offset to pass to OP_LOOP_WRITE()
+ */
+static inline long op_loop_begin(lox_fn_t *fn)
+{
+	fn->chunk.label = chunk_cur_instr(&fn->chunk);
+
+	return fn->chunk.label;
+}
+
+/**
+ * @brief reads the constant loaded by a previously written op. A local read
+ * fused with a constant only counts when its local is not an operand, I.E.
+ * when the op is the oldest of the operands being read
+ *
+ * @param chunk the chunk being written
+ * @param back how many ops back to read. Zero is the last written op
+ * @param oldest whether the op is the first operand
+ * @param val set to the loaded constant
+ * @return true the op loads a constant
+ * @return false the op is not a constant load or is a jump target
+ */
+static inline bool __op_prev_const(chunk_t *chunk, size_t back, bool oldest,
+				   lox_val_t *val)
+{
+	size_t offset = chunk->prev_ops[back];
+
+	if (__op_prev_is(chunk, back, OP_NIL, 1)) {
+		*val = VAL_CREATE_NIL;
+	} else if (__op_prev_is(chunk, back, OP_TRUE, 1)) {
+		*val = VAL_CREATE_BOOL(true);
+	} else if (__op_prev_is(chunk, back, OP_FALSE, 1)) {
+		*val = VAL_CREATE_BOOL(false);
+	} else if (__op_prev_is(chunk, back, OP_CONSTANT, SHORT_OP_SZ)) {
+		*val = chunk_get_const(chunk, chunk_get_code(chunk, offset + 1));
+	} else if (oldest && __op_prev_is(chunk, back, OP_VAR_GET_CONST,
+					  SHORT_OP_SZ + 1)) {
+		*val = chunk_get_const(chunk, chunk_get_code(chunk, offset + 2));
+	} else {
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * @brief reads the constants loaded by the last written ops, for folding
+ * operations over them at compile time
+ *
+ * @param fn the function being written
+ * @param cnt the number of operands, at most CHUNK_PREV_OPS
+ * @param vals set to the operands in the order they were loaded
+ * @return true every operand is a constant
+ * @return false an operand is computed at runtime
+ */
+static inline bool op_prev_consts(lox_fn_t *fn, size_t cnt, lox_val_t *vals)
+{
+	for (size_t back = 0; back < cnt; back++) {
+		if (!__op_prev_const(&fn->chunk, back, back == cnt - 1,
+				     &vals[cnt - back - 1])) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/**
+ * @brief removes the constant loads read by op_prev_consts(). Constants only
+ * used by the removed loads are dropped from the constant table
+ *
+ * @param fn the function being written
+ * @param cnt the number of operands read
+ */
+static inline void op_drop_consts(lox_fn_t *fn, size_t cnt)
+{
+	chunk_t *chunk = &fn->chunk;
+	size_t offset = chunk->prev_ops[cnt - 1];
+
+	for (size_t back = 0; back < cnt; back++) {
+		size_t op_offset = chunk->prev_ops[back];
+		code_t code = chunk_get_code(chunk, op_offset);
+
+		if (code == OP_CONSTANT) {
+			chunk_release_const(chunk,
+					    chunk_get_code(chunk, op_offset + 1));
+		} else if (code == OP_VAR_GET_CONST) {
+			chunk_release_const(chunk,
+					    chunk_get_code(chunk, op_offset + 2));
+		}
+	}
+
+	// a fused local read is split back out and kept
+	if (chunk_get_code(chunk, offset) == OP_VAR_GET_CONST) {
+		code_t var_get = OP_VAR_GET;
+
+		chunk_patch_code(chunk, offset, &var_get, 1);
+		offset += SHORT_OP_SZ;
+		cnt--;
+	}
+
+	chunk_truncate_code(chunk, chunk_cur_instr(chunk) - offset);
+
+	for (size_t op = 0; op < CHUNK_PREV_OPS; op++) {
+		if (op + cnt < CHUNK_PREV_OPS) {
+			chunk->prev_ops[op] = chunk->prev_ops[op + cnt];
+		} else {
+			// forgotten ops are given no size so are never fused
+			chunk->prev_ops[op] = op ? chunk->prev_ops[op - 1] :
+						   offset;
+		}
+	}
+}
+
+//! @brief point in a function's code which later writes can be undone to
+struct op_mark {
+	size_t code_cnt;
+	size_t const_cnt;
+	size_t prop_cache_cnt;
+	size_t prev_ops[CHUNK_PREV_OPS];
+	size_t label;
+};
+
+/**
+ * @brief marks the current point in the function's code
+ *
+ * @param fn the function being written
+ * @return struct op_mark the mark to pass to op_rewind()
+ */
+static inline struct op_mark op_get_mark(lox_fn_t *fn)
+{
+	struct op_mark mark = {
+		.code_cnt = chunk_cur_instr(&fn->chunk),
+		.const_cnt = list_size(&fn->chunk.consts),
+		.prop_cache_cnt = list_size(&fn->chunk.prop_caches),
+		.label = fn->chunk.label,
+	};
+
+	memcpy(mark.prev_ops, fn->chunk.prev_ops, sizeof(mark.prev_ops));
+	return mark;
+}
+
+/**
+ * @brief discards everything written to the function since the mark was
+ * taken. Only valid for code which nothing else refers to, such as a
+ * skipped expression
+ *
+ * @param fn the function being written
+ * @param mark the mark returned by op_get_mark()
+ */
+static inline void op_rewind(lox_fn_t *fn, struct op_mark mark)
+{
+	chunk_t *chunk = &fn->chunk;
+
+	chunk_truncate_code(chunk, chunk_cur_instr(chunk) - mark.code_cnt);
+	chunk_truncate_consts(chunk,
+			      list_size(&chunk->consts) - mark.const_cnt);
+	list_pop_bulk(&chunk->prop_caches,
+		      list_size(&chunk->prop_caches) - mark.prop_cache_cnt);
+	memcpy(chunk->prev_ops, mark.prev_ops, sizeof(mark.prev_ops));
+	chunk->label = mark.label;
+}
+
 static inline void OP_CONST_WRITE(lox_fn_t *fn, lox_val_t const_val,
 				  uint32_t line)
 {
 	uint32_t const_offset =
 		(uint32_t)chunk_write_const(&fn->chunk, const_val);
+
+	if (const_offset <= UINT8_MAX &&
+	    __op_prev_is(&fn->chunk, 0, OP_VAR_GET, SHORT_OP_SZ)) {
+		__op_fuse(&fn->chunk, OP_VAR_GET_CONST);
+		chunk_write_code(&fn->chunk, (code_t)const_offset, line);
+		return;
+	}
+
 	__extended_op(&fn->chunk, OP_CONSTANT, OP_CONSTANT_LONG, const_offset,
 		      line);
 }
@@ -69,12 +431,14 @@ static inline void OP_CLOSURE_WRITE(lox_fn_t *fn, lox_val_t const_val,
 
 static inline void OP_CALL_WRITE(lox_fn_t *fn, uint8_t arg_cnt, uint32_t line)
 {
+	__op_begin(&fn->chunk);
 	chunk_write_code(&fn->chunk, OP_CALL, line);
 	chunk_write_code(&fn->chunk, (code_t)arg_cnt, line);
 }
 
 static inline void OP_POP_COUNT_WRITE(lox_fn_t *fn, uint32_t cnt, uint32_t line)
 {
+	__op_begin(&fn->chunk);
 	chunk_write_code(&fn->chunk, OP_POP_COUNT, line);
 	chunk_write_code(&fn->chunk, (code_t)cnt, line);
 }
@@ -87,35 +451,97 @@ static inline bool OP_LOOP_WRITE(lox_fn_t *fn, long loop_begin, uint32_t line)
 		return false;
 	}
 
+	__op_begin(&fn->chunk);
 	chunk_write_code_extended(&fn->chunk, OP_JUMP, line, &jump,
 				  sizeof(int16_t));
 
 	return true;
 }
 
+/**
+ * @brief writes the entry check of a range loop, skipping the loop when the
+ * range is empty. The counter slot is followed by the exclusive range end.
+ *
+ * @param fn the function to write to
+ * @param counter the slot of the range counter
+ * @param line the line number
+ * @return long the offset to pass to op_patch_jump()
+ */
+static inline long OP_FOR_RANGE_INIT_WRITE(lox_fn_t *fn, uint8_t counter,
+					   uint32_t line)
+{
+	__op_begin(&fn->chunk);
+	chunk_write_code(&fn->chunk, OP_FOR_RANGE_INIT, line);
+	chunk_write_code(&fn->chunk, (code_t)counter, line);
+	chunk_reserve_code(&fn->chunk, 2);
+
+	return chunk_cur_instr(&fn->chunk) - 2;
+}
+
+/**
+ * @brief writes the step of a range loop. The counter is incremented and the
+ * loop jumps back to loop_begin while it is below the range end.
+ *
+ * @param fn the function to write to
+ * @param counter the slot of the range counter
+ * @param loop_begin the offset returned by op_loop_begin()
+ * @param line the line number
+ * @return true if the jump fits in the op
+ */
+static inline bool OP_FOR_RANGE_WRITE(lox_fn_t *fn, uint8_t counter,
+				      long loop_begin, uint32_t line)
+{
+	long jump = loop_begin - chunk_cur_instr(&fn->chunk) - 4;
+
+	if (jump > INT16_MAX || jump < INT16_MIN) {
+		return false;
+	}
+
+	__op_begin(&fn->chunk);
+	chunk_write_code(&fn->chunk, OP_FOR_RANGE, line);
+	chunk_write_code(&fn->chunk, (code_t)counter, line);
+	chunk_reserve_code(&fn->chunk, 2);
+	chunk_patch_code(&fn->chunk, chunk_cur_instr(&fn->chunk) - 2, &jump,
+			 2);
+
+	return true;
+}
+
 static inline void OP_PROPERTY_GET_WRITE(lox_fn_t *fn, lox_val_t prop_name,
 					 uint32_t line)
 {
 	size_t const_offset = chunk_write_const(&fn->chunk, prop_name);
+	size_t cache_offset = chunk_write_prop_cache(&fn->chunk, const_offset);
 	__extended_op(&fn->chunk, OP_PROPERTY_GET, OP_PROPERTY_GET_LONG,
-		      const_offset, line);
+		      cache_offset, line);
 }
 
 static inline void OP_PROPERTY_SET_WRITE(lox_fn_t *fn, lox_val_t prop_name,
 					 uint32_t line)
 {
 	size_t const_offset = chunk_write_const(&fn->chunk, prop_name);
+	size_t cache_offset = chunk_write_prop_cache(&fn->chunk, const_offset);
 	__extended_op(&fn->chunk, OP_PROPERTY_SET, OP_PROPERTY_SET_LONG,
-		      const_offset, line);
+		      cache_offset, line);
 }
 
 #define FUNC_NAME_OF(op) op##_WRITE
 #define CREATE_WRITE_FUNC(instr)                                               \
 	static inline void FUNC_NAME_OF(instr)(lox_fn_t * fn, uint32_t line)   \
 	{                                                                      \
+		__op_begin(&fn->chunk);                                        \
 		chunk_write_code(&fn->chunk, instr, line);                     \
 	}
 
+#define CREATE_BINARY_WRITE_FUNC(instr)                                        \
+	static inline void FUNC_NAME_OF(instr)(lox_fn_t * fn, uint32_t line)   \
+	{                                                                      \
+		if (!__reg_op_write(&fn->chunk, instr##_REG, line)) {          \
+			__op_begin(&fn->chunk);                                \
+			chunk_write_code(&fn->chunk, instr, line);             \
+		}                                                              \
+	}
+
 #define CREATE_JUMP_FUNC(instr)                                                \
 	static inline size_t instr##_WRITE(lox_fn_t *fn, uint32_t line)        \
 	{                                                                      \
@@ -132,32 +558,36 @@ static inline void OP_PROPERTY_SET_WRITE(lox_fn_t *fn, lox_val_t prop_name,
 CREATE_JUMP_FUNC(OP_JUMP)
 CREATE_JUMP_FUNC(OP_JUMP_IF_FALSE)
 
-CREATE_WRITE_FUNC(OP_ADD)
+CREATE_BINARY_WRITE_FUNC(OP_ADD)
+CREATE_BINARY_WRITE_FUNC(OP_SUBTRACT)
+CREATE_BINARY_WRITE_FUNC(OP_MULTIPLY)
+CREATE_BINARY_WRITE_FUNC(OP_DIVIDE)
+CREATE_BINARY_WRITE_FUNC(OP_MOD)
+CREATE_BINARY_WRITE_FUNC(OP_EQUAL)
+CREATE_BINARY_WRITE_FUNC(OP_GREATER)
+CREATE_BINARY_WRITE_FUNC(OP_LESS)
+CREATE_BINARY_WRITE_FUNC(OP_NOT_EQUAL)
+CREATE_BINARY_WRITE_FUNC(OP_GREATER_EQ)
+CREATE_BINARY_WRITE_FUNC(OP_LESS_EQ)
+
 CREATE_WRITE_FUNC(OP_FALSE)
 CREATE_WRITE_FUNC(OP_TRUE)
 CREATE_WRITE_FUNC(OP_NIL)
 CREATE_WRITE_FUNC(OP_NOT)
-CREATE_WRITE_FUNC(OP_SUBTRACT)
-CREATE_WRITE_FUNC(OP_MULTIPLY)
-CREATE_WRITE_FUNC(OP_DIVIDE)
 CREATE_WRITE_FUNC(OP_NEGATE)
-CREATE_WRITE_FUNC(OP_RETURN)
-CREATE_WRITE_FUNC(OP_EQUAL)
-CREATE_WRITE_FUNC(OP_GREATER)
-CREATE_WRITE_FUNC(OP_LESS)
-CREATE_WRITE_FUNC(OP_POP)
 CREATE_WRITE_FUNC(OP_CLOSE_UPVALUE)
-CREATE_WRITE_FUNC(OP_MOD)
 
-CREATE_EXTENDED_WRITE_FUNC(OP_VAR_DEFINE, OP_GLOBAL_DEFINE_LONG)
-CREATE_EXTENDED_WRITE_FUNC(OP_VAR_GET, OP_GLOBAL_GET_LONG)
-CREATE_EXTENDED_WRITE_FUNC(OP_VAR_SET, OP_GLOBAL_SET_LONG)
+CREATE_EXTENDED_WRITE_FUNC(OP_VAR_GET, OP_VAR_GET_LONG)
+CREATE_EXTENDED_WRITE_FUNC(OP_VAR_SET, OP_VAR_SET_LONG)
 CREATE_EXTENDED_WRITE_FUNC(OP_GLOBAL_DEFINE, OP_GLOBAL_DEFINE_LONG)
 CREATE_EXTENDED_WRITE_FUNC(OP_PROPERTY_DEFINE, OP_PROPERTY_DEFINE_LONG)
 CREATE_EXTENDED_WRITE_FUNC(OP_GLOBAL_GET, OP_GLOBAL_GET_LONG)
 CREATE_EXTENDED_WRITE_FUNC(OP_GLOBAL_SET, OP_GLOBAL_SET_LONG)
-CREATE_EXTENDED_WRITE_FUNC(OP_UPVALUE_GET, OP_UPVALUE_SET_LONG)
+CREATE_EXTENDED_WRITE_FUNC(OP_UPVALUE_GET, OP_UPVALUE_GET_LONG)
 CREATE_EXTENDED_WRITE_FUNC(OP_UPVALUE_SET, OP_UPVALUE_SET_LONG)
+CREATE_EXTENDED_WRITE_FUNC(OP_UPVALUE_COPY_GET, OP_UPVALUE_COPY_GET_LONG)
+CREATE_EXTENDED_WRITE_FUNC(OP_FIELD_GET, OP_FIELD_GET_LONG)
+CREATE_EXTENDED_WRITE_FUNC(OP_FIELD_SET, OP_FIELD_SET_LONG)
 
 static inline void OP_UPVALUE_DEFINE_WRITE(lox_fn_t *fn, uint32_t idx,
 					   uint8_t flags, uint32_t line)
@@ -167,27 +597,121 @@ static inline void OP_UPVALUE_DEFINE_WRITE(lox_fn_t *fn, uint32_t idx,
 	chunk_write_code(&fn->chunk, (code_t)flags, line);
 }
 
-static inline void OP_BANG_EQ_WRITE(lox_fn_t *fn, uint32_t line)
+// assignment statements discard the assigned value straight away
+static inline void OP_POP_WRITE(lox_fn_t *fn, uint32_t line)
+{
+	if (__reg_dest_write(&fn->chunk)) {
+		return;
+	} else if (__op_prev_is(&fn->chunk, 0, OP_VAR_SET, SHORT_OP_SZ)) {
+		__op_fuse(&fn->chunk, OP_VAR_SET_POP);
+	} else if (__op_prev_is(&fn->chunk, 0, OP_GLOBAL_SET, SHORT_OP_SZ)) {
+		__op_fuse(&fn->chunk, OP_GLOBAL_SET_POP);
+	} else if (__op_prev_is(&fn->chunk, 0, OP_PROPERTY_SET, SHORT_OP_SZ)) {
+		__op_fuse(&fn->chunk, OP_PROPERTY_SET_POP);
+	} else if (__op_prev_is(&fn->chunk, 0, OP_FIELD_SET, SHORT_OP_SZ)) {
+		__op_fuse(&fn->chunk, OP_FIELD_SET_POP);
+	} else {
+		__op_begin(&fn->chunk);
+		chunk_write_code(&fn->chunk, OP_POP, line);
+	}
+}
+
+// a call returned straight away is made in tail position, reusing the frame
+static inline void OP_RETURN_WRITE(lox_fn_t *fn, uint32_t line)
 {
-	OP_EQUAL_WRITE(fn, line);
-	OP_NOT_WRITE(fn, line);
+	if (__op_prev_is(&fn->chunk, 0, OP_CALL, SHORT_OP_SZ)) {
+		__op_fuse(&fn->chunk, OP_TAIL_CALL);
+		return;
+	}
+
+	__op_begin(&fn->chunk);
+	chunk_write_code(&fn->chunk, OP_RETURN, line);
 }
 
-static inline void OP_GREATER_EQ_WRITE(lox_fn_t *fn, uint32_t line)
+static inline op_code_t __cmp_branch_op(code_t cmp)
 {
-	OP_LESS_WRITE(fn, line);
-	OP_NOT_WRITE(fn, line);
+	switch (cmp) {
+	case OP_EQUAL:
+		return OP_JUMP_IF_NOT_EQUAL;
+	case OP_GREATER:
+		return OP_JUMP_IF_NOT_GREATER;
+	case OP_LESS:
+		return OP_JUMP_IF_NOT_LESS;
+	case OP_NOT_EQUAL:
+		return OP_JUMP_IF_EQUAL;
+	case OP_GREATER_EQ:
+		return OP_JUMP_IF_NOT_GREATER_EQ;
+	case OP_LESS_EQ:
+		return OP_JUMP_IF_NOT_LESS_EQ;
+	case OP_EQUAL_REG:
+		return OP_JUMP_IF_NOT_EQUAL_REG;
+	case OP_GREATER_REG:
+		return OP_JUMP_IF_NOT_GREATER_REG;
+	case OP_LESS_REG:
+		return OP_JUMP_IF_NOT_LESS_REG;
+	case OP_NOT_EQUAL_REG:
+		return OP_JUMP_IF_EQUAL_REG;
+	case OP_GREATER_EQ_REG:
+		return OP_JUMP_IF_NOT_GREATER_EQ_REG;
+	case OP_LESS_EQ_REG:
+		return OP_JUMP_IF_NOT_LESS_EQ_REG;
+	default:
+		return OP_NOP;
+	}
 }
 
-static inline void OP_LESS_EQ_WRITE(lox_fn_t *fn, uint32_t line)
+/**
+ * @brief writes a branch taken when the condition just written is false. The
+ * condition is popped on both paths. A comparison written straight before
+ * the branch is fused into it, so the condition is never pushed
+ *
+ * @param fn the function to write to
+ * @param line the line number
+ * @return long the offset to pass to op_patch_jump()
+ */
+static inline long OP_JUMP_IF_FALSE_POP_WRITE(lox_fn_t *fn, uint32_t line)
 {
-	OP_GREATER_WRITE(fn, line);
-	OP_NOT_WRITE(fn, line);
+	chunk_t *chunk = &fn->chunk;
+	size_t cmp_offset = chunk->prev_ops[0];
+
+	if (__op_prev_fits(chunk, 0, 1) &&
+	    __cmp_branch_op(chunk_get_code(chunk, cmp_offset)) != OP_NOP) {
+		__op_fuse(chunk, __cmp_branch_op(chunk_get_code(chunk,
+								cmp_offset)));
+		chunk_reserve_code(chunk, 2);
+
+		return chunk_cur_instr(chunk) - 2;
+	}
+#ifdef REGISTER_OPS
+	// the pushed destination of a register comparison is dropped, leaving
+	// its two operands
+	if (__op_prev_fits(chunk, 0, REG_OP_SZ) &&
+	    __cmp_branch_op(chunk_get_code(chunk, cmp_offset)) != OP_NOP &&
+	    chunk_get_code(chunk, cmp_offset + 1) == REG_DEST_PUSH) {
+		code_t operands[] = {
+			chunk_get_code(chunk, cmp_offset + 2),
+			chunk_get_code(chunk, cmp_offset + 3),
+		};
+
+		__op_fuse(chunk, __cmp_branch_op(chunk_get_code(chunk,
+								cmp_offset)));
+		chunk_patch_code(chunk, cmp_offset + 1, operands, 2);
+		chunk_truncate_code(chunk, 1);
+		chunk_reserve_code(chunk, 2);
+
+		return chunk_cur_instr(chunk) - 2;
+	}
+#endif // REGISTER_OPS
+
+	return __jump_instr_write(chunk, OP_JUMP_IF_FALSE_POP, line);
 }
 
+#undef CREATE_BINARY_WRITE_FUNC
 #undef CREATE_JUMP_FUNC
 #undef CREATE_EXTENDED_WRITE_FUNC
 #undef CREATE_WRITE_FUNC
 #undef FUNC_NAME_OF
+#undef SHORT_OP_SZ
+#undef REG_OP_SZ
 
 #endif // __CLOX_COMPILER_OPS_FUNC_H__
\ No newline at end of file
@@ -7,6 +7,8 @@
 #ifndef __CLOX_OPS_H__
 #define __CLOX_OPS_H__
 
+#include <stdint.h>
+
 //! @brief size of an extended op code
 #define EXT_CODE_SZ (sizeof(uint8_t) * 3)
 //! @brief mask for retrieving the extended op code
@@ -14,11 +16,42 @@
 //! @brief max value that an extended op code can hold
 #define EXT_CODE_MAX (UINT8_MAX * 24)
 
-#define X(a) a,
+//! @brief register operand flag marking a constant rather than a frame slot
+#define REG_CONST_FLAG (0x80)
+//! @brief max frame slot or constant offset a register operand can hold
+#define REG_OPERAND_MAX (REG_CONST_FLAG - 1)
+//! @brief register destination which pushes the result onto the stack
+#define REG_DEST_PUSH (UINT8_MAX)
+
+//! @brief upvalue define flag marking a slot of the enclosing frame rather
+//! than one of its upvalues
+#define UPVAL_LOCAL_FLAG (0x01)
+//! @brief upvalue define flag marking an immutable capture, copied by value
+#define UPVAL_COPY_FLAG (0x02)
+
+#define X(op, width) op,
 //! @brief enum of operations the VM can perform
 typedef enum __opcode {
 #include "ops_table.h"
 } op_code_t;
 #undef X
 
+#define X(op, width) [op] = 1 + (width),
+//! @brief op length table. SHOULD NOT BE ACCESSED DIRECTLY. @see op_len()
+static const uint8_t op_code_lens[UINT8_MAX + 1] = {
+#include "ops_table.h"
+};
+#undef X
+
+/**
+ * @brief gets the length of an op, including its operands
+ *
+ * @param op the op code
+ * @return uint8_t the op length, or zero if the op is unknown
+ */
+static inline uint8_t op_len(op_code_t op)
+{
+	return op_code_lens[(uint8_t)op];
+}
+
 #endif // __CLOX_OPS_H__
@@ -2,58 +2,101 @@
  * @file ops_table.h
  * @author Dylan Mayor
  * @brief X define header file which holds information about vm operations and their display names.
- * Used to populate op name and function defines whilst keeping opcode information in one place
+ * Used to populate op name and function defines whilst keeping opcode information in one place.
+ * Each op is listed with the number of operand bytes which follow it
  *
  * @see ops_name.h
  * @see ops.h
  *
  */
-X(OP_NOP)
-X(OP_CONSTANT)
-X(OP_CONSTANT_LONG)
-X(OP_CLOSURE)
-X(OP_CLOSURE_LONG)
-X(OP_EQUAL)
-X(OP_GREATER)
-X(OP_LESS)
-X(OP_NIL)
-X(OP_TRUE)
-X(OP_FALSE)
-X(OP_NOT)
-X(OP_ADD)
-X(OP_MOD)
-X(OP_SUBTRACT)
-X(OP_MULTIPLY)
-X(OP_DIVIDE)
-X(OP_NEGATE)
-X(OP_POP)
-X(OP_POP_COUNT)
-X(OP_VAR_DEFINE)
-X(OP_VAR_DEFINE_LONG)
-X(OP_VAR_GET)
-X(OP_VAR_GET_LONG)
-X(OP_VAR_SET)
-X(OP_VAR_SET_LONG)
-X(OP_GLOBAL_DEFINE)
-X(OP_GLOBAL_DEFINE_LONG)
-X(OP_GLOBAL_GET)
-X(OP_GLOBAL_GET_LONG)
-X(OP_GLOBAL_SET)
-X(OP_GLOBAL_SET_LONG)
-X(OP_UPVALUE_GET)
-X(OP_UPVALUE_GET_LONG)
-X(OP_UPVALUE_SET)
-X(OP_UPVALUE_SET_LONG)
-X(OP_UPVALUE_DEFINE)
-X(OP_UPVALUE_DEFINE_LONG)
-X(OP_PROPERTY_DEFINE)
-X(OP_PROPERTY_DEFINE_LONG)
-X(OP_PROPERTY_GET)
-X(OP_PROPERTY_GET_LONG)
-X(OP_PROPERTY_SET)
-X(OP_PROPERTY_SET_LONG)
-X(OP_CLOSE_UPVALUE)
-X(OP_JUMP)
-X(OP_JUMP_IF_FALSE)
-X(OP_CALL)
-X(OP_RETURN)
+X(OP_NOP, 0)
+X(OP_CONSTANT, 1)
+X(OP_CONSTANT_LONG, EXT_CODE_SZ)
+X(OP_CLOSURE, 1)
+X(OP_CLOSURE_LONG, EXT_CODE_SZ)
+X(OP_EQUAL, 0)
+X(OP_GREATER, 0)
+X(OP_LESS, 0)
+X(OP_NIL, 0)
+X(OP_TRUE, 0)
+X(OP_FALSE, 0)
+X(OP_NOT, 0)
+X(OP_ADD, 0)
+X(OP_MOD, 0)
+X(OP_SUBTRACT, 0)
+X(OP_MULTIPLY, 0)
+X(OP_DIVIDE, 0)
+X(OP_NEGATE, 0)
+X(OP_POP, 0)
+X(OP_POP_COUNT, 1)
+X(OP_VAR_GET, 1)
+X(OP_VAR_GET_LONG, EXT_CODE_SZ)
+X(OP_VAR_SET, 1)
+X(OP_VAR_SET_LONG, EXT_CODE_SZ)
+X(OP_GLOBAL_DEFINE, 1)
+X(OP_GLOBAL_DEFINE_LONG, EXT_CODE_SZ)
+X(OP_GLOBAL_GET, 1)
+X(OP_GLOBAL_GET_LONG, EXT_CODE_SZ)
+X(OP_GLOBAL_SET, 1)
+X(OP_GLOBAL_SET_LONG, EXT_CODE_SZ)
+X(OP_UPVALUE_GET, 1)
+X(OP_UPVALUE_GET_LONG, EXT_CODE_SZ)
+X(OP_UPVALUE_SET, 1)
+X(OP_UPVALUE_SET_LONG, EXT_CODE_SZ)
+X(OP_UPVALUE_DEFINE, 2)
+X(OP_UPVALUE_DEFINE_LONG, EXT_CODE_SZ + 1)
+X(OP_PROPERTY_DEFINE, 1)
+X(OP_PROPERTY_DEFINE_LONG, EXT_CODE_SZ)
+X(OP_PROPERTY_GET, 1)
+X(OP_PROPERTY_GET_LONG, EXT_CODE_SZ)
+X(OP_PROPERTY_SET, 1)
+X(OP_PROPERTY_SET_LONG, EXT_CODE_SZ)
+X(OP_CLOSE_UPVALUE, 0)
+X(OP_JUMP, 2)
+X(OP_JUMP_IF_FALSE, 2)
+X(OP_CALL, 1)
+X(OP_RETURN, 0)
+X(OP_ADD_NUM, 0)
+X(OP_ADD_STR, 0)
+X(OP_EQUAL_NUM, 0)
+X(OP_VAR_GET_CONST, 2)
+X(OP_VAR_SET_POP, 1)
+X(OP_GLOBAL_SET_POP, 1)
+X(OP_PROPERTY_SET_POP, 1)
+X(OP_ADD_REG, 3)
+X(OP_SUBTRACT_REG, 3)
+X(OP_MULTIPLY_REG, 3)
+X(OP_DIVIDE_REG, 3)
+X(OP_MOD_REG, 3)
+X(OP_EQUAL_REG, 3)
+X(OP_GREATER_REG, 3)
+X(OP_LESS_REG, 3)
+X(OP_TAIL_CALL, 1)
+X(OP_FOR_RANGE_INIT, 3)
+X(OP_FOR_RANGE, 3)
+X(OP_JUMP_IF_FALSE_POP, 2)
+X(OP_JUMP_IF_NOT_EQUAL, 2)
+X(OP_JUMP_IF_NOT_GREATER, 2)
+X(OP_JUMP_IF_NOT_LESS, 2)
+X(OP_JUMP_IF_NOT_EQUAL_REG, 4)
+X(OP_JUMP_IF_NOT_GREATER_REG, 4)
+X(OP_JUMP_IF_NOT_LESS_REG, 4)
+X(OP_GREATER_EQ, 0)
+X(OP_LESS_EQ, 0)
+X(OP_NOT_EQUAL, 0)
+X(OP_GREATER_EQ_REG, 3)
+X(OP_LESS_EQ_REG, 3)
+X(OP_NOT_EQUAL_REG, 3)
+X(OP_JUMP_IF_NOT_GREATER_EQ, 2)
+X(OP_JUMP_IF_NOT_LESS_EQ, 2)
+X(OP_JUMP_IF_EQUAL, 2)
+X(OP_JUMP_IF_NOT_GREATER_EQ_REG, 4)
+X(OP_JUMP_IF_NOT_LESS_EQ_REG, 4)
+X(OP_JUMP_IF_EQUAL_REG, 4)
+X(OP_UPVALUE_COPY_GET, 1)
+X(OP_UPVALUE_COPY_GET_LONG, EXT_CODE_SZ)
+X(OP_FIELD_GET, 1)
+X(OP_FIELD_GET_LONG, EXT_CODE_SZ)
+X(OP_FIELD_SET, 1)
+X(OP_FIELD_SET_LONG, EXT_CODE_SZ)
+X(OP_FIELD_SET_POP, 1)
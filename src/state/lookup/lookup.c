@@ -135,6 +135,22 @@ lookup_var_t lookup_find_name(const lookup_t *lookup, const char *name,
 		     (lookup_var_t){ .var_flags = LOOKUP_VAR_NOT_DECLARED };
 }
 
+lookup_var_t lookup_set_class(lookup_t *lookup, const char *name, size_t len,
+			      const struct object_class *cls, bool is_instance)
+{
+	lookup_var_t *var = __lookup_find_name_ptr(lookup, name, len);
+
+	if (!var) {
+		return LOOKUP_VAR_TYPE_INVALID;
+	}
+
+	var->cls = cls;
+	var->var_flags &= ~LOOKUP_VAR_INSTANCE;
+	var->var_flags |= is_instance ? LOOKUP_VAR_INSTANCE : LOOKUP_VAR_CLASS;
+
+	return *var;
+}
+
 static struct name_matcher __create_name_matcher(const char *name, size_t len)
 {
 	return (struct name_matcher){
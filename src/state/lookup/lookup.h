@@ -76,6 +76,22 @@ lookup_var_t lookup_find_name(const lookup_t *lookup, const char *name,
  */
 bool lookup_has_name(const lookup_t *lookup, const char *name, size_t name_sz);
 
+/**
+ * @brief records the class a defined variable is known to hold at compile
+ * time
+ *
+ * @param lookup the lookup table
+ * @param name the variable name
+ * @param name_sz the name length
+ * @param cls the known class
+ * @param is_instance whether the variable holds an instance of the class,
+ * rather than the class itself
+ * @return lookup_var_t the updated lookup variable
+ */
+lookup_var_t lookup_set_class(lookup_t *lookup, const char *name,
+			      size_t name_sz, const struct object_class *cls,
+			      bool is_instance);
+
 static inline uint32_t lookup_get_size(const lookup_t *lookup)
 {
 	return (uint32_t)map_size(&lookup->table);
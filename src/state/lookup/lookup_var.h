@@ -111,18 +111,38 @@ typedef uint8_t var_flags_t;
  *
  */
 #define LOOKUP_VAR_UPVAL (1 << 4)
+/**
+ * @brief flag to indicate lookup variable holds its known class. Default value
+ *
+ * @see var_flags_t
+ * @see lookup_var_is_instance()
+ *
+ */
+#define LOOKUP_VAR_CLASS (0 << 5)
+/**
+ * @brief flag to indicate lookup variable holds an instance of its known class
+ *
+ * @see var_flags_t
+ * @see lookup_var_is_instance()
+ *
+ */
+#define LOOKUP_VAR_INSTANCE (1 << 5)
 #pragma endregion
 
+struct object_class;
+
 //! @brief lookup variable
 typedef struct __lookup_var {
 	uint32_t idx;
 	var_flags_t var_flags;
+	//! @brief class the variable is known to hold at compile time, if any
+	const struct object_class *cls;
 } lookup_var_t;
 
 #define LOOKUP_VAR_TYPE_INVALID                                                \
 	(lookup_var_t)                                                         \
 	{                                                                      \
-		.idx = 0, .var_flags = LOOKUP_VAR_INVALID_FLAG,                \
+		.idx = 0, .var_flags = LOOKUP_VAR_INVALID_FLAG, .cls = NULL,   \
 	}
 
 static inline bool lookup_var_is_valid(lookup_var_t var)
@@ -189,4 +209,17 @@ static inline bool lookup_var_is_upval(lookup_var_t var)
 {
 	return var.var_flags & LOOKUP_VAR_UPVAL;
 }
+
+/**
+ * @brief returns whether the variable holds an instance of its known class,
+ * rather than the class itself
+ *
+ * @param var the variable to check
+ * @return true variable holds an instance
+ * @return false variable holds the class, or its class isn't known
+ */
+static inline bool lookup_var_is_instance(lookup_var_t var)
+{
+	return var.var_flags & LOOKUP_VAR_INSTANCE;
+}
 #endif // __CLOX_STATE_LOOKUP_VAR_H__
\ No newline at end of file
@@ -58,7 +58,9 @@ void list_reset(list_t *lst)
 
 void list_free(list_t *lst)
 {
-	FREE_LIST(lst->type_sz, lst->data, lst->cap);
+	if (!lst->arena && !lst->borrowed) {
+		FREE_LIST(lst->type_sz, lst->data, lst->cap);
+	}
 	__list_init(lst);
 }
 
@@ -73,7 +75,22 @@ void list_set_cap(list_t *lst, size_t cap)
 {
 	size_t old_cap = lst->cap;
 	lst->cap = cap;
-	lst->data = GROW_LIST(lst->type_sz, lst->data, old_cap, lst->cap);
+
+	if (lst->borrowed) {
+		uint8_t *owned = GROW_LIST(lst->type_sz, NULL, 0, lst->cap);
+
+		memcpy(owned, lst->data,
+		       lst->type_sz * (old_cap < cap ? old_cap : cap));
+		lst->data = owned;
+		lst->borrowed = false;
+	} else if (lst->arena) {
+		lst->data = arena_realloc(lst->arena, lst->data,
+					  lst->type_sz * old_cap,
+					  lst->type_sz * lst->cap);
+	} else {
+		lst->data = GROW_LIST(lst->type_sz, lst->data, old_cap,
+				      lst->cap);
+	}
 	lst->head = lst->data + (lst->type_sz * lst->cnt);
 }
 
@@ -101,6 +118,7 @@ static void __list_init(list_t *lst)
 	lst->cnt = 0;
 	lst->data = NULL;
 	lst->head = NULL;
+	lst->borrowed = false;
 }
 
 static void __list_inc_head(list_t *lst, size_t cnt)
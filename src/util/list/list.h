@@ -11,6 +11,7 @@
 
 #include <stddef.h>
 #include "util/mem/mem.h"
+#include "util/mem/arena.h"
 
 /**
  * @brief list struct. Created using list_new() or list_of_type(). contents must be freed after use by parser_free()
@@ -25,6 +26,11 @@ typedef struct __list {
 	size_t type_sz;
 	uint8_t *data;
 	uint8_t *head;
+	//! @brief arena the items are allocated from. NULL for the heap
+	arena_t *arena;
+	//! @brief whether the items are borrowed from a buffer the list does
+	//! not own. The items are copied out before the list first grows
+	bool borrowed;
 } list_t;
 
 //! @brief for each function implementation
@@ -40,6 +46,19 @@ typedef void (*for_each_fn)(void *);
  */
 #define list_of_type(elem_type) (list_new(sizeof(elem_type)))
 
+/**
+ * @brief creates a new list to hold the given type, with its items allocated
+ * from an arena. The items are released with the arena, so list_free() only
+ * empties the list
+ *
+ * @param elem_type the element type to hold
+ * @param arena the arena to allocate from
+ *
+ * @return list_t the created list
+ */
+#define list_of_type_in(elem_type, arena)                                      \
+	(list_new_in(sizeof(elem_type), (arena)))
+
 /**
  * @brief gets a value from the list. Indexing begins at zero
  * Note: Index bounds are only checked when the debug flag is set
@@ -159,9 +178,49 @@ static inline list_t list_new(size_t data_sz)
 		.type_sz = data_sz,
 		.data = NULL,
 		.head = NULL,
+		.arena = NULL,
+		.borrowed = false,
 	};
 }
 
+/**
+ * @brief creates a list over items held in a buffer the list does not own,
+ * such as a file mapping. The buffer must outlive the list. The items may
+ * be written in place, but are copied to a buffer of the list's own before
+ * it grows
+ *
+ * @param data_sz the size of the data item
+ * @param data the items
+ * @param cnt the number of items
+ * @return list_t the new list
+ */
+static inline list_t list_borrow(size_t data_sz, void *data, size_t cnt)
+{
+	list_t lst = list_new(data_sz);
+	lst.cnt = lst.cap = cnt;
+	lst.data = data;
+	lst.head = lst.data + (data_sz * cnt);
+	lst.borrowed = true;
+
+	return lst;
+}
+
+/**
+ * @brief creates a new arraylist to hold items at the given data size, with
+ * the items allocated from an arena
+ *
+ * @param data_sz the size of the data item
+ * @param arena the arena to allocate from
+ * @return list_t the new list
+ */
+static inline list_t list_new_in(size_t data_sz, arena_t *arena)
+{
+	list_t lst = list_new(data_sz);
+	lst.arena = arena;
+
+	return lst;
+}
+
 /**
  * @brief gets the list size
  *
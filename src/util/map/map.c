@@ -1,5 +1,6 @@
 #include "map.h"
 
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
@@ -10,12 +11,16 @@ struct __map_entry {
 	void *key;
 	hash_t hash;
 	bool tombstoned;
-	uint8_t value[];
+	// values are aligned so they can be read in place
+	_Alignas(max_align_t) uint8_t value[];
 };
 
 #define EMPTY_MAP_ENTRY ((struct map_entry){ .key = NULL, .value = NULL })
 
-#define SIZEOF_ENTRY(map) (sizeof(struct __map_entry) + (map)->data_sz)
+#define ENTRY_ALIGN (_Alignof(struct __map_entry))
+#define SIZEOF_ENTRY(map)                                                      \
+	((sizeof(struct __map_entry) + (map)->data_sz + ENTRY_ALIGN - 1) &    \
+	 ~(ENTRY_ALIGN - 1))
 #define ENTRY_AT(map, idx)                                                     \
 	((struct __map_entry *)((map)->entries + (SIZEOF_ENTRY(map) * idx)))
 
@@ -289,8 +294,7 @@ static void __entry_revive(hashmap_t *map, struct __map_entry *entry)
 
 void map_free(hashmap_t *map)
 {
-	reallocate(map->entries,
-		   (sizeof(struct __map_entry) + map->data_sz) * map->cap, 0);
+	reallocate(map->entries, SIZEOF_ENTRY(map) * map->cap, 0);
 	map->cap = 0;
 	map->cnt = 0;
 	map->tomb_cnt = 0;
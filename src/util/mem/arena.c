@@ -0,0 +1,106 @@
+#include "arena.h"
+#include "mem.h"
+
+#include <string.h>
+
+//! @brief alignment of every allocation
+#define ARENA_ALIGN (_Alignof(max_align_t))
+
+#define ALIGN_UP(sz) (((sz) + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1))
+
+struct arena_block {
+	struct arena_block *prev;
+	size_t cap;
+	size_t used;
+	_Alignas(max_align_t) uint8_t data[];
+};
+
+static struct arena_block *__arena_add_block(arena_t *arena, size_t min_sz);
+
+void *arena_alloc(arena_t *arena, size_t sz)
+{
+	struct arena_block *block = arena->head;
+
+	sz = ALIGN_UP(sz);
+
+	if (!block || block->cap - block->used < sz) {
+		block = __arena_add_block(arena, sz);
+	}
+
+	void *pointer = block->data + block->used;
+
+	block->used += sz;
+	arena->last = pointer;
+
+	return pointer;
+}
+
+void *arena_realloc(arena_t *arena, void *pointer, size_t old_sz,
+		    size_t new_sz)
+{
+	if (!pointer) {
+		return arena_alloc(arena, new_sz);
+	}
+
+	struct arena_block *block = arena->head;
+	size_t old_aligned = ALIGN_UP(old_sz);
+	size_t new_aligned = ALIGN_UP(new_sz);
+
+	// the last allocation ends at the block's used mark, so can move it
+	if (pointer == arena->last &&
+	    block->cap - block->used + old_aligned >= new_aligned) {
+		block->used = block->used - old_aligned + new_aligned;
+
+		return pointer;
+	}
+
+	if (new_sz <= old_sz) {
+		return pointer;
+	}
+
+	void *moved = arena_alloc(arena, new_sz);
+	memcpy(moved, pointer, old_sz);
+
+	return moved;
+}
+
+void arena_free(arena_t *arena)
+{
+	struct arena_block *block = arena->head;
+
+	while (block) {
+		struct arena_block *prev = block->prev;
+
+		reallocate(block, sizeof(struct arena_block) + block->cap, 0);
+		block = prev;
+	}
+
+	*arena = arena_new();
+}
+
+/**
+ * @brief adds a block to the arena which can hold at least min_sz bytes.
+ * Allocations bigger than a standard block get a block of their own
+ *
+ * @param arena the arena
+ * @param min_sz the aligned size of the allocation needing the block
+ * @return struct arena_block* the new block
+ */
+static struct arena_block *__arena_add_block(arena_t *arena, size_t min_sz)
+{
+	size_t cap = ARENA_BLOCK_SZ - sizeof(struct arena_block);
+
+	if (min_sz > cap) {
+		cap = min_sz;
+	}
+
+	struct arena_block *block =
+		reallocate(NULL, 0, sizeof(struct arena_block) + cap);
+
+	block->prev = arena->head;
+	block->cap = cap;
+	block->used = 0;
+	arena->head = block;
+
+	return block;
+}
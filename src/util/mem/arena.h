@@ -0,0 +1,80 @@
+/**
+ * @file arena.h
+ * @author Dylan Mayor
+ * @brief header file for the bump allocator used for short lived data
+ *
+ * Allocations are carved from large blocks and are never freed one at a
+ * time. Everything allocated from an arena is released together by
+ * arena_free(), which suits data that all dies at the same point, such as
+ * the compiler state of a single compile() call.
+ */
+#ifndef __CLOX_UTIL_MEM_ARENA_H__
+#define __CLOX_UTIL_MEM_ARENA_H__
+
+#include "util/common.h"
+
+#include <stddef.h>
+
+//! @brief the size of a standard arena block, including its header
+#define ARENA_BLOCK_SZ (64 * 1024)
+
+struct arena_block;
+
+/**
+ * @brief arena struct. Created using arena_new(). Its allocations must be
+ * released after use with arena_free()
+ *
+ * @see arena_new()
+ * @see arena_free()
+ */
+typedef struct __arena {
+	//! @brief block currently allocated from. Older blocks are chained
+	//! behind it
+	struct arena_block *head;
+	//! @brief the last allocation made, which can grow in place
+	void *last;
+} arena_t;
+
+/**
+ * @brief creates a new empty arena. No memory is held until the first
+ * allocation
+ *
+ * @return arena_t the new arena
+ */
+static inline arena_t arena_new()
+{
+	return (arena_t){ .head = NULL, .last = NULL };
+}
+
+/**
+ * @brief allocates memory from the arena. The memory is aligned for any type
+ * and is valid until the arena is freed
+ *
+ * @param arena the arena
+ * @param sz the number of bytes to allocate
+ * @return void* the allocated memory
+ */
+void *arena_alloc(arena_t *arena, size_t sz);
+
+/**
+ * @brief resizes an allocation made from the arena. The last allocation is
+ * grown in place when the block has room, otherwise the contents are copied
+ * to a new allocation and the old one is left unused
+ *
+ * @param arena the arena
+ * @param pointer the allocation to resize. NULL if a new allocation is needed
+ * @param old_sz the old size
+ * @param new_sz the new size
+ * @return void* the resized allocation
+ */
+void *arena_realloc(arena_t *arena, void *pointer, size_t old_sz,
+		    size_t new_sz);
+
+/**
+ * @brief releases every allocation made from the arena at once
+ *
+ * @param arena the arena to free
+ */
+void arena_free(arena_t *arena);
+
+#endif // __CLOX_UTIL_MEM_ARENA_H__
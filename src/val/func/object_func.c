@@ -4,6 +4,7 @@
 #include "util/map/hash_util.h"
 #include "chunk/func/chunk_func.h"
 #include "util/map/set.h"
+#include "vm/jit/jit.h"
 
 #include <stdio.h>
 #include <string.h>
@@ -17,6 +18,12 @@
 		sizeof(struct object_str) + (sizeof(char) * (str_sz + 1)),     \
 		OBJ_STRING))
 
+#define ALLOCATE_OBJECT_CLOSURE(upval_cnt)                                     \
+	((struct object_closure *)__allocate_object(                           \
+		sizeof(struct object_closure) +                                \
+			(sizeof(lox_closure_upval_t) * (upval_cnt)),           \
+		OBJ_CLOSURE))
+
 #define NATIVE_FN_STR "<native fn>"
 #define UNKNOWN_STR "<unknown>"
 #define SCRIPT_STR "<script>"
@@ -50,8 +57,15 @@ struct object_fn *object_fn_new()
 
 	fn->arity = 0;
 	fn->upval_cnt = 0;
+	fn->max_slots = 0;
 	fn->name = NULL;
 	fn->chunk = chunk_new();
+	fn->call_cnt = 0;
+	fn->native = NULL;
+	fn->native_sz = 0;
+	fn->closure = NULL;
+	fn->image = NULL;
+	fn->image_idx = 0;
 
 	return fn;
 }
@@ -60,14 +74,14 @@ struct object_str *object_str_concat(const struct object_str *a,
 				     const struct object_str *b)
 {
 	size_t concat_len = a->len + b->len;
-	char *concat_str = reallocate(NULL, 0, concat_len);
+	char *concat_str = reallocate(NULL, 0, concat_len + 1);
 
 	memcpy(concat_str, a->chars, a->len);
 	memcpy(concat_str + a->len, b->chars, b->len);
 	concat_str[concat_len] = '\0';
 
 	struct object_str *concat = __intern_string(concat_str, concat_len);
-	reallocate(concat_str, concat_len, 0);
+	reallocate(concat_str, concat_len + 1, 0);
 
 	return concat;
 }
@@ -83,12 +97,20 @@ struct object_native_fn *object_native_fn_new(native_fn native_fn)
 
 struct object_closure *object_closure_new(struct object_fn *fn)
 {
-	struct object_closure *closure =
-		ALLOCATE_OBJECT(struct object_closure, OBJ_CLOSURE);
+	// closures without upvalues can not be told apart, so one is shared
+	if (fn->closure) {
+		return fn->closure;
+	}
+
+	struct object_closure *closure = ALLOCATE_OBJECT_CLOSURE(fn->upval_cnt);
 
 	closure->fn = fn;
-	closure->upvalues = list_of_type(lox_upval_t);
-	list_set_cap(&closure->upvalues, fn->upval_cnt);
+	memset(closure->upvalues, 0,
+	       sizeof(lox_closure_upval_t) * fn->upval_cnt);
+
+	if (!fn->upval_cnt) {
+		fn->closure = closure;
+	}
 
 	return closure;
 }
@@ -148,6 +170,9 @@ void object_free(struct object *obj)
 
 	case OBJ_FN: {
 		struct object_fn *fn = (struct object_fn *)obj;
+#ifdef VM_JIT
+		jit_free(fn);
+#endif
 		chunk_free(&fn->chunk);
 		FREE(struct object_fn, fn);
 	} break;
@@ -158,8 +183,11 @@ void object_free(struct object *obj)
 
 	case OBJ_CLOSURE: {
 		struct object_closure *closure = (struct object_closure *)obj;
-		list_free(&closure->upvalues);
-		FREE(struct object_closure, obj);
+		reallocate(closure,
+			   sizeof(struct object_closure) +
+				   (sizeof(lox_closure_upval_t) *
+				    closure->fn->upval_cnt),
+			   0);
 	} break;
 
 	case OBJ_UPVALUE:
@@ -270,7 +270,8 @@ hash_t obj_str_gen_hash(const struct object_str *str);
 struct object_native_fn *object_native_fn_new(native_fn native_fn);
 
 /**
- * @brief creates a new closure over the given function
+ * @brief creates a new closure over the given function. Functions without
+ * upvalues share a single closure
  *
  * @param fn the function to wrap
  * @return struct object_closure* the new object closure
@@ -303,7 +304,7 @@ struct object_instance *object_instance_new(struct object_class *cls);
 static inline lox_upval_t *
 object_closure_get_upval(struct object_closure *closure, int idx)
 {
-	return *(lox_upval_t **)list_get(&closure->upvalues, idx);
+	return closure->upvalues[idx].upval;
 }
 
 /**
@@ -321,15 +322,42 @@ static inline void object_closure_set_upval(struct object_closure *closure,
 }
 
 /**
- * @brief pushes the given value on to the upvalue list
+ * @brief binds the given upvalue to its position within the closure
  *
  * @param closure the closure to write to
- * @param val the new upvalue value
+ * @param idx the index of the upvalue
+ * @param upval the upvalue
+ */
+static inline void object_closure_bind_upval(struct object_closure *closure,
+					     int idx, lox_upval_t *upval)
+{
+	closure->upvalues[idx].upval = upval;
+}
+
+/**
+ * @brief gets the copied value at the given position within the closure
+ *
+ * @param closure the closure to read
+ * @param idx the index of the upvalue
+ * @return lox_val_t the value copied in when the closure was created
+ */
+static inline lox_val_t object_closure_get_copy(struct object_closure *closure,
+						int idx)
+{
+	return closure->upvalues[idx].val;
+}
+
+/**
+ * @brief copies the given value in to its position within the closure
+ *
+ * @param closure the closure to write to
+ * @param idx the index of the upvalue
+ * @param val the value to copy
  */
-static inline void object_closure_push_upval(struct object_closure *closure,
-					     lox_upval_t *val)
+static inline void object_closure_bind_copy(struct object_closure *closure,
+					    int idx, lox_val_t val)
 {
-	list_push(&closure->upvalues, &val);
+	closure->upvalues[idx].val = val;
 }
 
 /**
@@ -7,7 +7,7 @@
 
 void val_print(lox_val_t val)
 {
-	switch (val.type) {
+	switch (VAL_TYPE(val)) {
 	case VAL_BOOL:
 		printf(VAL_AS_BOOL(val) ? "true" : "false");
 		break;
@@ -30,7 +30,7 @@ void val_print(lox_val_t val)
 
 lox_val_t val_to_string(lox_val_t val)
 {
-	switch (val.type) {
+	switch (VAL_TYPE(val)) {
 	case VAL_BOOL:
 		if (VAL_AS_BOOL(val)) {
 			return VAL_CREATE_OBJ(LITERAL_OBJECT_STRING("true"));
@@ -43,7 +43,7 @@ lox_val_t val_to_string(lox_val_t val)
 #define BUF_LEN 100
 		char buf[BUF_LEN];
 
-		snprintf(buf, BUF_LEN, "%.15g", val.as.number);
+		snprintf(buf, BUF_LEN, "%.15g", VAL_AS_NUMBER(val));
 
 		lox_val_t num_str =
 			VAL_CREATE_OBJ(object_str_new(buf, strlen(buf)));
@@ -62,7 +62,7 @@ lox_val_t val_to_string(lox_val_t val)
 
 bool val_is_falsey(lox_val_t val)
 {
-	switch (val.type) {
+	switch (VAL_TYPE(val)) {
 	case VAL_NUMBER:
 		return !(bool)VAL_AS_NUMBER(val);
 	case VAL_NIL:
@@ -79,19 +79,19 @@ bool val_is_falsey(lox_val_t val)
 
 bool val_equals(lox_val_t a, lox_val_t b)
 {
-	if (a.type != b.type) {
+	if (VAL_TYPE(a) != VAL_TYPE(b)) {
 		return false;
 	}
 
-	switch (a.type) {
+	switch (VAL_TYPE(a)) {
 	case VAL_BOOL:
-		return a.as.boolean == b.as.boolean;
+		return VAL_AS_BOOL(a) == VAL_AS_BOOL(b);
 
 	case VAL_NIL:
 		return true;
 
 	case VAL_NUMBER:
-		return a.as.number == b.as.number;
+		return VAL_AS_NUMBER(a) == VAL_AS_NUMBER(b);
 
 	case VAL_OBJ:
 		return object_equals(VAL_AS_OBJ(a), VAL_AS_OBJ(b));
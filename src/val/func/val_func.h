@@ -11,6 +11,47 @@
 
 #include "val/val.h"
 
+#ifdef NAN_BOXING
+#include <string.h>
+
+//! @brief sign bit of a double. Set for object and error values
+#define VAL_SIGN_BIT ((uint64_t)0x8000000000000000)
+//! @brief quiet NaN bits. Any value with all of these set is not a number
+#define VAL_QNAN ((uint64_t)0x7ffc000000000000)
+//! @brief tag bit which separates error pointers from object pointers
+#define VAL_ERR_BIT ((uint64_t)0x0001000000000000)
+//! @brief mask of the pointer bits of an object or error value
+#define VAL_PTR_MASK ((uint64_t)0x0000ffffffffffff)
+
+//! @brief nil singleton tag
+#define VAL_TAG_NIL 1
+//! @brief false singleton tag
+#define VAL_TAG_FALSE 2
+//! @brief true singleton tag
+#define VAL_TAG_TRUE 3
+
+//! @brief boxed nil value
+#define VAL_NIL_BITS ((lox_val_t)(VAL_QNAN | VAL_TAG_NIL))
+//! @brief boxed false value
+#define VAL_FALSE_BITS ((lox_val_t)(VAL_QNAN | VAL_TAG_FALSE))
+//! @brief boxed true value
+#define VAL_TRUE_BITS ((lox_val_t)(VAL_QNAN | VAL_TAG_TRUE))
+
+static inline lox_val_t __val_num_to_bits(lox_num_t num)
+{
+	lox_val_t bits;
+	memcpy(&bits, &num, sizeof(bits));
+	return bits;
+}
+
+static inline lox_num_t __val_bits_to_num(lox_val_t bits)
+{
+	lox_num_t num;
+	memcpy(&num, &bits, sizeof(num));
+	return num;
+}
+#endif
+
 /**
  * @brief creates a new lox bool value
  *
@@ -21,14 +62,22 @@
  * @return lox_val_t boolean lox value
  *
  */
+#ifdef NAN_BOXING
+#define VAL_CREATE_BOOL(value) ((value) ? VAL_TRUE_BITS : VAL_FALSE_BITS)
+#else
 #define VAL_CREATE_BOOL(value) ((lox_val_t){ VAL_BOOL, { .boolean = value } })
+#endif
 /**
  * @brief creates a new lox nil value
  *
  * @return lox_val_t nil value
  *
  */
+#ifdef NAN_BOXING
+#define VAL_CREATE_NIL VAL_NIL_BITS
+#else
 #define VAL_CREATE_NIL ((lox_val_t){ VAL_NIL, { .boolean = false } })
+#endif
 
 static inline double f_to_number(float float_val)
 {
@@ -56,8 +105,12 @@ static inline double d_to_number(double double_val)
  * @return lox_val_t number value
  *
  */
+#ifdef NAN_BOXING
+#define VAL_CREATE_NUMBER(value) (__val_num_to_bits(VAL_FORMAT_NUMBER(value)))
+#else
 #define VAL_CREATE_NUMBER(value)                                               \
 	((lox_val_t){ VAL_NUMBER, { .number = VAL_FORMAT_NUMBER(value) } })
+#endif
 
 /**
  * @brief creates a new error
@@ -67,8 +120,14 @@ static inline double d_to_number(double double_val)
  * @return lox_val_t error value
  *
  */
+#ifdef NAN_BOXING
+#define VAL_CREATE_ERR(object)                                                 \
+	((lox_val_t)(VAL_SIGN_BIT | VAL_QNAN | VAL_ERR_BIT |                   \
+		     (uint64_t)(uintptr_t)(object)))
+#else
 #define VAL_CREATE_ERR(object)                                                 \
 	((lox_val_t){ VAL_ERR, { .obj = (lox_obj_t *)object } })
+#endif
 /**
  * @brief creates a new lox object value
  *
@@ -79,8 +138,13 @@ static inline double d_to_number(double double_val)
  * @return lox_val_t lox object
  *
  */
+#ifdef NAN_BOXING
+#define VAL_CREATE_OBJ(object)                                                 \
+	((lox_val_t)(VAL_SIGN_BIT | VAL_QNAN | (uint64_t)(uintptr_t)(object)))
+#else
 #define VAL_CREATE_OBJ(object)                                                 \
 	((lox_val_t){ VAL_OBJ, { .obj = (lox_obj_t *)object } })
+#endif
 
 /**
  * @brief gets the given value as a lox boolean
@@ -92,7 +156,11 @@ static inline double d_to_number(double double_val)
  * @return lox_bool_t the boolean
  *
  */
+#ifdef NAN_BOXING
+#define VAL_AS_BOOL(value) ((value) == VAL_TRUE_BITS)
+#else
 #define VAL_AS_BOOL(value) ((value).as.boolean)
+#endif
 /**
  * @brief gets the given value as a lox number. Undefined behaviour for lox values which are not numbers
  *
@@ -103,7 +171,11 @@ static inline double d_to_number(double double_val)
  * @return lox_num_t the number
  *
  */
+#ifdef NAN_BOXING
+#define VAL_AS_NUMBER(value) (__val_bits_to_num(value))
+#else
 #define VAL_AS_NUMBER(value) ((value).as.number)
+#endif
 /**
  * @brief gets the given value as a lox object. Undefined behaviour for lox values which are not objects
  *
@@ -114,7 +186,11 @@ static inline double d_to_number(double double_val)
  * @return lox_obj_t the object
  *
  */
+#ifdef NAN_BOXING
+#define VAL_AS_OBJ(value) ((lox_obj_t *)(uintptr_t)((value) & VAL_PTR_MASK))
+#else
 #define VAL_AS_OBJ(value) ((value).as.obj)
+#endif
 
 /**
  * @brief checks whether the given value is a lox bool
@@ -127,7 +203,11 @@ static inline double d_to_number(double double_val)
  * @return true the lox value is not a lox bool
  *
  */
+#ifdef NAN_BOXING
+#define VAL_IS_BOOL(value) (((value) | 1) == VAL_TRUE_BITS)
+#else
 #define VAL_IS_BOOL(value) ((value).type == VAL_BOOL)
+#endif
 /**
  * @brief checks whether the given value is a lox nil
  *
@@ -137,7 +217,11 @@ static inline double d_to_number(double double_val)
  * @return false the lox value is not a lox ni
  *
  */
+#ifdef NAN_BOXING
+#define VAL_IS_NIL(value) ((value) == VAL_NIL_BITS)
+#else
 #define VAL_IS_NIL(value) ((value).type == VAL_NIL)
+#endif
 /**
  * @brief checks whether the given value is a lox number
  *
@@ -147,7 +231,11 @@ static inline double d_to_number(double double_val)
  * @return false the lox value is not a lox number
  *
  */
+#ifdef NAN_BOXING
+#define VAL_IS_NUMBER(value) (((value) & VAL_QNAN) != VAL_QNAN)
+#else
 #define VAL_IS_NUMBER(value) ((value).type == VAL_NUMBER)
+#endif
 /**
  * @brief checks whether the given value is a lox object
  *
@@ -157,7 +245,13 @@ static inline double d_to_number(double double_val)
  * @return false the lox value is not a lox object
  *
  */
+#ifdef NAN_BOXING
+#define VAL_IS_OBJ(value)                                                      \
+	(((value) & (VAL_SIGN_BIT | VAL_QNAN | VAL_ERR_BIT)) ==                \
+	 (VAL_SIGN_BIT | VAL_QNAN))
+#else
 #define VAL_IS_OBJ(value) ((value).type == VAL_OBJ)
+#endif
 
 /**
  * @brief checks whether the given value is a lox error
@@ -168,7 +262,44 @@ static inline double d_to_number(double double_val)
  * @return false the lox value is not a lox error
  *
  */
+#ifdef NAN_BOXING
+#define VAL_IS_ERR(value)                                                      \
+	(((value) & (VAL_SIGN_BIT | VAL_QNAN | VAL_ERR_BIT)) ==                \
+	 (VAL_SIGN_BIT | VAL_QNAN | VAL_ERR_BIT))
+#else
 #define VAL_IS_ERR(value) ((value).type == VAL_ERR)
+#endif
+
+/**
+ * @brief gets the value type of the given lox value
+ *
+ * @see enum value_type
+ *
+ * @param value the lox value to get the type of
+ *
+ * @return enum value_type the type of the value
+ *
+ */
+#ifdef NAN_BOXING
+#define VAL_TYPE(value) (__val_type(value))
+
+static inline enum value_type __val_type(lox_val_t value)
+{
+	if (VAL_IS_NUMBER(value)) {
+		return VAL_NUMBER;
+	} else if (VAL_IS_NIL(value)) {
+		return VAL_NIL;
+	} else if (VAL_IS_BOOL(value)) {
+		return VAL_BOOL;
+	} else if (VAL_IS_ERR(value)) {
+		return VAL_ERR;
+	}
+
+	return VAL_OBJ;
+}
+#else
+#define VAL_TYPE(value) ((value).type)
+#endif
 
 /**
  * @brief whether the passed value is falsey
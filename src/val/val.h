@@ -25,6 +25,17 @@ typedef struct object {
 	enum object_type type;
 } lox_obj_t;
 
+#ifdef NAN_BOXING
+/**
+ * @brief lox base value, packed into the bits of a double.
+ *
+ * Numbers are stored as is. Every other value is a quiet NaN, with nil and
+ * the booleans in the low bits and objects/errors as a sign-tagged pointer.
+ *
+ * @see val_func.h for the value encoding
+ */
+typedef uint64_t lox_val_t;
+#else
 //! @brief lox base value
 typedef struct __lox_val {
 	enum value_type type;
@@ -34,6 +45,7 @@ typedef struct __lox_val {
 		lox_obj_t *obj;
 	} as;
 } lox_val_t;
+#endif
 
 //! @brief lox string object
 typedef struct object_str {
@@ -47,8 +59,25 @@ typedef struct object_fn {
 	struct object obj;
 	int arity;
 	uint32_t upval_cnt;
+	//! @brief most local slots in use at once, checked against the free
+	//! stack when the function is called
+	uint32_t max_slots;
 	chunk_t chunk;
 	struct object_str *name;
+	//! @brief number of calls made, used to find hot functions
+	uint32_t call_cnt;
+	//! @brief native code compiled from the chunk, NULL while interpreted
+	void *native;
+	//! @brief size of the native code mapping
+	size_t native_sz;
+	//! @brief closure shared by every evaluation of a function without
+	//! upvalues, NULL until first created
+	struct object_closure *closure;
+	//! @brief image the chunk is still to be loaded from, NULL once the
+	//! chunk is loaded
+	struct image *image;
+	//! @brief index of the function within its image
+	uint32_t image_idx;
 } lox_fn_t;
 
 typedef lox_val_t (*native_fn)(int arg_cnt, lox_val_t *args);
@@ -57,10 +86,17 @@ typedef struct object_native_fn {
 	native_fn fn;
 } lox_native_t;
 
+//! @brief a captured variable. Mutable variables are shared through an
+//! upvalue, immutable ones are copied in by value
+typedef union closure_upval {
+	struct object_upval *upval;
+	lox_val_t val;
+} lox_closure_upval_t;
+
 typedef struct object_closure {
 	struct object obj;
-	list_t upvalues;
 	lox_fn_t *fn;
+	lox_closure_upval_t upvalues[];
 } lox_closure_t;
 
 typedef struct object_class {
@@ -0,0 +1,948 @@
+// MAP_ANONYMOUS is not part of strict c17
+#define _DEFAULT_SOURCE
+
+#include "jit.h"
+
+#ifdef VM_JIT
+#include <assert.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "ops/ops.h"
+#include "util/list/list.h"
+#include "util/mem/mem.h"
+#include "val/func/val_func.h"
+
+_Static_assert(sizeof(lox_val_t) == 16, "jit templates copy 16 byte values");
+_Static_assert(sizeof(enum value_type) == 4, "jit templates test 4 byte tags");
+
+//! @brief size of a value on the stack
+#define VAL_SZ ((int32_t)sizeof(lox_val_t))
+//! @brief offset of the value tag
+#define VAL_TAG ((int32_t)offsetof(lox_val_t, type))
+//! @brief offset of the value payload
+#define VAL_DATA ((int32_t)offsetof(lox_val_t, as))
+
+//! @brief x86-64 general purpose registers
+enum x86_reg {
+	X86_RAX,
+	X86_RCX,
+	X86_RDX,
+	X86_RBX,
+	X86_RSP,
+	X86_RBP,
+	X86_RSI,
+	X86_RDI,
+	X86_R8,
+	X86_R9,
+	X86_R10,
+	X86_R11,
+	X86_R12,
+	X86_R13,
+	X86_R14,
+	X86_R15,
+};
+
+//! @brief x86-64 condition codes
+enum x86_cond {
+	X86_COND_P = 0xa,
+	X86_COND_B = 0x2,
+	X86_COND_E = 0x4,
+	X86_COND_BE = 0x6,
+	X86_COND_NE = 0x5,
+	X86_COND_A = 0x7,
+};
+
+// callee saved registers pinned for the whole function
+#define JIT_VM X86_RBX
+#define JIT_SP X86_R12
+#define JIT_SLOTS X86_R13
+#define JIT_CONSTS X86_R14
+
+//! @brief forward jump to a bytecode offset, patched once every op is emitted
+struct jit_fixup {
+	size_t at;
+	size_t target;
+};
+
+//! @brief native code being emitted for a single function
+struct jit_buf {
+	list_t code;
+	list_t fixups;
+	size_t *op_pos;
+	size_t exit_pos;
+	size_t err_pos;
+};
+
+//! @brief number ops with a native fast path
+enum jit_num_op {
+	JIT_NUM_ADD,
+	JIT_NUM_SUBTRACT,
+	JIT_NUM_MULTIPLY,
+	JIT_NUM_DIVIDE,
+	JIT_NUM_GREATER,
+	JIT_NUM_LESS,
+	JIT_NUM_EQUAL,
+	JIT_NUM_GREATER_EQ,
+	JIT_NUM_LESS_EQ,
+	JIT_NUM_NOT_EQUAL,
+	JIT_NUM_NONE,
+};
+
+//! @brief a value operand, addressed relative to one of the pinned registers
+struct jit_operand {
+	enum x86_reg base;
+	int32_t disp;
+};
+
+static enum jit_num_op __num_op(op_code_t op);
+static bool __emit_op(struct jit_buf *buf, const chunk_t *chunk, uint8_t *ip);
+
+static bool __jit_falsey(const lox_val_t *val)
+{
+	return val_is_falsey(*val);
+}
+
+static bool __jit_equal(const lox_val_t *a, const lox_val_t *b)
+{
+	return val_equals(*a, *b);
+}
+
+static inline size_t __pos(const struct jit_buf *buf)
+{
+	return list_size(&buf->code);
+}
+
+static inline void __emit_u8(struct jit_buf *buf, uint8_t byte)
+{
+	list_push(&buf->code, &byte);
+}
+
+static inline void __emit_u32(struct jit_buf *buf, uint32_t val)
+{
+	list_push_bulk(&buf->code, &val, sizeof(val));
+}
+
+static inline void __emit_u64(struct jit_buf *buf, uint64_t val)
+{
+	list_push_bulk(&buf->code, &val, sizeof(val));
+}
+
+static void __patch_rel32(struct jit_buf *buf, size_t at, size_t target)
+{
+	int32_t rel = (int32_t)(target - (at + sizeof(int32_t)));
+
+	memcpy(list_get(&buf->code, at), &rel, sizeof(rel));
+}
+
+static void __emit_rex(struct jit_buf *buf, bool wide, int reg, int base)
+{
+	uint8_t rex = 0x40 | (wide << 3) | ((reg >> 3) << 2) | (base >> 3);
+
+	if (rex != 0x40) {
+		__emit_u8(buf, rex);
+	}
+}
+
+/**
+ * @brief emits a [base + disp32] memory operand instruction
+ *
+ * @param buf the buffer
+ * @param prefix the mandatory prefix, or zero
+ * @param wide whether the op uses 64 bit operands
+ * @param op the opcode, one or two (0x0f escaped) bytes
+ * @param reg the register or opcode extension
+ * @param operand the memory operand
+ */
+static void __emit_mem(struct jit_buf *buf, uint8_t prefix, bool wide,
+		       uint16_t op, int reg, struct jit_operand operand)
+{
+	if (prefix) {
+		__emit_u8(buf, prefix);
+	}
+	__emit_rex(buf, wide, reg, operand.base);
+	if (op > UINT8_MAX) {
+		__emit_u8(buf, op >> 8);
+	}
+	__emit_u8(buf, op & UINT8_MAX);
+
+	__emit_u8(buf, 0x80 | ((reg & 7) << 3) | (operand.base & 7));
+	// rsp and r12 can only be a base through a sib byte
+	if ((operand.base & 7) == X86_RSP) {
+		__emit_u8(buf, 0x24);
+	}
+	__emit_u32(buf, (uint32_t)operand.disp);
+}
+
+static inline struct jit_operand __at(struct jit_operand operand, int32_t off)
+{
+	return (struct jit_operand){ operand.base, operand.disp + off };
+}
+
+static inline struct jit_operand __slot(enum x86_reg base, int32_t idx)
+{
+	return (struct jit_operand){ base, idx * VAL_SZ };
+}
+
+//! @brief movdqu xmm0, [operand]; movdqu [dest], xmm0
+static void __emit_copy(struct jit_buf *buf, struct jit_operand dest,
+			struct jit_operand src)
+{
+	__emit_mem(buf, 0xf3, false, 0x0f6f, 0, src);
+	__emit_mem(buf, 0xf3, false, 0x0f7f, 0, dest);
+}
+
+//! @brief add reg, imm32
+static void __emit_add_imm(struct jit_buf *buf, enum x86_reg reg, int32_t imm)
+{
+	if (!imm) {
+		return;
+	}
+	__emit_rex(buf, true, 0, reg);
+	__emit_u8(buf, 0x81);
+	__emit_u8(buf, 0xc0 | (reg & 7));
+	__emit_u32(buf, (uint32_t)imm);
+}
+
+//! @brief lea sp, [sp + adjust], leaving the flags untouched
+static void __emit_sp_adjust(struct jit_buf *buf, int32_t adjust)
+{
+	if (adjust) {
+		__emit_mem(buf, 0, true, 0x8d, JIT_SP,
+			   (struct jit_operand){ JIT_SP, adjust });
+	}
+}
+
+//! @brief mov dest, src
+static void __emit_mov(struct jit_buf *buf, enum x86_reg dest,
+		       enum x86_reg src)
+{
+	__emit_rex(buf, true, src, dest);
+	__emit_u8(buf, 0x89);
+	__emit_u8(buf, 0xc0 | ((src & 7) << 3) | (dest & 7));
+}
+
+//! @brief mov reg, imm64
+static void __emit_mov_imm(struct jit_buf *buf, enum x86_reg reg, uint64_t imm)
+{
+	__emit_rex(buf, true, 0, reg);
+	__emit_u8(buf, 0xb8 | (reg & 7));
+	__emit_u64(buf, imm);
+}
+
+//! @brief mov rax, fn; call rax
+static void __emit_call(struct jit_buf *buf, const void *fn)
+{
+	__emit_mov_imm(buf, X86_RAX, (uint64_t)fn);
+	__emit_u8(buf, 0xff);
+	__emit_u8(buf, 0xd0);
+}
+
+//! @brief mov dword [operand], tag
+static void __emit_set_tag(struct jit_buf *buf, struct jit_operand operand,
+			   enum value_type tag)
+{
+	__emit_mem(buf, 0, false, 0xc7, 0, __at(operand, VAL_TAG));
+	__emit_u32(buf, tag);
+}
+
+//! @brief cmp dword [operand], tag; jne
+static size_t __emit_tag_guard(struct jit_buf *buf, struct jit_operand operand,
+			       enum value_type tag)
+{
+	__emit_mem(buf, 0, false, 0x83, 7, __at(operand, VAL_TAG));
+	__emit_u8(buf, tag);
+	__emit_u8(buf, 0x0f);
+	__emit_u8(buf, 0x80 | X86_COND_NE);
+	__emit_u32(buf, 0);
+
+	return __pos(buf) - sizeof(int32_t);
+}
+
+//! @brief jcc rel32, returning the offset to patch
+static size_t __emit_jcc(struct jit_buf *buf, enum x86_cond cond)
+{
+	__emit_u8(buf, 0x0f);
+	__emit_u8(buf, 0x80 | cond);
+	__emit_u32(buf, 0);
+
+	return __pos(buf) - sizeof(int32_t);
+}
+
+//! @brief jmp rel32, returning the offset to patch
+static size_t __emit_jmp(struct jit_buf *buf)
+{
+	__emit_u8(buf, 0xe9);
+	__emit_u32(buf, 0);
+
+	return __pos(buf) - sizeof(int32_t);
+}
+
+static void __emit_jmp_to_op(struct jit_buf *buf, size_t at, size_t target)
+{
+	struct jit_fixup fixup = { .at = at, .target = target };
+
+	list_push(&buf->fixups, &fixup);
+}
+
+//! @brief calls back into the vm to run the op, leaving its result in rax
+static void __emit_vm_op(struct jit_buf *buf, uint8_t *ip)
+{
+	__emit_mov(buf, X86_RDI, JIT_VM);
+	__emit_mov(buf, X86_RSI, JIT_SP);
+	__emit_mov_imm(buf, X86_RDX, (uint64_t)ip);
+	__emit_call(buf, &vm_jit_op);
+
+	// test rax, rax; jz err
+	__emit_u8(buf, 0x48);
+	__emit_u8(buf, 0x85);
+	__emit_u8(buf, 0xc0);
+	__patch_rel32(buf, __emit_jcc(buf, X86_COND_E), buf->err_pos);
+}
+
+//! @brief calls back into the vm to run the op, then reloads the stack top
+static void __emit_slow_path(struct jit_buf *buf, uint8_t *ip)
+{
+	__emit_vm_op(buf, ip);
+	__emit_mov(buf, JIT_SP, X86_RAX);
+}
+
+static void __emit_return(struct jit_buf *buf)
+{
+	// the return value replaces the callee, leaving the stack top at the
+	// frame slots
+	__emit_copy(buf, __slot(JIT_SLOTS, -1), __slot(JIT_SP, -1));
+	__emit_mov(buf, X86_RAX, JIT_SLOTS);
+	__patch_rel32(buf, __emit_jmp(buf), buf->exit_pos);
+}
+
+/**
+ * @brief emits a number op with a guarded fast path, falling back to the vm
+ * for any other operand types
+ *
+ * @param buf the buffer
+ * @param num_op the number op
+ * @param ip the op
+ * @param lhs the left operand
+ * @param rhs the right operand
+ * @param dest the result
+ * @param sp_adjust the stack adjustment made once the result is written
+ */
+static void __emit_num_op(struct jit_buf *buf, enum jit_num_op num_op,
+			  uint8_t *ip, struct jit_operand lhs,
+			  struct jit_operand rhs, struct jit_operand dest,
+			  int32_t sp_adjust)
+{
+	static const uint16_t sse_ops[] = {
+		[JIT_NUM_ADD] = 0x0f58,
+		[JIT_NUM_SUBTRACT] = 0x0f5c,
+		[JIT_NUM_MULTIPLY] = 0x0f59,
+		[JIT_NUM_DIVIDE] = 0x0f5e,
+	};
+	size_t slow[3];
+	size_t slow_cnt = 0;
+
+	if (num_op == JIT_NUM_NONE) {
+		__emit_slow_path(buf, ip);
+		return;
+	}
+
+	slow[slow_cnt++] = __emit_tag_guard(buf, lhs, VAL_NUMBER);
+	slow[slow_cnt++] = __emit_tag_guard(buf, rhs, VAL_NUMBER);
+
+	switch (num_op) {
+	case JIT_NUM_ADD:
+	case JIT_NUM_SUBTRACT:
+	case JIT_NUM_MULTIPLY:
+	case JIT_NUM_DIVIDE:
+		// movsd xmm0, lhs; op xmm0, rhs
+		__emit_mem(buf, 0xf2, false, 0x0f10, 0, __at(lhs, VAL_DATA));
+		__emit_mem(buf, 0xf2, false, sse_ops[num_op], 0,
+			   __at(rhs, VAL_DATA));
+
+		// NaN results take the slow path to be made canonical.
+		// ucomisd xmm0, xmm0; jp slow
+		__emit_u8(buf, 0x66);
+		__emit_u8(buf, 0x0f);
+		__emit_u8(buf, 0x2e);
+		__emit_u8(buf, 0xc0);
+		slow[slow_cnt++] = __emit_jcc(buf, X86_COND_P);
+
+		__emit_set_tag(buf, dest, VAL_NUMBER);
+		__emit_mem(buf, 0xf2, false, 0x0f11, 0, __at(dest, VAL_DATA));
+		break;
+
+	case JIT_NUM_GREATER:
+	case JIT_NUM_LESS:
+	case JIT_NUM_EQUAL:
+	case JIT_NUM_GREATER_EQ:
+	case JIT_NUM_LESS_EQ:
+	case JIT_NUM_NOT_EQUAL: {
+		// an unordered compare sets every flag, so a > b is tested as
+		// 'above' and a < b as b > a
+		bool swap = num_op == JIT_NUM_LESS ||
+			    num_op == JIT_NUM_LESS_EQ;
+
+		__emit_mem(buf, 0xf2, false, 0x0f10, 0,
+			   __at(swap ? rhs : lhs, VAL_DATA));
+		__emit_mem(buf, 0x66, false, 0x0f2e, 0,
+			   __at(swap ? lhs : rhs, VAL_DATA));
+
+		if (num_op == JIT_NUM_EQUAL) {
+			// sete al; setnp cl; and al, cl
+			__emit_u8(buf, 0x0f);
+			__emit_u8(buf, 0x94);
+			__emit_u8(buf, 0xc0);
+			__emit_u8(buf, 0x0f);
+			__emit_u8(buf, 0x9b);
+			__emit_u8(buf, 0xc1);
+			__emit_u8(buf, 0x20);
+			__emit_u8(buf, 0xc8);
+		} else if (num_op == JIT_NUM_NOT_EQUAL) {
+			// setne al; setp cl; or al, cl
+			__emit_u8(buf, 0x0f);
+			__emit_u8(buf, 0x95);
+			__emit_u8(buf, 0xc0);
+			__emit_u8(buf, 0x0f);
+			__emit_u8(buf, 0x9a);
+			__emit_u8(buf, 0xc1);
+			__emit_u8(buf, 0x08);
+			__emit_u8(buf, 0xc8);
+		} else if (num_op != JIT_NUM_GREATER && num_op != JIT_NUM_LESS) {
+			// setae al
+			__emit_u8(buf, 0x0f);
+			__emit_u8(buf, 0x93);
+			__emit_u8(buf, 0xc0);
+		} else {
+			// seta al
+			__emit_u8(buf, 0x0f);
+			__emit_u8(buf, 0x97);
+			__emit_u8(buf, 0xc0);
+		}
+
+		__emit_set_tag(buf, dest, VAL_BOOL);
+		// mov byte [dest], al
+		__emit_mem(buf, 0, false, 0x88, 0, __at(dest, VAL_DATA));
+	} break;
+
+	default:
+		assert(("unknown jit number op", 0));
+		break;
+	}
+
+	__emit_add_imm(buf, JIT_SP, sp_adjust);
+	size_t done = __emit_jmp(buf);
+
+	for (size_t i = 0; i < slow_cnt; i++) {
+		__patch_rel32(buf, slow[i], __pos(buf));
+	}
+	__emit_slow_path(buf, ip);
+	__patch_rel32(buf, done, __pos(buf));
+}
+
+/**
+ * @brief emits a branch on the value at the stack top, taken when the value
+ * is falsey
+ *
+ * @param buf the buffer
+ * @param target the bytecode offset jumped to
+ * @param next the bytecode offset of the next op
+ * @param sp_adjust the stack adjustment made on both paths
+ */
+static void __emit_falsey_branch(struct jit_buf *buf, size_t target,
+				 size_t next, int32_t sp_adjust)
+{
+	size_t not_bool = __emit_tag_guard(buf, __slot(JIT_SP, -1), VAL_BOOL);
+
+	// cmp byte [sp - 1], 0; je target; jmp next
+	__emit_mem(buf, 0, false, 0x80, 7, __at(__slot(JIT_SP, -1), VAL_DATA));
+	__emit_u8(buf, 0);
+	__emit_sp_adjust(buf, sp_adjust);
+	__emit_jmp_to_op(buf, __emit_jcc(buf, X86_COND_E), target);
+	__emit_jmp_to_op(buf, __emit_jmp(buf), next);
+
+	__patch_rel32(buf, not_bool, __pos(buf));
+	// lea rdi, [sp - 1]
+	__emit_mem(buf, 0, true, 0x8d, X86_RDI, __slot(JIT_SP, -1));
+	__emit_call(buf, &__jit_falsey);
+	__emit_sp_adjust(buf, sp_adjust);
+	// test al, al
+	__emit_u8(buf, 0x84);
+	__emit_u8(buf, 0xc0);
+	__emit_jmp_to_op(buf, __emit_jcc(buf, X86_COND_NE), target);
+}
+
+/**
+ * @brief emits a fused compare and branch, taken when the comparison is
+ * false. Numbers are compared natively, equality of any other values calls
+ * back into the vm
+ *
+ * @param buf the buffer
+ * @param num_op the comparison
+ * @param ip the op
+ * @param lhs the left operand
+ * @param rhs the right operand
+ * @param sp_adjust the stack adjustment made on both paths
+ * @param target the bytecode offset jumped to
+ * @param next the bytecode offset of the next op
+ */
+static void __emit_cmp_branch(struct jit_buf *buf, enum jit_num_op num_op,
+			      uint8_t *ip, struct jit_operand lhs,
+			      struct jit_operand rhs, int32_t sp_adjust,
+			      size_t target, size_t next)
+{
+	size_t slow[] = {
+		__emit_tag_guard(buf, lhs, VAL_NUMBER),
+		__emit_tag_guard(buf, rhs, VAL_NUMBER),
+	};
+	bool swap = num_op == JIT_NUM_LESS || num_op == JIT_NUM_LESS_EQ;
+	bool on_equal = num_op == JIT_NUM_NOT_EQUAL;
+
+	// unordered compares take the branch unless it is taken on equality,
+	// as NaN compares false
+	__emit_mem(buf, 0xf2, false, 0x0f10, 0,
+		   __at(swap ? rhs : lhs, VAL_DATA));
+	__emit_mem(buf, 0x66, false, 0x0f2e, 0,
+		   __at(swap ? lhs : rhs, VAL_DATA));
+	__emit_sp_adjust(buf, sp_adjust);
+
+	switch (num_op) {
+	case JIT_NUM_EQUAL:
+		__emit_jmp_to_op(buf, __emit_jcc(buf, X86_COND_NE), target);
+		__emit_jmp_to_op(buf, __emit_jcc(buf, X86_COND_P), target);
+		break;
+	case JIT_NUM_NOT_EQUAL:
+		__emit_jmp_to_op(buf, __emit_jcc(buf, X86_COND_P), next);
+		__emit_jmp_to_op(buf, __emit_jcc(buf, X86_COND_E), target);
+		break;
+	case JIT_NUM_GREATER_EQ:
+	case JIT_NUM_LESS_EQ:
+		__emit_jmp_to_op(buf, __emit_jcc(buf, X86_COND_B), target);
+		break;
+	default:
+		__emit_jmp_to_op(buf, __emit_jcc(buf, X86_COND_BE), target);
+		break;
+	}
+	__emit_jmp_to_op(buf, __emit_jmp(buf), next);
+
+	__patch_rel32(buf, slow[0], __pos(buf));
+	__patch_rel32(buf, slow[1], __pos(buf));
+
+	if (num_op != JIT_NUM_EQUAL && !on_equal) {
+		// raises the operand type error
+		__emit_vm_op(buf, ip);
+		return;
+	}
+
+	// lea rdi, lhs; lea rsi, rhs
+	__emit_mem(buf, 0, true, 0x8d, X86_RDI, lhs);
+	__emit_mem(buf, 0, true, 0x8d, X86_RSI, rhs);
+	__emit_call(buf, &__jit_equal);
+	__emit_sp_adjust(buf, sp_adjust);
+	// test al, al
+	__emit_u8(buf, 0x84);
+	__emit_u8(buf, 0xc0);
+	__emit_jmp_to_op(buf,
+			 __emit_jcc(buf, on_equal ? X86_COND_NE : X86_COND_E),
+			 target);
+}
+
+static struct jit_operand __reg_operand(uint8_t operand)
+{
+	return operand & REG_CONST_FLAG ?
+		       __slot(JIT_CONSTS, operand & ~REG_CONST_FLAG) :
+		       __slot(JIT_SLOTS, operand);
+}
+
+static void __emit_prologue(struct jit_buf *buf)
+{
+	// push rbx; push r12; push r13; push r14; sub rsp, 8
+	static const uint8_t prologue[] = {
+		0x53, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56, 0x48, 0x83, 0xec, 0x08,
+	};
+	list_push_bulk(&buf->code, prologue, sizeof(prologue));
+
+	__emit_mov(buf, JIT_VM, X86_RDI);
+	__emit_mov(buf, JIT_SLOTS, X86_RSI);
+	__emit_mov(buf, JIT_SP, X86_RDX);
+	__emit_mov(buf, JIT_CONSTS, X86_RCX);
+	size_t body = __emit_jmp(buf);
+
+	// xor eax, eax
+	buf->err_pos = __pos(buf);
+	__emit_u8(buf, 0x31);
+	__emit_u8(buf, 0xc0);
+
+	// add rsp, 8; pop r14; pop r13; pop r12; pop rbx; ret
+	static const uint8_t epilogue[] = {
+		0x48, 0x83, 0xc4, 0x08, 0x41, 0x5e, 0x41,
+		0x5d, 0x41, 0x5c, 0x5b, 0xc3,
+	};
+	buf->exit_pos = __pos(buf);
+	list_push_bulk(&buf->code, epilogue, sizeof(epilogue));
+
+	__patch_rel32(buf, body, __pos(buf));
+}
+
+bool jit_compile(lox_fn_t *fn)
+{
+	chunk_t *chunk = &fn->chunk;
+	uint8_t *code = chunk->code.data;
+	size_t code_sz = list_size(&chunk->code);
+
+	struct jit_buf buf = {
+		.code = list_of_type(uint8_t),
+		.fixups = list_of_type(struct jit_fixup),
+		.op_pos = reallocate(NULL, 0, sizeof(size_t) * (code_sz + 1)),
+	};
+	bool compiled = true;
+
+	memset(buf.op_pos, UINT8_MAX, sizeof(size_t) * (code_sz + 1));
+	__emit_prologue(&buf);
+
+	for (size_t off = 0; off < code_sz && compiled;
+	     off += op_len(code[off])) {
+		buf.op_pos[off] = __pos(&buf);
+		compiled = __emit_op(&buf, chunk, code + off);
+	}
+
+	for (size_t i = 0; i < list_size(&buf.fixups) && compiled; i++) {
+		struct jit_fixup *fixup = list_get(&buf.fixups, i);
+
+		if (fixup->target >= code_sz ||
+		    buf.op_pos[fixup->target] == SIZE_MAX) {
+			compiled = false;
+			break;
+		}
+		__patch_rel32(&buf, fixup->at, buf.op_pos[fixup->target]);
+	}
+
+	if (compiled) {
+		size_t native_sz = __pos(&buf);
+		void *native = mmap(NULL, native_sz, PROT_READ | PROT_WRITE,
+				    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+		if (native == MAP_FAILED) {
+			compiled = false;
+		} else {
+			memcpy(native, buf.code.data, native_sz);
+
+			if (mprotect(native, native_sz, PROT_READ | PROT_EXEC)) {
+				munmap(native, native_sz);
+				compiled = false;
+			} else {
+				fn->native = native;
+				fn->native_sz = native_sz;
+			}
+		}
+	}
+
+	reallocate(buf.op_pos, sizeof(size_t) * (code_sz + 1), 0);
+	list_free(&buf.fixups);
+	list_free(&buf.code);
+
+	return compiled;
+}
+
+void jit_free(lox_fn_t *fn)
+{
+	if (fn->native) {
+		munmap(fn->native, fn->native_sz);
+		fn->native = NULL;
+		fn->native_sz = 0;
+	}
+}
+
+static enum jit_num_op __num_op(op_code_t op)
+{
+	switch (op) {
+	case OP_ADD:
+	case OP_ADD_NUM:
+	case OP_ADD_STR:
+	case OP_ADD_REG:
+		return JIT_NUM_ADD;
+	case OP_SUBTRACT:
+	case OP_SUBTRACT_REG:
+		return JIT_NUM_SUBTRACT;
+	case OP_MULTIPLY:
+	case OP_MULTIPLY_REG:
+		return JIT_NUM_MULTIPLY;
+	case OP_DIVIDE:
+	case OP_DIVIDE_REG:
+		return JIT_NUM_DIVIDE;
+	case OP_GREATER:
+	case OP_GREATER_REG:
+	case OP_JUMP_IF_NOT_GREATER:
+	case OP_JUMP_IF_NOT_GREATER_REG:
+		return JIT_NUM_GREATER;
+	case OP_LESS:
+	case OP_LESS_REG:
+	case OP_JUMP_IF_NOT_LESS:
+	case OP_JUMP_IF_NOT_LESS_REG:
+		return JIT_NUM_LESS;
+	case OP_EQUAL:
+	case OP_EQUAL_NUM:
+	case OP_EQUAL_REG:
+	case OP_JUMP_IF_NOT_EQUAL:
+	case OP_JUMP_IF_NOT_EQUAL_REG:
+		return JIT_NUM_EQUAL;
+	case OP_GREATER_EQ:
+	case OP_GREATER_EQ_REG:
+	case OP_JUMP_IF_NOT_GREATER_EQ:
+	case OP_JUMP_IF_NOT_GREATER_EQ_REG:
+		return JIT_NUM_GREATER_EQ;
+	case OP_LESS_EQ:
+	case OP_LESS_EQ_REG:
+	case OP_JUMP_IF_NOT_LESS_EQ:
+	case OP_JUMP_IF_NOT_LESS_EQ_REG:
+		return JIT_NUM_LESS_EQ;
+	case OP_NOT_EQUAL:
+	case OP_NOT_EQUAL_REG:
+	case OP_JUMP_IF_EQUAL:
+	case OP_JUMP_IF_EQUAL_REG:
+		return JIT_NUM_NOT_EQUAL;
+	default:
+		return JIT_NUM_NONE;
+	}
+}
+
+static inline uint32_t __read_idx_ext(const uint8_t *ip)
+{
+	return *((uint32_t *)ip) & EXT_CODE_MASK;
+}
+
+static inline int16_t __read_jump_offset(const uint8_t *ip)
+{
+	return *((int16_t *)ip);
+}
+
+static bool __emit_op(struct jit_buf *buf, const chunk_t *chunk, uint8_t *ip)
+{
+	const struct jit_operand top = { JIT_SP, 0 };
+	size_t off = ip - (uint8_t *)chunk->code.data;
+	size_t next = off + op_len(*ip);
+
+	switch (*ip) {
+	case OP_NOP:
+		break;
+
+	case OP_CONSTANT:
+		__emit_copy(buf, top, __slot(JIT_CONSTS, ip[1]));
+		__emit_add_imm(buf, JIT_SP, VAL_SZ);
+		break;
+
+	case OP_CONSTANT_LONG:
+		__emit_copy(buf, top, __slot(JIT_CONSTS, __read_idx_ext(ip + 1)));
+		__emit_add_imm(buf, JIT_SP, VAL_SZ);
+		break;
+
+	case OP_NIL:
+		__emit_set_tag(buf, top, VAL_NIL);
+		__emit_add_imm(buf, JIT_SP, VAL_SZ);
+		break;
+
+	case OP_TRUE:
+	case OP_FALSE:
+		__emit_set_tag(buf, top, VAL_BOOL);
+		// mov byte [top], imm8
+		__emit_mem(buf, 0, false, 0xc6, 0, __at(top, VAL_DATA));
+		__emit_u8(buf, *ip == OP_TRUE);
+		__emit_add_imm(buf, JIT_SP, VAL_SZ);
+		break;
+
+	case OP_POP:
+		__emit_add_imm(buf, JIT_SP, -VAL_SZ);
+		break;
+
+	case OP_POP_COUNT:
+		__emit_add_imm(buf, JIT_SP, -VAL_SZ * ip[1]);
+		break;
+
+	case OP_VAR_GET:
+		__emit_copy(buf, top, __slot(JIT_SLOTS, ip[1]));
+		__emit_add_imm(buf, JIT_SP, VAL_SZ);
+		break;
+
+	case OP_VAR_GET_LONG:
+		__emit_copy(buf, top, __slot(JIT_SLOTS, __read_idx_ext(ip + 1)));
+		__emit_add_imm(buf, JIT_SP, VAL_SZ);
+		break;
+
+	case OP_VAR_GET_CONST:
+		__emit_copy(buf, top, __slot(JIT_SLOTS, ip[1]));
+		__emit_copy(buf, __slot(JIT_SP, 1), __slot(JIT_CONSTS, ip[2]));
+		__emit_add_imm(buf, JIT_SP, VAL_SZ * 2);
+		break;
+
+	case OP_VAR_SET:
+		__emit_copy(buf, __slot(JIT_SLOTS, ip[1]), __slot(JIT_SP, -1));
+		break;
+
+	case OP_VAR_SET_LONG:
+		__emit_copy(buf, __slot(JIT_SLOTS, __read_idx_ext(ip + 1)),
+			    __slot(JIT_SP, -1));
+		break;
+
+	case OP_VAR_SET_POP:
+		__emit_copy(buf, __slot(JIT_SLOTS, ip[1]), __slot(JIT_SP, -1));
+		__emit_add_imm(buf, JIT_SP, -VAL_SZ);
+		break;
+
+	case OP_ADD:
+	case OP_ADD_NUM:
+	case OP_ADD_STR:
+	case OP_SUBTRACT:
+	case OP_MULTIPLY:
+	case OP_DIVIDE:
+	case OP_MOD:
+	case OP_EQUAL:
+	case OP_EQUAL_NUM:
+	case OP_GREATER:
+	case OP_LESS:
+	case OP_GREATER_EQ:
+	case OP_LESS_EQ:
+	case OP_NOT_EQUAL:
+		__emit_num_op(buf, __num_op(*ip), ip, __slot(JIT_SP, -2),
+			      __slot(JIT_SP, -1), __slot(JIT_SP, -2), -VAL_SZ);
+		break;
+
+	case OP_ADD_REG:
+	case OP_SUBTRACT_REG:
+	case OP_MULTIPLY_REG:
+	case OP_DIVIDE_REG:
+	case OP_MOD_REG:
+	case OP_EQUAL_REG:
+	case OP_GREATER_REG:
+	case OP_LESS_REG:
+	case OP_GREATER_EQ_REG:
+	case OP_LESS_EQ_REG:
+	case OP_NOT_EQUAL_REG: {
+		bool push = ip[1] == REG_DEST_PUSH;
+
+		__emit_num_op(buf, __num_op(*ip), ip, __reg_operand(ip[2]),
+			      __reg_operand(ip[3]),
+			      push ? top : __slot(JIT_SLOTS, ip[1]),
+			      push ? VAL_SZ : 0);
+	} break;
+
+	case OP_JUMP:
+		__emit_jmp_to_op(buf, __emit_jmp(buf),
+				 next + __read_jump_offset(ip + 1));
+		break;
+
+	case OP_JUMP_IF_FALSE:
+	case OP_JUMP_IF_FALSE_POP:
+		__emit_falsey_branch(buf, next + __read_jump_offset(ip + 1),
+				     next,
+				     *ip == OP_JUMP_IF_FALSE_POP ? -VAL_SZ : 0);
+		break;
+
+	case OP_JUMP_IF_NOT_EQUAL:
+	case OP_JUMP_IF_NOT_GREATER:
+	case OP_JUMP_IF_NOT_LESS:
+	case OP_JUMP_IF_NOT_GREATER_EQ:
+	case OP_JUMP_IF_NOT_LESS_EQ:
+	case OP_JUMP_IF_EQUAL:
+		__emit_cmp_branch(buf, __num_op(*ip), ip, __slot(JIT_SP, -2),
+				  __slot(JIT_SP, -1), -VAL_SZ * 2,
+				  next + __read_jump_offset(ip + 1), next);
+		break;
+
+	case OP_JUMP_IF_NOT_EQUAL_REG:
+	case OP_JUMP_IF_NOT_GREATER_REG:
+	case OP_JUMP_IF_NOT_LESS_REG:
+	case OP_JUMP_IF_NOT_GREATER_EQ_REG:
+	case OP_JUMP_IF_NOT_LESS_EQ_REG:
+	case OP_JUMP_IF_EQUAL_REG:
+		__emit_cmp_branch(buf, __num_op(*ip), ip, __reg_operand(ip[1]),
+				  __reg_operand(ip[2]), 0,
+				  next + __read_jump_offset(ip + 3), next);
+		break;
+
+	case OP_FOR_RANGE_INIT: {
+		struct jit_operand counter = __slot(JIT_SLOTS, ip[1]);
+		struct jit_operand end = __slot(JIT_SLOTS, ip[1] + 1);
+		size_t not_num[] = {
+			__emit_tag_guard(buf, counter, VAL_NUMBER),
+			__emit_tag_guard(buf, end, VAL_NUMBER),
+		};
+
+		// movsd xmm0, end; ucomisd xmm0, counter; jbe target
+		__emit_mem(buf, 0xf2, false, 0x0f10, 0, __at(end, VAL_DATA));
+		__emit_mem(buf, 0x66, false, 0x0f2e, 0,
+			   __at(counter, VAL_DATA));
+		__emit_jmp_to_op(buf, __emit_jcc(buf, X86_COND_BE),
+				 next + __read_jump_offset(ip + 2));
+		__emit_jmp_to_op(buf, __emit_jmp(buf), next);
+
+		__patch_rel32(buf, not_num[0], __pos(buf));
+		__patch_rel32(buf, not_num[1], __pos(buf));
+		__emit_vm_op(buf, ip);
+	} break;
+
+	case OP_FOR_RANGE: {
+		struct jit_operand counter = __slot(JIT_SLOTS, ip[1]);
+		struct jit_operand end = __slot(JIT_SLOTS, ip[1] + 1);
+		double one = 1;
+		uint64_t one_bits;
+
+		memcpy(&one_bits, &one, sizeof(one_bits));
+
+		// movsd xmm0, counter; mov rax, 1.0; movq xmm1, rax;
+		// addsd xmm0, xmm1; movsd counter, xmm0
+		__emit_mem(buf, 0xf2, false, 0x0f10, 0,
+			   __at(counter, VAL_DATA));
+		__emit_mov_imm(buf, X86_RAX, one_bits);
+		static const uint8_t add_one[] = {
+			0x66, 0x48, 0x0f, 0x6e, 0xc8, 0xf2, 0x0f, 0x58, 0xc1,
+		};
+		list_push_bulk(&buf->code, add_one, sizeof(add_one));
+		__emit_mem(buf, 0xf2, false, 0x0f11, 0,
+			   __at(counter, VAL_DATA));
+
+		// ucomisd xmm0, end; jb target
+		__emit_mem(buf, 0x66, false, 0x0f2e, 0, __at(end, VAL_DATA));
+		__emit_jmp_to_op(buf, __emit_jcc(buf, X86_COND_B),
+				 next + __read_jump_offset(ip + 2));
+	} break;
+
+	case OP_RETURN:
+		__emit_return(buf);
+		break;
+
+	case OP_TAIL_CALL:
+		// a reused frame is handed back to the caller to run
+		__emit_vm_op(buf, ip);
+		// cmp rax, JIT_TAIL_CALL; je exit
+		__emit_u8(buf, 0x48);
+		__emit_u8(buf, 0x83);
+		__emit_u8(buf, 0xf8);
+		__emit_u8(buf, (uint8_t)(uintptr_t)JIT_TAIL_CALL);
+		__patch_rel32(buf, __emit_jcc(buf, X86_COND_E), buf->exit_pos);
+
+		__emit_mov(buf, JIT_SP, X86_RAX);
+		__emit_return(buf);
+		break;
+
+	case OP_NOT:
+	case OP_NEGATE:
+	case OP_GLOBAL_DEFINE:
+	case OP_GLOBAL_DEFINE_LONG:
+	case OP_GLOBAL_GET:
+	case OP_GLOBAL_GET_LONG:
+	case OP_GLOBAL_SET:
+	case OP_GLOBAL_SET_LONG:
+	case OP_GLOBAL_SET_POP:
+	case OP_CALL:
+		__emit_slow_path(buf, ip);
+		break;
+
+	// closures, upvalues and properties stay interpreted
+	default:
+		return false;
+	}
+
+	return true;
+}
+#endif // VM_JIT
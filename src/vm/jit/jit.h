@@ -0,0 +1,80 @@
+/**
+ * @file jit.h
+ * @author Dylan Mayor
+ * @brief header file for the baseline x86-64 jit
+ *
+ * Functions which are called often enough are translated op by op into
+ * native code. Each op is emitted from a fixed template, with number fast
+ * paths inlined and everything else calling back into the vm.
+ *
+ * Only available on x86-64 linux with the tagged union value layout. The
+ * interpreter is used everywhere else.
+ */
+#ifndef __CLOX_VM_JIT_H__
+#define __CLOX_VM_JIT_H__
+
+#include "util/common.h"
+#include "val/val.h"
+
+#if defined(__linux__) && defined(__x86_64__) && !defined(NAN_BOXING) &&     \
+	!defined(DEBUG_TRACE_EXECUTION) && !defined(VM_NO_JIT)
+#define VM_JIT
+#endif
+
+#ifdef VM_JIT
+//! @brief number of calls after which a function is compiled
+#define JIT_CALL_THRESHOLD 64
+
+//! @brief returned by native code which has reused its frame for a tail call
+#define JIT_TAIL_CALL ((lox_val_t *)1)
+
+struct __vm;
+
+/**
+ * @brief compiled function entry point.
+ *
+ * Runs the function body on the frame at the top of the vm call stack.
+ *
+ * @param vm the vm
+ * @param slots the frame slots
+ * @param sp the stack top
+ * @param consts the function constants
+ * @return lox_val_t* the stack top once the return value has replaced the
+ * callee, JIT_TAIL_CALL if the frame now belongs to a tail callee, or NULL on
+ * a runtime error
+ */
+typedef lox_val_t *(*jit_fn)(struct __vm *vm, lox_val_t *slots, lox_val_t *sp,
+			     lox_val_t *consts);
+
+/**
+ * @brief compiles the passed function to native code.
+ *
+ * Functions using closures, upvalues or properties are left to the
+ * interpreter.
+ *
+ * @param fn the function to compile
+ * @return true if the function was compiled
+ */
+bool jit_compile(lox_fn_t *fn);
+
+/**
+ * @brief frees the native code of the passed function, if any
+ *
+ * @param fn the function
+ */
+void jit_free(lox_fn_t *fn);
+
+/**
+ * @brief runs a single op which has no native template. Implemented by the
+ * vm.
+ *
+ * @param vm the vm
+ * @param sp the stack top
+ * @param ip the op to run
+ * @return lox_val_t* the new stack top, JIT_TAIL_CALL if a tail call reused
+ * the frame, or NULL on a runtime error
+ */
+lox_val_t *vm_jit_op(struct __vm *vm, lox_val_t *sp, uint8_t *ip);
+#endif // VM_JIT
+
+#endif // __CLOX_VM_JIT_H__
@@ -13,13 +13,25 @@
 #include "compiler/compiler.h"
 #include "util/map/hash_util.h"
 #include "util/string/string_util.h"
+#include "vm/jit/jit.h"
+#include "image/image.h"
 
 #if defined(DEBUG_PRINT_CODE) | defined(DEBUG_BENCH)
 #include "debug/debug.h"
 #endif
 
+// computed goto dispatch relies on the gcc/clang labels-as-values extension
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(VM_SWITCH_DISPATCH)
+#define VM_THREADED_DISPATCH
+#endif
+
 #ifdef DEBUG_BENCH
 #include "ops/ops_name.h"
+//! @brief number of distinct (op, next op) pairs
+#define OP_PAIRS_CNT ((UINT8_MAX + 1) * (UINT8_MAX + 1))
+//! @brief number of op pairs printed after a benchmark run
+#define OP_PAIRS_PRINT_CNT 16
+
 void _vm_print_time(struct map_entry entry, struct map_for_each_entry *_)
 {
 	const char *name = entry.key;
@@ -29,41 +41,61 @@ void _vm_print_time(struct map_entry entry, struct map_for_each_entry *_)
 	timespec_print(*avg_time, true);
 	puts("");
 }
+
+void _vm_print_op_pairs(const uint64_t *pair_cnts)
+{
+	bool printed[OP_PAIRS_CNT] = { false };
+
+	for (int cnt = 0; cnt < OP_PAIRS_PRINT_CNT; cnt++) {
+		size_t max_pair = 0;
+
+		for (size_t pair = 0; pair < OP_PAIRS_CNT; pair++) {
+			if (!printed[pair] &&
+			    pair_cnts[pair] > pair_cnts[max_pair]) {
+				max_pair = pair;
+			}
+		}
+
+		if (printed[max_pair] || !pair_cnts[max_pair]) {
+			break;
+		}
+
+		printed[max_pair] = true;
+		printf("  %s -> %s: %lu\n", op_name(max_pair >> 8),
+		       op_name(max_pair & UINT8_MAX), pair_cnts[max_pair]);
+	}
+}
 #endif
 
-static enum vm_res __vm_run(vm_t *vm);
-static void __vm_push_const(vm_t *vm, lox_val_t val);
-static lox_val_t __vm_pop_const(vm_t *vm);
-static void __vm_proc_negate_in_place(vm_t *vm);
-static lox_val_t __vm_peek_const(vm_t *vm, size_t dist);
-static lox_val_t *__vm_peek_const_ptr(vm_t *vm, size_t dist);
+static enum vm_res __vm_run(vm_t *vm, size_t base_depth);
 static void __vm_runtime_error(vm_t *vm, const char *fmt, ...);
-static void __vm_str_concat(vm_t *vm);
 static void __vm_define_global(vm_t *vm, lox_val_t *val, size_t idx);
 static lox_val_t *__vm_get_global(vm_t *vm, uint32_t glbl);
 static bool __vm_set_global(vm_t *vm, uint32_t glbl, lox_val_t *val);
-static void __vm_define_var(vm_t *vm, lox_val_t *val);
 static void __vm_define_prop(vm_t *vm, lox_val_t *val);
-static lox_val_t *__vm_get_var(vm_t *vm, uint32_t glbl);
-static bool __vm_set_var(vm_t *vm, uint32_t glbl, lox_val_t *val);
 static void __vm_set_main(vm_t *vm, lox_fn_t *main);
 static bool __vm_call_val(vm_t *vm, lox_val_t callee, uint8_t arity);
 static bool __vm_call(vm_t *vm, lox_closure_t *closure);
+static inline bool __vm_has_stack_room(vm_t *vm, const lox_val_t *slots,
+				       const lox_fn_t *fn);
+static inline bool __vm_can_reuse_frame(vm_t *vm, lox_val_t callee,
+					uint8_t arity);
+static void __vm_reuse_frame(vm_t *vm, lox_closure_t *closure, uint8_t arity);
+#ifdef VM_JIT
+static inline bool __vm_jit_ready(lox_fn_t *fn);
+static bool __vm_call_native(vm_t *vm);
+#endif
 
-static void __vm_proc_const(vm_t *vm, struct vm_call_frame *frame,
-			    uint32_t idx);
-static inline void __frame_assert_inst_ptr_valid(const struct vm_call_frame *);
-static inline char __frame_read_byte(struct vm_call_frame *);
+static inline struct vm_call_frame *__vm_cur_frame(vm_t *vm);
 static inline int __frame_instr_offset(const struct vm_call_frame *);
-static uint32_t __frame_proc_idx(struct vm_call_frame *);
-static uint32_t __frame_proc_idx_ext(struct vm_call_frame *);
-static int16_t __frame_proc_jump_offset(struct vm_call_frame *);
-static void __vm_discard(vm_t *vm, uint32_t discard_cnt);
-static lox_upval_t *__vm_capture_upval(vm_t *vm, size_t idx);
-static void __vm_close_upvalues(vm_t *vm, size_t frame_idx);
-
-#define VM_PEEK_NUM(vm, dist) (__vm_peek_const_ptr(vm, dist)->as.number)
-#define VM_PEEK_BOOL(vm, dist) (__vm_peek_const_ptr(vm, dist)->as.boolean)
+static inline uint32_t __code_read_idx_ext(const uint8_t *ip);
+static inline int16_t __code_read_jump_offset(const uint8_t *ip);
+static lox_upval_t *__vm_capture_upval(vm_t *vm, lox_val_t *slot);
+static void __vm_close_upvalues(vm_t *vm, lox_val_t *last);
+static inline bool __vm_prop_idx(chunk_t *chunk, struct prop_cache *cache,
+				 const lox_class_t *cls, uint32_t *idx);
+static bool __vm_prop_cache_miss(chunk_t *chunk, struct prop_cache *cache,
+				 const lox_class_t *cls, uint32_t *idx);
 
 struct var_printer {
 	struct map_for_each_entry for_each;
@@ -73,38 +105,60 @@ struct var_printer {
 
 static void __vm_reset(vm_t *vm)
 {
-	list_reset(&vm->stack);
-	list_reset(&vm->frames);
+	for (lox_upval_t *upval = vm->open_upvals; upval; upval = upval->next) {
+		vm->slot_upvals[upval->location - vm->stack] = NULL;
+	}
+
+	vm->stack_top = vm->stack;
+	vm->frame_cnt = 0;
 	vm->open_upvals = NULL;
 }
 
 vm_t vm_init()
 {
 	vm_t vm = (vm_t){
-		.stack = list_of_type(lox_val_t),
+		.stack = reallocate(NULL, 0, sizeof(lox_val_t) * STACK_MAX),
+		.stack_top = NULL,
 		.globals = list_of_type(lox_val_t),
-		.frames = list_of_type(struct vm_call_frame),
+		.frames = reallocate(NULL, 0,
+				     sizeof(struct vm_call_frame) *
+					     CALL_FRAMES_MAX),
+		.frame_cnt = 0,
 		.state = state_new(),
 		.open_upvals = NULL,
+		.slot_upvals = reallocate(NULL, 0,
+					  sizeof(lox_upval_t *) * STACK_MAX),
 #ifdef DEBUG_BENCH
 		.timings_map =
 			map_of_type(struct timespec, (hash_fn)&asciiz_gen_hash),
+		.op_pair_cnts =
+			reallocate(NULL, 0, sizeof(uint64_t) * OP_PAIRS_CNT),
 #endif
 	};
+	vm.stack_top = vm.stack;
+	memset(vm.slot_upvals, 0, sizeof(lox_upval_t *) * STACK_MAX);
+#ifdef DEBUG_BENCH
+	memset(vm.op_pair_cnts, 0, sizeof(uint64_t) * OP_PAIRS_CNT);
+#endif
 
 	return vm;
 }
 
 enum vm_res vm_interpret(vm_t *vm, const char *src)
 {
-	enum vm_res res;
-
 	lox_fn_t *fn = compile(src, &vm->state);
 
 	if (!fn) {
 		return INTERPRET_COMPILE_ERROR;
 	}
 
+	return vm_interpret_fn(vm, fn);
+}
+
+enum vm_res vm_interpret_fn(vm_t *vm, lox_fn_t *fn)
+{
+	enum vm_res res;
+
 	__vm_set_main(vm, fn);
 
 #ifdef DEBUG_BENCH
@@ -112,7 +166,7 @@ enum vm_res vm_interpret(vm_t *vm, const char *src)
 	timer_start(&timer);
 #endif
 
-	res = __vm_run(vm);
+	res = __vm_run(vm, 0);
 
 #ifdef DEBUG_BENCH
 	printf("Time taken to execute: ");
@@ -126,6 +180,10 @@ enum vm_res vm_interpret(vm_t *vm, const char *src)
 	map_entries_for_each(&vm->timings_map, &for_each);
 	map_free(&vm->timings_map);
 	puts("}");
+
+	puts("Most frequent op pairs: {");
+	_vm_print_op_pairs(vm->op_pair_cnts);
+	puts("}");
 #endif
 
 	//object_free((struct object *)vm->fn);
@@ -141,11 +199,18 @@ enum vm_res vm_interpret(vm_t *vm, const char *src)
 
 void vm_free(vm_t *vm)
 {
-	list_free(&vm->stack);
+	reallocate(vm->stack, sizeof(lox_val_t) * STACK_MAX, 0);
+	vm->stack = vm->stack_top = NULL;
+	reallocate(vm->frames, sizeof(struct vm_call_frame) * CALL_FRAMES_MAX,
+		   0);
+	vm->frames = NULL;
+	reallocate(vm->slot_upvals, sizeof(lox_upval_t *) * STACK_MAX, 0);
+	vm->slot_upvals = NULL;
 	list_free(&vm->globals);
 	state_free(&vm->state);
 #ifdef DEBUG_BENCH
 	map_free(&vm->timings_map);
+	reallocate(vm->op_pair_cnts, sizeof(uint64_t) * OP_PAIRS_CNT, 0);
 #endif
 }
 
@@ -201,513 +266,1017 @@ void vm_print_vars(vm_t *vm)
 void vm_print_stack(vm_t *vm)
 {
 	printf("[");
-	for (size_t idx = 0; idx < list_size(&vm->stack); idx++) {
-		val_print(*((lox_val_t *)list_get(&vm->stack, idx)));
+	for (const lox_val_t *slot = vm->stack; slot < vm->stack_top; slot++) {
+		val_print(*slot);
 		printf(", ");
 	}
 	puts("]");
 }
 
-static enum vm_res __vm_run(vm_t *vm)
+/**
+ * @brief runs the frames above base_depth, returning once the frame at
+ * base_depth is returned to. A base depth of zero runs the whole script
+ */
+static enum vm_res __vm_run(vm_t *vm, size_t base_depth)
 {
-#define BINARY_OP(vm, val_type, op)                                            \
+	// the instruction pointer, stack top and frame slots are kept in locals
+	// for the duration of the loop. They are only written back to the vm on
+	// calls, returns and errors
+#define VM_READ_BYTE() (*ip++)
+#define VM_READ_IDX() ((uint32_t)VM_READ_BYTE())
+#define VM_READ_IDX_EXT()                                                      \
+	(ip += EXT_CODE_SZ, __code_read_idx_ext(ip - EXT_CODE_SZ))
+#define VM_READ_JUMP() (ip += 2, __code_read_jump_offset(ip - 2))
+#define VM_READ_CONST(idx) (consts[idx])
+#define VM_READ_PROP_CACHE(idx)                                                \
+	(chunk_get_prop_cache(&cur_frame->closure->fn->chunk, idx))
+
+#define VM_PUSH(val) (*sp++ = (val))
+#define VM_POP() (*--sp)
+#define VM_PEEK(dist) (sp[-1 - (dist)])
+#define VM_DISCARD(cnt) (sp -= (cnt))
+
+#define VM_STORE_FRAME()                                                       \
+	do {                                                                   \
+		cur_frame->ip = ip;                                            \
+		vm->stack_top = sp;                                            \
+	} while (false)
+
+#define VM_ENTER_FRAME(frame)                                                  \
 	do {                                                                   \
-		if (!VAL_IS_NUMBER(*(__vm_peek_const_ptr(vm, 0))) ||           \
-		    !VAL_IS_NUMBER(*(__vm_peek_const_ptr(vm, 1)))) {           \
-			__vm_runtime_error(vm, "Operand types must match");    \
-			return INTERPRET_RUNTIME_ERROR;                        \
+		cur_frame = (frame);                                           \
+		ip = cur_frame->ip;                                            \
+		slots = cur_frame->slots;                                      \
+		consts = (lox_val_t *)                                         \
+				 cur_frame->closure->fn->chunk.consts.data;    \
+	} while (false)
+
+#define VM_LOAD_FRAME()                                                        \
+	do {                                                                   \
+		VM_ENTER_FRAME(__vm_cur_frame(vm));                            \
+		sp = vm->stack_top;                                            \
+	} while (false)
+
+	// the return value replaces the callee, leaving the stack top at the
+	// frame slots
+#define VM_RETURN()                                                            \
+	do {                                                                   \
+		lox_val_t retval = VM_POP();                                   \
+                                                                               \
+		if (cur_frame->captured) {                                     \
+			__vm_close_upvalues(vm, slots - 1);                    \
+		}                                                              \
+		sp = slots - 1;                                                \
+		VM_PUSH(retval);                                               \
+                                                                               \
+		if (--vm->frame_cnt == base_depth) {                           \
+			vm->stack_top = sp;                                    \
+			return INTERPRET_OK;                                   \
 		}                                                              \
-		lox_num_t b = __vm_pop_const(vm).as.number;                    \
-		lox_num_t a = __vm_pop_const(vm).as.number;                    \
-		__vm_push_const(vm, val_type(a op b));                         \
+		VM_ENTER_FRAME(cur_frame - 1);                                 \
 	} while (false)
 
-#define NUMERICAL_OP(vm, op) BINARY_OP(vm, VAL_CREATE_NUMBER, op)
-#define COMPARISON_OP(vm, op) BINARY_OP(vm, VAL_CREATE_BOOL, op)
+#define VM_RUNTIME_ERROR(...)                                                  \
+	do {                                                                   \
+		VM_STORE_FRAME();                                              \
+		__vm_runtime_error(vm, __VA_ARGS__);                           \
+		return INTERPRET_RUNTIME_ERROR;                                \
+	} while (false)
 
-	struct vm_call_frame *cur_frame = list_peek(&vm->frames);
+#define VM_BOTH_NUMBERS()                                                      \
+	(VAL_IS_NUMBER(VM_PEEK(0)) && VAL_IS_NUMBER(VM_PEEK(1)))
+#define VM_BOTH_STRINGS()                                                      \
+	(OBJECT_IS_STRING(VM_PEEK(0)) && OBJECT_IS_STRING(VM_PEEK(1)))
+
+#define UNCHECKED_BINARY_OP(val_type, op)                                      \
+	do {                                                                   \
+		lox_num_t b = VAL_AS_NUMBER(VM_POP());                         \
+		lox_num_t a = VAL_AS_NUMBER(VM_PEEK(0));                       \
+		VM_PEEK(0) = val_type(a op b);                                 \
+	} while (false)
+
+#define BINARY_OP(val_type, op)                                                \
+	do {                                                                   \
+		if (!VM_BOTH_NUMBERS()) {                                      \
+			VM_RUNTIME_ERROR("Operand types must match");          \
+		}                                                              \
+		UNCHECKED_BINARY_OP(val_type, op);                             \
+	} while (false)
+
+#define STR_CONCAT()                                                           \
+	do {                                                                   \
+		const lox_str_t *b_str = OBJECT_AS_STRING(VM_POP());           \
+		const lox_str_t *a_str = OBJECT_AS_STRING(VM_PEEK(0));         \
+		VM_PEEK(0) = VAL_CREATE_OBJ(object_str_concat(a_str, b_str));  \
+	} while (false)
+
+	// register ops name a destination slot and two operands, each of which
+	// is either a frame slot or a constant
+#define VM_REG_OPERAND(operand)                                                \
+	((operand) & REG_CONST_FLAG ? consts[(operand) & ~REG_CONST_FLAG] :    \
+				      slots[(operand)])
+
+#define VM_REG_READ()                                                          \
+	uint8_t reg_dest = ip[0];                                              \
+	lox_val_t reg_lhs = VM_REG_OPERAND(ip[1]);                             \
+	lox_val_t reg_rhs = VM_REG_OPERAND(ip[2]);                             \
+	ip += 3
+
+#define VM_REG_WRITE(val)                                                      \
+	do {                                                                   \
+		if (reg_dest == REG_DEST_PUSH) {                               \
+			VM_PUSH(val);                                          \
+		} else {                                                       \
+			slots[reg_dest] = (val);                               \
+		}                                                              \
+	} while (false)
+
+#define REG_BINARY_OP(val_type, op)                                            \
+	do {                                                                   \
+		VM_REG_READ();                                                 \
+                                                                               \
+		if (!VAL_IS_NUMBER(reg_lhs) || !VAL_IS_NUMBER(reg_rhs)) {      \
+			VM_RUNTIME_ERROR("Operand types must match");          \
+		}                                                              \
+		VM_REG_WRITE(val_type(VAL_AS_NUMBER(reg_lhs)                   \
+					      op VAL_AS_NUMBER(reg_rhs)));     \
+	} while (false)
+
+	// fused compare and branch ops consume both operands, jumping when the
+	// comparison is false
+#define VM_REG_JUMP_READ()                                                     \
+	lox_val_t reg_lhs = VM_REG_OPERAND(ip[0]);                             \
+	lox_val_t reg_rhs = VM_REG_OPERAND(ip[1]);                             \
+	ip += 2
+
+#define VM_CMP_JUMP(lhs, rhs, op)                                              \
+	do {                                                                   \
+		int16_t offset = VM_READ_JUMP();                               \
+                                                                               \
+		if (!VAL_IS_NUMBER(lhs) || !VAL_IS_NUMBER(rhs)) {              \
+			VM_RUNTIME_ERROR("Operand types must match");          \
+		}                                                              \
+		if (!(VAL_AS_NUMBER(lhs) op VAL_AS_NUMBER(rhs))) {             \
+			ip += offset;                                          \
+		}                                                              \
+	} while (false)
+
+#define VM_EQUAL_JUMP(lhs, rhs, on_equal)                                       \
+	do {                                                                   \
+		int16_t offset = VM_READ_JUMP();                               \
+                                                                               \
+		if (val_equals(lhs, rhs) == (on_equal)) {                      \
+			ip += offset;                                          \
+		}                                                              \
+	} while (false)
+
+	// generic ops rewrite themselves into a specialized op once they see
+	// their operand types. A specialized op whose guard fails rewrites
+	// itself back and re-dispatches the generic op
+#define VM_QUICKEN(op) (ip[-1] = (op))
+#define VM_DEOPT(op) (*--ip = (op))
+
+#define NUMERICAL_OP(op) BINARY_OP(VAL_CREATE_NUMBER, op)
+#define COMPARISON_OP(op) BINARY_OP(VAL_CREATE_BOOL, op)
+
+#define VM_PROPERTY_GET(cache_idx)                                             \
+	do {                                                                   \
+		struct prop_cache *cache = VM_READ_PROP_CACHE(cache_idx);      \
+		lox_instance_t *instance = OBJECT_AS_INSTANCE(VM_PEEK(0));     \
+		uint32_t field_idx;                                            \
+                                                                               \
+		if (!__vm_prop_idx(&cur_frame->closure->fn->chunk, cache,      \
+				   instance->cls, &field_idx)) {               \
+			VM_RUNTIME_ERROR("Undefined property");                \
+		}                                                              \
+                                                                               \
+		VM_PEEK(0) = *(lox_val_t *)list_get(&instance->fields,         \
+						    field_idx);                \
+	} while (false)
+
+#define VM_PROPERTY_SET(cache_idx)                                             \
+	do {                                                                   \
+		struct prop_cache *cache = VM_READ_PROP_CACHE(cache_idx);      \
+		lox_instance_t *instance = OBJECT_AS_INSTANCE(VM_PEEK(1));     \
+		uint32_t field_idx;                                            \
+                                                                               \
+		if (!__vm_prop_idx(&cur_frame->closure->fn->chunk, cache,      \
+				   instance->cls, &field_idx)) {               \
+			VM_RUNTIME_ERROR("Undefined property");                \
+		}                                                              \
+                                                                               \
+		lox_val_t new_val = VM_POP();                                  \
+		*(lox_val_t *)list_get(&instance->fields, field_idx) =         \
+			new_val;                                               \
+		VM_PEEK(0) = new_val;                                          \
+	} while (false)
+
+// the compiler only writes field ops for receivers of a known class, so the
+// field index needs no lookup
+#define VM_FIELD_GET(field_idx)                                                \
+	do {                                                                   \
+		lox_instance_t *instance = OBJECT_AS_INSTANCE(VM_PEEK(0));     \
+		VM_PEEK(0) = *(lox_val_t *)list_get(&instance->fields,         \
+						    field_idx);                \
+	} while (false)
+
+#define VM_FIELD_SET(field_idx)                                                \
+	do {                                                                   \
+		lox_instance_t *instance = OBJECT_AS_INSTANCE(VM_PEEK(1));     \
+		lox_val_t new_val = VM_POP();                                  \
+		*(lox_val_t *)list_get(&instance->fields, field_idx) =         \
+			new_val;                                               \
+		VM_PEEK(0) = new_val;                                          \
+	} while (false)
 
-	while (true) {
-		uint8_t instr;
 #ifdef DEBUG_TRACE_EXECUTION
-		printf("\t\t");
-		vm_print_stack(vm);
-		disassem_inst(&cur_frame->closure->fn->chunk,
-			      __frame_instr_offset(cur_frame));
+#define VM_TRACE_OP()                                                          \
+	do {                                                                   \
+		vm->stack_top = sp;                                            \
+		printf("\t\t");                                                \
+		vm_print_stack(vm);                                            \
+		disassem_inst(&cur_frame->closure->fn->chunk,                  \
+			      ip - cur_frame->closure->fn->chunk.code.data);   \
+	} while (false)
+#else
+#define VM_TRACE_OP()
 #endif // DEBUG_TRACE_EXECUTION
+
 #ifdef DEBUG_BENCH
-		struct timespec timer;
-		timer_start(&timer);
+#define VM_BENCH_START() timer_start(&timer)
+#define VM_BENCH_END()                                                         \
+	do {                                                                   \
+		struct timespec time_end = timer_end(timer);                   \
+		struct timespec *prev_time =                                   \
+			map_get(&vm->timings_map, op_name(instr));             \
+		if (prev_time) {                                               \
+			time_end = timespec_avg(*prev_time, time_end);         \
+		}                                                              \
+		map_insert(&vm->timings_map, op_name(instr), &time_end);       \
+		vm->op_pair_cnts[(prev_instr << 8) | instr]++;                 \
+		prev_instr = instr;                                            \
+	} while (false)
+#else
+#define VM_BENCH_START()
+#define VM_BENCH_END()
+#endif // DEBUG_BENCH
+
+#ifdef VM_THREADED_DISPATCH
+	// every handler jumps straight to the next handler, so each op gets its
+	// own indirect branch rather than sharing the one at the switch head
+#define X(op, width) [op] = &&LBL_##op,
+	static void *const dispatch_table[UINT8_MAX + 1] = {
+		[0 ... UINT8_MAX] = &&LBL_UNKNOWN_OP,
+#include "ops/ops_table.h"
+	};
+#undef X
+
+#define VM_DISPATCH()                                                          \
+	do {                                                                   \
+		VM_TRACE_OP();                                                 \
+		VM_BENCH_START();                                              \
+		goto *dispatch_table[instr = VM_READ_BYTE()];                  \
+	} while (false)
+#define VM_SWITCH() VM_DISPATCH();
+#define VM_CASE(op) LBL_##op
+#define VM_DEFAULT LBL_UNKNOWN_OP
+#define VM_BREAK                                                               \
+	do {                                                                   \
+		VM_BENCH_END();                                                \
+		VM_DISPATCH();                                                 \
+	} while (false)
+#else
+#define VM_SWITCH()                                                            \
+	VM_TRACE_OP();                                                         \
+	VM_BENCH_START();                                                      \
+	switch (instr = VM_READ_BYTE())
+#define VM_CASE(op) case op
+#define VM_DEFAULT default
+#define VM_BREAK break
+#endif // VM_THREADED_DISPATCH
+
+	struct vm_call_frame *cur_frame;
+	uint8_t *ip;
+	lox_val_t *sp;
+	lox_val_t *slots;
+	lox_val_t *consts;
+	uint8_t instr;
+#ifdef DEBUG_BENCH
+	struct timespec timer;
+	uint8_t prev_instr = OP_NOP;
 #endif
 
-		switch (instr = __frame_read_byte(cur_frame)) {
-		case OP_NOP:
-			break;
+	VM_LOAD_FRAME();
 
-		case OP_CONSTANT:
-			__vm_proc_const(vm, cur_frame,
-					__frame_proc_idx(cur_frame));
-			break;
+	while (true) {
+		VM_SWITCH() {
+		VM_CASE(OP_NOP):
+			VM_BREAK;
 
-		case OP_CONSTANT_LONG:
-			__vm_proc_const(vm, cur_frame,
-					__frame_proc_idx_ext(cur_frame));
-			break;
+		VM_CASE(OP_CONSTANT):
+			VM_PUSH(VM_READ_CONST(VM_READ_IDX()));
+			VM_BREAK;
 
-		case OP_CLOSURE: {
-			lox_val_t fn =
-				chunk_get_const(&cur_frame->closure->fn->chunk,
-						__frame_proc_idx(cur_frame));
+		VM_CASE(OP_CONSTANT_LONG):
+			VM_PUSH(VM_READ_CONST(VM_READ_IDX_EXT()));
+			VM_BREAK;
+
+		VM_CASE(OP_CLOSURE): {
+			lox_val_t fn = VM_READ_CONST(VM_READ_IDX());
 
 			assert(("closure object is not a function",
 				OBJECT_IS_FN(fn)));
 
+			// functions from an image are loaded on first use
+			if (OBJECT_AS_FN(fn)->image &&
+			    !image_load_fn(OBJECT_AS_FN(fn))) {
+				VM_RUNTIME_ERROR("Image is corrupt.");
+			}
+
 			lox_closure_t *closure =
 				object_closure_new(OBJECT_AS_FN(fn));
 
-			__vm_push_const(vm, VAL_CREATE_OBJ(closure));
+			VM_PUSH(VAL_CREATE_OBJ(closure));
 			for (size_t i = 0; i < closure->fn->upval_cnt; i++) {
-				lox_upval_t *upval;
-				op_code_t opcode = __frame_read_byte(cur_frame);
+				op_code_t opcode = VM_READ_BYTE();
 				assert(("expected upval define indicator",
 					opcode == OP_UPVALUE_DEFINE ||
 						opcode ==
 							OP_UPVALUE_DEFINE_LONG));
 
-				uint32_t idx = __frame_proc_idx(
-					cur_frame); // TODO: add support for wide commands
-				bool is_local = __frame_read_byte(cur_frame);
-
-				if (is_local) {
-					upval = __vm_capture_upval(
-						vm, cur_frame->stack_snapshot +
-							    idx);
+				uint32_t idx =
+					VM_READ_IDX(); // TODO: add support for wide commands
+				uint8_t flags = VM_READ_BYTE();
+
+				// immutable values can't change after capture so
+				// are copied, skipping the upvalue entirely
+				if (flags & UPVAL_COPY_FLAG) {
+					object_closure_bind_copy(
+						closure, i,
+						flags & UPVAL_LOCAL_FLAG ?
+							slots[idx] :
+							object_closure_get_copy(
+								cur_frame->closure,
+								idx));
+				} else if (flags & UPVAL_LOCAL_FLAG) {
+					object_closure_bind_upval(
+						closure, i,
+						__vm_capture_upval(vm,
+								   slots + idx));
 				} else {
-					upval = object_closure_get_upval(
-						cur_frame->closure, idx);
+					object_closure_bind_upval(
+						closure, i,
+						object_closure_get_upval(
+							cur_frame->closure,
+							idx));
 				}
-				object_closure_push_upval(closure, upval);
 			}
-		} break;
+		} VM_BREAK;
 
-		case OP_CLOSURE_LONG: {
-			lox_val_t fn = chunk_get_const(
-				&cur_frame->closure->fn->chunk,
-				__frame_proc_idx_ext(cur_frame));
+		VM_CASE(OP_CLOSURE_LONG): {
+			lox_val_t fn = VM_READ_CONST(VM_READ_IDX_EXT());
 
 			assert(("closure object is not a function",
 				OBJECT_IS_FN(fn)));
 
+			// functions from an image are loaded on first use
+			if (OBJECT_AS_FN(fn)->image &&
+			    !image_load_fn(OBJECT_AS_FN(fn))) {
+				VM_RUNTIME_ERROR("Image is corrupt.");
+			}
+
 			lox_closure_t *closure =
 				object_closure_new(OBJECT_AS_FN(fn));
 
-			__vm_push_const(vm, VAL_CREATE_OBJ(closure));
-		} break;
+			VM_PUSH(VAL_CREATE_OBJ(closure));
+		} VM_BREAK;
+
+		VM_CASE(OP_CLOSE_UPVALUE):
+			__vm_close_upvalues(vm, sp - 1);
+			VM_DISCARD(1);
+			VM_BREAK;
+
+		VM_CASE(OP_NIL):
+			VM_PUSH(VAL_CREATE_NIL);
+			VM_BREAK;
+
+		VM_CASE(OP_TRUE):
+			VM_PUSH(VAL_CREATE_BOOL(true));
+			VM_BREAK;
+
+		VM_CASE(OP_FALSE):
+			VM_PUSH(VAL_CREATE_BOOL(false));
+			VM_BREAK;
+
+		VM_CASE(OP_ADD):
+			if (VM_BOTH_NUMBERS()) {
+				VM_QUICKEN(OP_ADD_NUM);
+				UNCHECKED_BINARY_OP(VAL_CREATE_NUMBER, +);
+			} else if (VM_BOTH_STRINGS()) {
+				VM_QUICKEN(OP_ADD_STR);
+				STR_CONCAT();
+			} else {
+				VM_RUNTIME_ERROR("Operand types must match");
+			}
+			VM_BREAK;
+
+		VM_CASE(OP_ADD_NUM):
+			if (!VM_BOTH_NUMBERS()) {
+				VM_DEOPT(OP_ADD);
+				VM_BREAK;
+			}
+			UNCHECKED_BINARY_OP(VAL_CREATE_NUMBER, +);
+			VM_BREAK;
 
-		case OP_CLOSE_UPVALUE:
-			__vm_close_upvalues(vm, list_size(&vm->stack) - 1);
-			__vm_pop_const(vm);
-			break;
+		VM_CASE(OP_ADD_STR):
+			if (!VM_BOTH_STRINGS()) {
+				VM_DEOPT(OP_ADD);
+				VM_BREAK;
+			}
+			STR_CONCAT();
+			VM_BREAK;
 
-		case OP_NIL:
-			__vm_push_const(vm, VAL_CREATE_NIL);
-			break;
+		VM_CASE(OP_MOD): {
+			if (!VAL_IS_NUMBER(VM_PEEK(0)) ||
+			    !VAL_IS_NUMBER(VM_PEEK(1))) {
+				VM_RUNTIME_ERROR("Operand types must match");
+			}
 
-		case OP_TRUE:
-			__vm_push_const(vm, VAL_CREATE_BOOL(true));
-			break;
+			lox_num_t b = VAL_AS_NUMBER(VM_POP());
+			lox_num_t a = VAL_AS_NUMBER(VM_PEEK(0));
+			VM_PEEK(0) = VAL_CREATE_NUMBER(fmod(a, b));
+		} VM_BREAK;
 
-		case OP_FALSE:
-			__vm_push_const(vm, VAL_CREATE_BOOL(false));
-			break;
+		VM_CASE(OP_SUBTRACT):
+			NUMERICAL_OP(-);
+			VM_BREAK;
 
-		case OP_ADD:
-			if (OBJECT_IS_STRING(__vm_peek_const(vm, 0)) &&
-			    OBJECT_IS_STRING(__vm_peek_const(vm, 1))) {
-				__vm_str_concat(vm);
-			} else if (VAL_IS_NUMBER(__vm_peek_const(vm, 0)) &&
-				   VAL_IS_NUMBER(__vm_peek_const(vm, 1))) {
-				NUMERICAL_OP(vm, +);
-			} else {
-				__vm_runtime_error(vm,
-						   "Operand types must match");
-				return INTERPRET_RUNTIME_ERROR;
-			}
-			break;
+		VM_CASE(OP_MULTIPLY):
+			NUMERICAL_OP(*);
+			VM_BREAK;
 
-		case OP_MOD: {
-			if (!VAL_IS_NUMBER(*(__vm_peek_const_ptr(vm, 0))) ||
-			    !VAL_IS_NUMBER(*(__vm_peek_const_ptr(vm, 1)))) {
-				__vm_runtime_error(vm,
-						   "Operand types must match");
-				return INTERPRET_RUNTIME_ERROR;
+		VM_CASE(OP_DIVIDE):
+			NUMERICAL_OP(/);
+			VM_BREAK;
+
+		VM_CASE(OP_GREATER):
+			COMPARISON_OP(>);
+			VM_BREAK;
+
+		VM_CASE(OP_LESS):
+			COMPARISON_OP(<);
+			VM_BREAK;
+
+		VM_CASE(OP_GREATER_EQ):
+			COMPARISON_OP(>=);
+			VM_BREAK;
+
+		VM_CASE(OP_LESS_EQ):
+			COMPARISON_OP(<=);
+			VM_BREAK;
+
+		VM_CASE(OP_NOT_EQUAL): {
+			lox_val_t b = VM_POP();
+			lox_val_t a = VM_PEEK(0);
+
+			VM_PEEK(0) = VAL_CREATE_BOOL(!val_equals(a, b));
+		} VM_BREAK;
+
+		VM_CASE(OP_EQUAL): {
+			if (VM_BOTH_NUMBERS()) {
+				VM_QUICKEN(OP_EQUAL_NUM);
+				UNCHECKED_BINARY_OP(VAL_CREATE_BOOL, ==);
+				VM_BREAK;
 			}
 
-			lox_num_t b = __vm_pop_const(vm).as.number;
-			lox_num_t a = __vm_pop_const(vm).as.number;
-			__vm_push_const(vm, VAL_CREATE_NUMBER(fmod(a, b)));
-		} break;
+			lox_val_t b = VM_POP();
+			lox_val_t a = VM_PEEK(0);
 
-		case OP_SUBTRACT:
-			NUMERICAL_OP(vm, -);
-			break;
+			VM_PEEK(0) = VAL_CREATE_BOOL(val_equals(a, b));
+		} VM_BREAK;
 
-		case OP_MULTIPLY:
-			NUMERICAL_OP(vm, *);
-			break;
+		VM_CASE(OP_EQUAL_NUM):
+			if (!VM_BOTH_NUMBERS()) {
+				VM_DEOPT(OP_EQUAL);
+				VM_BREAK;
+			}
+			UNCHECKED_BINARY_OP(VAL_CREATE_BOOL, ==);
+			VM_BREAK;
+
+		VM_CASE(OP_ADD_REG): {
+			VM_REG_READ();
+
+			if (VAL_IS_NUMBER(reg_lhs) && VAL_IS_NUMBER(reg_rhs)) {
+				VM_REG_WRITE(VAL_CREATE_NUMBER(
+					VAL_AS_NUMBER(reg_lhs) +
+					VAL_AS_NUMBER(reg_rhs)));
+			} else if (OBJECT_IS_STRING(reg_lhs) &&
+				   OBJECT_IS_STRING(reg_rhs)) {
+				VM_REG_WRITE(VAL_CREATE_OBJ(object_str_concat(
+					OBJECT_AS_STRING(reg_lhs),
+					OBJECT_AS_STRING(reg_rhs))));
+			} else {
+				VM_RUNTIME_ERROR("Operand types must match");
+			}
+		} VM_BREAK;
 
-		case OP_DIVIDE:
-			NUMERICAL_OP(vm, /);
-			break;
+		VM_CASE(OP_SUBTRACT_REG):
+			REG_BINARY_OP(VAL_CREATE_NUMBER, -);
+			VM_BREAK;
 
-		case OP_GREATER:
-			COMPARISON_OP(vm, >);
-			break;
+		VM_CASE(OP_MULTIPLY_REG):
+			REG_BINARY_OP(VAL_CREATE_NUMBER, *);
+			VM_BREAK;
 
-		case OP_LESS:
-			COMPARISON_OP(vm, <);
-			break;
+		VM_CASE(OP_DIVIDE_REG):
+			REG_BINARY_OP(VAL_CREATE_NUMBER, /);
+			VM_BREAK;
 
-		case OP_EQUAL: {
-			lox_val_t b = __vm_pop_const(vm);
-			lox_val_t a = __vm_pop_const(vm);
+		VM_CASE(OP_MOD_REG): {
+			VM_REG_READ();
 
-			__vm_push_const(vm, VAL_CREATE_BOOL(val_equals(a, b)));
-		} break;
+			if (!VAL_IS_NUMBER(reg_lhs) || !VAL_IS_NUMBER(reg_rhs)) {
+				VM_RUNTIME_ERROR("Operand types must match");
+			}
+			VM_REG_WRITE(VAL_CREATE_NUMBER(fmod(
+				VAL_AS_NUMBER(reg_lhs), VAL_AS_NUMBER(reg_rhs))));
+		} VM_BREAK;
+
+		VM_CASE(OP_GREATER_REG):
+			REG_BINARY_OP(VAL_CREATE_BOOL, >);
+			VM_BREAK;
+
+		VM_CASE(OP_LESS_REG):
+			REG_BINARY_OP(VAL_CREATE_BOOL, <);
+			VM_BREAK;
+
+		VM_CASE(OP_GREATER_EQ_REG):
+			REG_BINARY_OP(VAL_CREATE_BOOL, >=);
+			VM_BREAK;
+
+		VM_CASE(OP_LESS_EQ_REG):
+			REG_BINARY_OP(VAL_CREATE_BOOL, <=);
+			VM_BREAK;
+
+		VM_CASE(OP_NOT_EQUAL_REG): {
+			VM_REG_READ();
+			VM_REG_WRITE(
+				VAL_CREATE_BOOL(!val_equals(reg_lhs, reg_rhs)));
+		} VM_BREAK;
+
+		VM_CASE(OP_EQUAL_REG): {
+			VM_REG_READ();
+
+			if (VAL_IS_NUMBER(reg_lhs) && VAL_IS_NUMBER(reg_rhs)) {
+				VM_REG_WRITE(VAL_CREATE_BOOL(
+					VAL_AS_NUMBER(reg_lhs) ==
+					VAL_AS_NUMBER(reg_rhs)));
+			} else {
+				VM_REG_WRITE(VAL_CREATE_BOOL(
+					val_equals(reg_lhs, reg_rhs)));
+			}
+		} VM_BREAK;
 
-		case OP_POP:
-			__vm_pop_const(vm);
-			break;
+		VM_CASE(OP_POP):
+			VM_DISCARD(1);
+			VM_BREAK;
 
-		case OP_POP_COUNT:
-			__vm_discard(vm, __frame_proc_idx(cur_frame));
-			break;
+		VM_CASE(OP_POP_COUNT):
+			VM_DISCARD(VM_READ_IDX());
+			VM_BREAK;
 
-		case OP_NEGATE:
-			if (!VAL_IS_NUMBER(__vm_peek_const(vm, 0))) {
-				__vm_runtime_error(vm,
-						   "Operand must be a number");
-				return INTERPRET_RUNTIME_ERROR;
+		VM_CASE(OP_NEGATE):
+			if (!VAL_IS_NUMBER(VM_PEEK(0))) {
+				VM_RUNTIME_ERROR("Operand must be a number");
 			}
-			__vm_proc_negate_in_place(vm);
-			break;
+			VM_PEEK(0) = VAL_CREATE_NUMBER(-VAL_AS_NUMBER(VM_PEEK(0)));
+			VM_BREAK;
 
-		case OP_NOT:
-			__vm_push_const(vm, VAL_CREATE_BOOL(val_is_falsey(
-						    __vm_pop_const(vm))));
-			break;
+		VM_CASE(OP_NOT):
+			VM_PEEK(0) = VAL_CREATE_BOOL(val_is_falsey(VM_PEEK(0)));
+			VM_BREAK;
 
-		case OP_UPVALUE_GET: {
-			uint32_t slot = __frame_proc_idx(cur_frame);
+		VM_CASE(OP_UPVALUE_GET): {
+			uint32_t slot = VM_READ_IDX();
 			const lox_upval_t *upval = object_closure_get_upval(
 				cur_frame->closure, slot);
 
 			if (!upval) {
-				__vm_runtime_error(vm, "Unknown upvalue");
-				return INTERPRET_RUNTIME_ERROR;
+				VM_RUNTIME_ERROR("Unknown upvalue");
 			}
 
-			__vm_push_const(vm, *upval->location);
-		} break;
+			VM_PUSH(*upval->location);
+		} VM_BREAK;
 
-		case OP_UPVALUE_GET_LONG: {
-			uint32_t slot = __frame_proc_idx_ext(cur_frame);
+		VM_CASE(OP_UPVALUE_GET_LONG): {
+			uint32_t slot = VM_READ_IDX_EXT();
 			const lox_upval_t *upval = object_closure_get_upval(
 				cur_frame->closure, slot);
 
-			__vm_push_const(vm, *upval->location);
-		} break;
+			VM_PUSH(*upval->location);
+		} VM_BREAK;
+
+		VM_CASE(OP_UPVALUE_COPY_GET):
+			VM_PUSH(object_closure_get_copy(cur_frame->closure,
+							VM_READ_IDX()));
+			VM_BREAK;
 
-		case OP_UPVALUE_SET: {
-			uint32_t slot = __frame_proc_idx(cur_frame);
-			lox_val_t *new_val = __vm_peek_const_ptr(vm, 0);
+		VM_CASE(OP_UPVALUE_COPY_GET_LONG):
+			VM_PUSH(object_closure_get_copy(cur_frame->closure,
+							VM_READ_IDX_EXT()));
+			VM_BREAK;
+
+		VM_CASE(OP_UPVALUE_SET): {
+			uint32_t slot = VM_READ_IDX();
 
 			object_closure_set_upval(cur_frame->closure, slot,
-						 new_val);
-		} break;
+						 &VM_PEEK(0));
+		} VM_BREAK;
 
-		case OP_UPVALUE_SET_LONG: {
-			uint32_t slot = __frame_proc_idx_ext(cur_frame);
-			lox_val_t *new_val = __vm_peek_const_ptr(vm, 0);
+		VM_CASE(OP_UPVALUE_SET_LONG): {
+			uint32_t slot = VM_READ_IDX_EXT();
 
 			object_closure_set_upval(cur_frame->closure, slot,
-						 new_val);
-		} break;
+						 &VM_PEEK(0));
+		} VM_BREAK;
 
-		case OP_GLOBAL_DEFINE: {
-			uint32_t idx = __frame_proc_idx(cur_frame);
-			lox_val_t *val = __vm_peek_const_ptr(vm, 0);
+		VM_CASE(OP_GLOBAL_DEFINE): {
+			uint32_t idx = VM_READ_IDX();
 
-			__vm_define_global(vm, val, idx);
-			__vm_pop_const(vm);
-		} break;
+			__vm_define_global(vm, &VM_POP(), idx);
+		} VM_BREAK;
 
-		case OP_GLOBAL_DEFINE_LONG: {
-			uint32_t idx = __frame_proc_idx(cur_frame);
-			lox_val_t *val = __vm_peek_const_ptr(vm, 0);
+		VM_CASE(OP_GLOBAL_DEFINE_LONG): {
+			uint32_t idx = VM_READ_IDX_EXT();
 
-			__vm_define_global(vm, val, idx);
-			__vm_pop_const(vm);
-		} break;
+			__vm_define_global(vm, &VM_POP(), idx);
+		} VM_BREAK;
 
-		case OP_GLOBAL_GET: {
-			uint32_t idx = __frame_proc_idx(cur_frame);
+		VM_CASE(OP_GLOBAL_GET): {
+			uint32_t idx = VM_READ_IDX();
 			lox_val_t *val = __vm_get_global(vm, idx);
 
 			if (!val) {
-				__vm_runtime_error(vm, "undefined global.");
-				return INTERPRET_RUNTIME_ERROR;
+				VM_RUNTIME_ERROR("undefined global.");
 			}
-			__vm_push_const(vm, *val);
-		} break;
+			VM_PUSH(*val);
+		} VM_BREAK;
 
-		case OP_GLOBAL_GET_LONG: {
-			uint32_t idx = __frame_proc_idx_ext(cur_frame);
+		VM_CASE(OP_GLOBAL_GET_LONG): {
+			uint32_t idx = VM_READ_IDX_EXT();
 			lox_val_t *val = __vm_get_global(vm, idx);
 
 			if (!val) {
-				__vm_runtime_error(vm, "undefined global.");
-				return INTERPRET_RUNTIME_ERROR;
+				VM_RUNTIME_ERROR("undefined global.");
 			}
-			__vm_push_const(vm, *val);
-		} break;
+			VM_PUSH(*val);
+		} VM_BREAK;
 
-		case OP_GLOBAL_SET: {
-			uint32_t idx = __frame_proc_idx(cur_frame);
-			lox_val_t *val = __vm_peek_const_ptr(vm, 0);
+		VM_CASE(OP_GLOBAL_SET): {
+			uint32_t idx = VM_READ_IDX();
 
-			if (!__vm_set_global(vm, idx, val)) {
-				__vm_runtime_error(vm, "Undefined global.");
-				return INTERPRET_RUNTIME_ERROR;
+			if (!__vm_set_global(vm, idx, &VM_PEEK(0))) {
+				VM_RUNTIME_ERROR("Undefined global.");
 			}
-		} break;
+		} VM_BREAK;
 
-		case OP_GLOBAL_SET_LONG: {
-			uint32_t idx = __frame_proc_idx_ext(cur_frame);
-			lox_val_t *val = __vm_peek_const_ptr(vm, 0);
+		VM_CASE(OP_GLOBAL_SET_LONG): {
+			uint32_t idx = VM_READ_IDX_EXT();
 
-			if (!__vm_set_global(vm, idx, val)) {
-				__vm_runtime_error(vm, "Undefined global.");
-				return INTERPRET_RUNTIME_ERROR;
+			if (!__vm_set_global(vm, idx, &VM_PEEK(0))) {
+				VM_RUNTIME_ERROR("Undefined global.");
 			}
-		} break;
-
-		case OP_VAR_DEFINE: {
-			__frame_proc_idx(cur_frame);
-			lox_val_t *val = __vm_peek_const_ptr(vm, 0);
-
-			__vm_define_var(vm, val);
-			__vm_pop_const(vm);
-		} break;
-
-		case OP_VAR_DEFINE_LONG: {
-			__frame_proc_idx_ext(cur_frame);
-			lox_val_t *val = __vm_peek_const_ptr(vm, 0);
+		} VM_BREAK;
 
-			__vm_define_var(vm, val);
-			__vm_pop_const(vm);
-		} break;
+		VM_CASE(OP_GLOBAL_SET_POP): {
+			uint32_t idx = VM_READ_IDX();
 
-		case OP_VAR_GET: {
-			uint32_t idx = cur_frame->stack_snapshot +
-				       __frame_proc_idx(cur_frame);
-			lox_val_t *val = __vm_get_var(vm, idx);
-
-			if (!val) {
-				__vm_runtime_error(vm, "Undefined variable.");
-				return INTERPRET_RUNTIME_ERROR;
+			if (!__vm_set_global(vm, idx, &VM_PEEK(0))) {
+				VM_RUNTIME_ERROR("Undefined global.");
 			}
-			__vm_push_const(vm, *val);
-		} break;
-
-		case OP_VAR_GET_LONG: {
-			uint32_t idx = cur_frame->stack_snapshot +
-				       __frame_proc_idx_ext(cur_frame);
-			lox_val_t *val = __vm_get_var(vm, idx);
-
-			if (!val) {
-				__vm_runtime_error(vm, "Undefined variable.");
-				return INTERPRET_RUNTIME_ERROR;
+			VM_DISCARD(1);
+		} VM_BREAK;
+
+		// locals are assigned the slot their initializer was pushed to,
+		// so defining one leaves the stack untouched
+		VM_CASE(OP_VAR_GET): {
+			uint32_t idx = VM_READ_IDX();
+
+			assert(("local slot is outside of the stack",
+				slots + idx < sp));
+			VM_PUSH(slots[idx]);
+		} VM_BREAK;
+
+		VM_CASE(OP_VAR_GET_LONG): {
+			uint32_t idx = VM_READ_IDX_EXT();
+
+			assert(("local slot is outside of the stack",
+				slots + idx < sp));
+			VM_PUSH(slots[idx]);
+		} VM_BREAK;
+
+		VM_CASE(OP_VAR_GET_CONST): {
+			uint32_t idx = VM_READ_IDX();
+
+			assert(("local slot is outside of the stack",
+				slots + idx < sp));
+			VM_PUSH(slots[idx]);
+			VM_PUSH(VM_READ_CONST(VM_READ_IDX()));
+		} VM_BREAK;
+
+		VM_CASE(OP_VAR_SET): {
+			uint32_t idx = VM_READ_IDX();
+
+			assert(("local slot is outside of the stack",
+				slots + idx < sp));
+			slots[idx] = VM_PEEK(0);
+		} VM_BREAK;
+
+		VM_CASE(OP_VAR_SET_LONG): {
+			uint32_t idx = VM_READ_IDX_EXT();
+
+			assert(("local slot is outside of the stack",
+				slots + idx < sp));
+			slots[idx] = VM_PEEK(0);
+		} VM_BREAK;
+
+		VM_CASE(OP_VAR_SET_POP): {
+			uint32_t idx = VM_READ_IDX();
+
+			assert(("local slot is outside of the stack",
+				slots + idx < sp - 1));
+			slots[idx] = VM_POP();
+		} VM_BREAK;
+
+		VM_CASE(OP_PROPERTY_DEFINE):
+			(void)VM_READ_IDX();
+			VM_DISCARD(1);
+			VM_BREAK;
+
+		VM_CASE(OP_PROPERTY_DEFINE_LONG):
+			(void)VM_READ_IDX_EXT();
+			VM_DISCARD(1);
+			VM_BREAK;
+
+		VM_CASE(OP_PROPERTY_GET):
+			VM_PROPERTY_GET(VM_READ_IDX());
+			VM_BREAK;
+
+		VM_CASE(OP_PROPERTY_GET_LONG):
+			VM_PROPERTY_GET(VM_READ_IDX_EXT());
+			VM_BREAK;
+
+		VM_CASE(OP_PROPERTY_SET):
+			VM_PROPERTY_SET(VM_READ_IDX());
+			VM_BREAK;
+
+		VM_CASE(OP_PROPERTY_SET_LONG):
+			VM_PROPERTY_SET(VM_READ_IDX_EXT());
+			VM_BREAK;
+
+		VM_CASE(OP_PROPERTY_SET_POP):
+			VM_PROPERTY_SET(VM_READ_IDX());
+			VM_DISCARD(1);
+			VM_BREAK;
+
+		VM_CASE(OP_FIELD_GET):
+			VM_FIELD_GET(VM_READ_IDX());
+			VM_BREAK;
+
+		VM_CASE(OP_FIELD_GET_LONG):
+			VM_FIELD_GET(VM_READ_IDX_EXT());
+			VM_BREAK;
+
+		VM_CASE(OP_FIELD_SET):
+			VM_FIELD_SET(VM_READ_IDX());
+			VM_BREAK;
+
+		VM_CASE(OP_FIELD_SET_LONG):
+			VM_FIELD_SET(VM_READ_IDX_EXT());
+			VM_BREAK;
+
+		VM_CASE(OP_FIELD_SET_POP):
+			VM_FIELD_SET(VM_READ_IDX());
+			VM_DISCARD(1);
+			VM_BREAK;
+
+		VM_CASE(OP_JUMP): {
+			int16_t offset = VM_READ_JUMP();
+			ip += offset;
+		} VM_BREAK;
+
+		VM_CASE(OP_JUMP_IF_FALSE): {
+			int16_t offset = VM_READ_JUMP();
+
+			if (val_is_falsey(VM_PEEK(0))) {
+				ip += offset;
 			}
-			__vm_push_const(vm, *val);
-		} break;
+		} VM_BREAK;
 
-		case OP_VAR_SET: {
-			uint32_t idx = cur_frame->stack_snapshot +
-				       __frame_proc_idx(cur_frame);
-			lox_val_t *val = __vm_peek_const_ptr(vm, 0);
+		VM_CASE(OP_JUMP_IF_FALSE_POP): {
+			int16_t offset = VM_READ_JUMP();
 
-			if (!__vm_set_var(vm, idx, val)) {
-				__vm_runtime_error(vm, "Undefined variable.");
-				return INTERPRET_RUNTIME_ERROR;
+			if (val_is_falsey(VM_POP())) {
+				ip += offset;
 			}
-		} break;
-
-		case OP_PROPERTY_DEFINE: {
-			__frame_proc_idx(cur_frame);
-			__vm_pop_const(vm);
-		} break;
-
-		case OP_PROPERTY_DEFINE_LONG: {
-			__frame_proc_idx_ext(cur_frame);
-			__vm_pop_const(vm);
-		} break;
-
-		case OP_PROPERTY_GET: {
-			// TODO: refactor to share between props
-			lox_str_t *prop_name = OBJECT_AS_STRING(
-				chunk_get_const(&cur_frame->closure->fn->chunk,
-						__frame_proc_idx(cur_frame)));
-			lox_instance_t *instance =
-				OBJECT_AS_INSTANCE(__vm_pop_const(vm));
-
-			lookup_var_t var = lookup_find_name(
-				&instance->cls->field_lookup.table,
-				prop_name->chars, prop_name->len);
-
-			if (!lookup_var_is_valid(var)) {
-				__vm_runtime_error(vm, "Undefined property");
+		} VM_BREAK;
+
+		VM_CASE(OP_JUMP_IF_NOT_EQUAL):
+			VM_EQUAL_JUMP(VM_PEEK(1), VM_PEEK(0), false);
+			VM_DISCARD(2);
+			VM_BREAK;
+
+		VM_CASE(OP_JUMP_IF_NOT_GREATER):
+			VM_CMP_JUMP(VM_PEEK(1), VM_PEEK(0), >);
+			VM_DISCARD(2);
+			VM_BREAK;
+
+		VM_CASE(OP_JUMP_IF_NOT_LESS):
+			VM_CMP_JUMP(VM_PEEK(1), VM_PEEK(0), <);
+			VM_DISCARD(2);
+			VM_BREAK;
+
+		VM_CASE(OP_JUMP_IF_NOT_GREATER_EQ):
+			VM_CMP_JUMP(VM_PEEK(1), VM_PEEK(0), >=);
+			VM_DISCARD(2);
+			VM_BREAK;
+
+		VM_CASE(OP_JUMP_IF_NOT_LESS_EQ):
+			VM_CMP_JUMP(VM_PEEK(1), VM_PEEK(0), <=);
+			VM_DISCARD(2);
+			VM_BREAK;
+
+		VM_CASE(OP_JUMP_IF_EQUAL):
+			VM_EQUAL_JUMP(VM_PEEK(1), VM_PEEK(0), true);
+			VM_DISCARD(2);
+			VM_BREAK;
+
+		VM_CASE(OP_JUMP_IF_NOT_EQUAL_REG): {
+			VM_REG_JUMP_READ();
+			VM_EQUAL_JUMP(reg_lhs, reg_rhs, false);
+		} VM_BREAK;
+
+		VM_CASE(OP_JUMP_IF_NOT_GREATER_REG): {
+			VM_REG_JUMP_READ();
+			VM_CMP_JUMP(reg_lhs, reg_rhs, >);
+		} VM_BREAK;
+
+		VM_CASE(OP_JUMP_IF_NOT_LESS_REG): {
+			VM_REG_JUMP_READ();
+			VM_CMP_JUMP(reg_lhs, reg_rhs, <);
+		} VM_BREAK;
+
+		VM_CASE(OP_JUMP_IF_NOT_GREATER_EQ_REG): {
+			VM_REG_JUMP_READ();
+			VM_CMP_JUMP(reg_lhs, reg_rhs, >=);
+		} VM_BREAK;
+
+		VM_CASE(OP_JUMP_IF_NOT_LESS_EQ_REG): {
+			VM_REG_JUMP_READ();
+			VM_CMP_JUMP(reg_lhs, reg_rhs, <=);
+		} VM_BREAK;
+
+		VM_CASE(OP_JUMP_IF_EQUAL_REG): {
+			VM_REG_JUMP_READ();
+			VM_EQUAL_JUMP(reg_lhs, reg_rhs, true);
+		} VM_BREAK;
+
+		VM_CASE(OP_FOR_RANGE_INIT): {
+			lox_val_t *counter = slots + VM_READ_IDX();
+			int16_t offset = VM_READ_JUMP();
+
+			if (!VAL_IS_NUMBER(counter[0]) ||
+			    !VAL_IS_NUMBER(counter[1])) {
+				VM_RUNTIME_ERROR("Range bounds must be numbers");
 			}
-
-			lox_val_t *val = list_get(&instance->fields, var.idx);
-			__vm_push_const(vm, *val);
-		} break;
-
-		case OP_PROPERTY_GET_LONG: {
-			lox_str_t *prop_name = OBJECT_AS_STRING(chunk_get_const(
-				&cur_frame->closure->fn->chunk,
-				__frame_proc_idx_ext(cur_frame)));
-			lox_instance_t *instance =
-				OBJECT_AS_INSTANCE(__vm_pop_const(vm));
-
-			lookup_var_t var = lookup_find_name(
-				&instance->cls->field_lookup.table,
-				prop_name->chars, prop_name->len);
-
-			if (!lookup_var_is_valid(var)) {
-				__vm_runtime_error(vm, "Undefined property");
+			if (!(VAL_AS_NUMBER(counter[0]) <
+			      VAL_AS_NUMBER(counter[1]))) {
+				ip += offset;
 			}
-
-			lox_val_t *val = list_get(&instance->fields, var.idx);
-			__vm_push_const(vm, *val);
-		} break;
-
-		case OP_PROPERTY_SET: {
-			// TODO: refactor to share between props
-			lox_str_t *prop_name = OBJECT_AS_STRING(
-				chunk_get_const(&cur_frame->closure->fn->chunk,
-						__frame_proc_idx(cur_frame)));
-			lox_val_t *new_val = __vm_peek_const_ptr(vm, 0);
-			lox_instance_t *instance =
-				OBJECT_AS_INSTANCE(*__vm_peek_const_ptr(vm, 1));
-
-			// TODO: verify if sanity checks are needed
-			lookup_var_t var = lookup_find_name(
-				&instance->cls->field_lookup.table,
-				prop_name->chars, prop_name->len);
-
-			if (!lookup_var_is_valid(var)) {
-				__vm_runtime_error(vm, "Undefined property");
-			}
-
-			lox_val_t *val_ptr =
-				list_get(&instance->fields, var.idx);
-			memcpy(val_ptr, new_val, sizeof(lox_val_t));
-		} break;
-
-		case OP_PROPERTY_SET_LONG: {
-			lox_str_t *prop_name = OBJECT_AS_STRING(chunk_get_const(
-				&cur_frame->closure->fn->chunk,
-				__frame_proc_idx_ext(cur_frame)));
-			lox_val_t *new_val = __vm_peek_const_ptr(vm, 0);
-			lox_instance_t *instance =
-				OBJECT_AS_INSTANCE(*__vm_peek_const_ptr(vm, 1));
-
-			// TODO: verify if sanity checks are needed
-			lookup_var_t var = lookup_find_name(
-				&instance->cls->field_lookup.table,
-				prop_name->chars, prop_name->len);
-
-			if (!lookup_var_is_valid(var)) {
-				__vm_runtime_error(vm, "Undefined property");
+		} VM_BREAK;
+
+		// the bounds were checked on entry and the counter slot can
+		// not be assigned to, so both are known to be numbers
+		VM_CASE(OP_FOR_RANGE): {
+			lox_val_t *counter = slots + VM_READ_IDX();
+			int16_t offset = VM_READ_JUMP();
+			lox_num_t next = VAL_AS_NUMBER(counter[0]) + 1;
+
+			counter[0] = VAL_CREATE_NUMBER(next);
+			if (next < VAL_AS_NUMBER(counter[1])) {
+				ip += offset;
 			}
+		} VM_BREAK;
 
-			lox_val_t *val_ptr =
-				list_get(&instance->fields, var.idx);
-			memcpy(val_ptr, new_val, sizeof(lox_val_t));
-		} break;
-
-		case OP_VAR_SET_LONG: {
-			uint32_t idx = cur_frame->stack_snapshot +
-				       __frame_proc_idx_ext(cur_frame);
-			lox_val_t *val = __vm_peek_const_ptr(vm, 0);
+		VM_CASE(OP_CALL): {
+			uint8_t arg_cnt = VM_READ_IDX();
+#ifdef VM_JIT
+			size_t depth = vm->frame_cnt;
+#endif
 
-			if (!__vm_set_var(vm, idx, val)) {
-				__vm_runtime_error(vm, "Undefined variable.");
+			VM_STORE_FRAME();
+			if (!__vm_call_val(vm, VM_PEEK(arg_cnt), arg_cnt)) {
 				return INTERPRET_RUNTIME_ERROR;
 			}
-		} break;
-
-		case OP_JUMP: {
-			int16_t offset = __frame_proc_jump_offset(cur_frame);
-			cur_frame->ip += offset;
-		} break;
-
-		case OP_JUMP_IF_FALSE: {
-			int16_t offset = __frame_proc_jump_offset(cur_frame);
-
-			if (val_is_falsey(__vm_peek_const(vm, 0))) {
-				cur_frame->ip += offset;
-			}
-		} break;
-
-		case OP_CALL: {
-			uint8_t arg_cnt = __frame_proc_idx(cur_frame);
-
-			if (!__vm_call_val(vm, __vm_peek_const(vm, arg_cnt),
-					   arg_cnt)) {
+#ifdef VM_JIT
+			// hot callees run natively to their return
+			if (vm->frame_cnt > depth &&
+			    __vm_jit_ready(__vm_cur_frame(vm)->closure->fn) &&
+			    !__vm_call_native(vm)) {
 				return INTERPRET_RUNTIME_ERROR;
 			}
-
-			cur_frame = list_peek(&vm->frames);
-		} break;
-
-		case OP_RETURN: {
-			// arg_sz + 1
-			list_pop(&vm->frames);
-
-			if (!list_size(&vm->frames)) {
-				__vm_pop_const(vm);
-				return INTERPRET_OK;
+#endif
+			VM_LOAD_FRAME();
+		} VM_BREAK;
+
+		VM_CASE(OP_TAIL_CALL): {
+			uint8_t arg_cnt = VM_READ_IDX();
+			lox_val_t callee = VM_PEEK(arg_cnt);
+
+			VM_STORE_FRAME();
+			if (__vm_can_reuse_frame(vm, callee, arg_cnt)) {
+				__vm_reuse_frame(vm, OBJECT_AS_CLOSURE(callee),
+						 arg_cnt);
+#ifdef VM_JIT
+				if (__vm_jit_ready(OBJECT_AS_CLOSURE(callee)->fn)) {
+					if (!__vm_call_native(vm)) {
+						return INTERPRET_RUNTIME_ERROR;
+					}
+					if (vm->frame_cnt == base_depth) {
+						return INTERPRET_OK;
+					}
+				}
+#endif
+				VM_LOAD_FRAME();
+				VM_BREAK;
 			}
 
-			lox_val_t retval = __vm_pop_const(vm);
-			__vm_close_upvalues(vm, cur_frame->stack_snapshot - 1);
-			list_set_cnt(&vm->stack, cur_frame->stack_snapshot - 1);
-
-			__vm_push_const(vm, retval);
-			cur_frame = list_peek(&vm->frames);
-		} break;
-
-		default:
+			// natives and classes leave their result in place of
+			// the callee, which is then returned
+			if (!__vm_call_val(vm, callee, arg_cnt)) {
+				return INTERPRET_RUNTIME_ERROR;
+			}
+			sp = vm->stack_top;
+			VM_RETURN();
+		} VM_BREAK;
+
+		VM_CASE(OP_RETURN):
+			VM_RETURN();
+			VM_BREAK;
+
+		// only valid as OP_CLOSURE operands
+		VM_CASE(OP_UPVALUE_DEFINE):
+		VM_CASE(OP_UPVALUE_DEFINE_LONG):
+		VM_DEFAULT:
 			printf("UNKNOWN OPCODE: %d\n", instr);
 			return INTERPRET_RUNTIME_ERROR;
 		}
-#ifdef DEBUG_BENCH
-		struct timespec time_end = timer_end(timer);
-		struct timespec *prev_time =
-			map_get(&vm->timings_map, op_name(instr));
-		if (prev_time) {
-			time_end = timespec_avg(*prev_time, time_end);
-		}
-		map_insert(&vm->timings_map, op_name(instr), &time_end);
-
-#endif
+		VM_BENCH_END();
 	}
 
+#undef VM_READ_BYTE
+#undef VM_READ_IDX
+#undef VM_READ_IDX_EXT
+#undef VM_READ_JUMP
+#undef VM_READ_CONST
+#undef VM_READ_PROP_CACHE
+#undef VM_PUSH
+#undef VM_POP
+#undef VM_PEEK
+#undef VM_DISCARD
+#undef VM_STORE_FRAME
+#undef VM_ENTER_FRAME
+#undef VM_LOAD_FRAME
+#undef VM_RETURN
+#undef VM_RUNTIME_ERROR
+#undef VM_BOTH_NUMBERS
+#undef VM_BOTH_STRINGS
+#undef UNCHECKED_BINARY_OP
 #undef BINARY_OP
+#undef STR_CONCAT
+#undef VM_REG_OPERAND
+#undef VM_REG_READ
+#undef VM_REG_WRITE
+#undef REG_BINARY_OP
+#undef VM_REG_JUMP_READ
+#undef VM_CMP_JUMP
+#undef VM_EQUAL_JUMP
+#undef VM_QUICKEN
+#undef VM_DEOPT
 #undef NUMERICAL_OP
 #undef COMPARISON_OP
+#undef VM_PROPERTY_GET
+#undef VM_PROPERTY_SET
+#undef VM_FIELD_GET
+#undef VM_FIELD_SET
+#undef VM_TRACE_OP
+#undef VM_BENCH_START
+#undef VM_BENCH_END
+#undef VM_DISPATCH
+#undef VM_SWITCH
+#undef VM_CASE
+#undef VM_DEFAULT
+#undef VM_BREAK
 }
 
 static void __vm_define_global(vm_t *vm, lox_val_t *val, size_t idx)
@@ -738,36 +1307,11 @@ static bool __vm_set_global(vm_t *vm, uint32_t glbl, lox_val_t *val)
 	memcpy(val_ptr, val, sizeof(lox_val_t));
 	return true;
 }
-static void __vm_define_var(vm_t *vm, lox_val_t *val)
-{
-	list_push(&vm->stack, val);
-}
-
 static void __vm_define_prop(vm_t *vm, lox_val_t *val)
 {
 	// TODO: check for statics
 }
 
-static lox_val_t *__vm_get_var(vm_t *vm, uint32_t glbl)
-{
-	if (glbl >= vm->stack.cnt) {
-		return NULL;
-	}
-
-	return (lox_val_t *)list_get(&vm->stack, glbl);
-}
-
-static bool __vm_set_var(vm_t *vm, uint32_t glbl, lox_val_t *val)
-{
-	if (glbl >= vm->stack.cnt) {
-		return false;
-	}
-
-	lox_val_t *val_ptr = (lox_val_t *)list_get(&vm->stack, glbl);
-	memcpy(val_ptr, val, sizeof(lox_val_t));
-	return true;
-}
-
 static void __vm_set_main(vm_t *vm, lox_fn_t *main)
 {
 	lox_val_t main_obj = VAL_CREATE_OBJ(main);
@@ -776,76 +1320,13 @@ static void __vm_set_main(vm_t *vm, lox_fn_t *main)
 	struct vm_call_frame main_frame = {
 		.closure = main_closure,
 		.ip = main->chunk.code.data,
-		.stack_snapshot = STACK_RESERVED_COUNT,
+		.slots = vm->stack + STACK_RESERVED_COUNT,
 	};
 
-	if (!list_size(&vm->stack)) {
-		list_push(&vm->stack, &main_obj);
-	} else {
-		*(lox_val_t *)list_get(&vm->stack, STACK_MAIN_IDX) = main_obj;
-	}
-
-	list_push(&vm->frames, &main_frame);
-}
-
-static uint32_t __frame_proc_idx(struct vm_call_frame *frame)
-{
-	__frame_assert_inst_ptr_valid(frame);
-	return __frame_read_byte(frame);
-}
-
-static uint32_t __frame_proc_idx_ext(struct vm_call_frame *frame)
-{
-	__frame_assert_inst_ptr_valid(frame);
-	uint32_t idx = *((uint32_t *)frame->ip) & EXT_CODE_MASK;
-	frame->ip += EXT_CODE_SZ;
-
-	return idx;
-}
-
-static int16_t __frame_proc_jump_offset(struct vm_call_frame *frame)
-{
-	__frame_assert_inst_ptr_valid(frame);
-	int16_t idx = *((int16_t *)frame->ip);
-
-	frame->ip += 2;
+	vm->stack[STACK_MAIN_IDX] = main_obj;
+	vm->stack_top = vm->stack + STACK_RESERVED_COUNT;
 
-	return idx;
-}
-
-static void __vm_proc_const(vm_t *vm, struct vm_call_frame *frame, uint32_t idx)
-{
-	__frame_assert_inst_ptr_valid(frame);
-	__vm_push_const(vm, chunk_get_const(&frame->closure->fn->chunk, idx));
-}
-
-static void __vm_proc_negate_in_place(vm_t *vm)
-{
-	assert(("value stack can not be empty", vm->stack.cap));
-
-	VM_PEEK_NUM(vm, 0) = -VM_PEEK_NUM(vm, 0);
-}
-
-static lox_val_t __vm_peek_const(vm_t *vm, size_t dist)
-{
-	return *(__vm_peek_const_ptr(vm, dist));
-}
-
-static lox_val_t *__vm_peek_const_ptr(vm_t *vm, size_t dist)
-{
-	return (lox_val_t *)(list_peek_offset(&vm->stack, dist));
-}
-
-static lox_val_t __vm_pop_const(vm_t *vm)
-{
-	assert(("Stack cannot be empty on pop", vm->stack.cnt));
-
-	return *((lox_val_t *)list_pop(&vm->stack));
-}
-
-static void __vm_push_const(vm_t *vm, lox_val_t val)
-{
-	list_push(&vm->stack, &val);
+	vm->frames[vm->frame_cnt++] = main_frame;
 }
 
 static void __vm_runtime_error(vm_t *vm, const char *fmt, ...)
@@ -858,8 +1339,8 @@ static void __vm_runtime_error(vm_t *vm, const char *fmt, ...)
 	va_end(args);
 	fputs("\n", stderr);
 
-	for (int i = list_size(&vm->frames) - 1; i >= 0; i--) {
-		struct vm_call_frame *cur_frame = list_get(&vm->frames, i);
+	for (size_t i = vm->frame_cnt; i-- > 0;) {
+		struct vm_call_frame *cur_frame = &vm->frames[i];
 		lox_closure_t *closure = cur_frame->closure;
 
 		size_t offset = ((size_t)__frame_instr_offset(cur_frame)) - 1;
@@ -873,18 +1354,9 @@ static void __vm_runtime_error(vm_t *vm, const char *fmt, ...)
 	__vm_reset(vm);
 }
 
-static inline void
-__frame_assert_inst_ptr_valid(const struct vm_call_frame *frame)
-{
-	assert(("Instruction pointer has passed code end",
-		frame->ip < frame->closure->fn->chunk.code.data +
-				    (frame->closure->fn->chunk.code.cnt *
-				     frame->closure->fn->chunk.code.type_sz)));
-}
-
-static inline char __frame_read_byte(struct vm_call_frame *frame)
+static inline struct vm_call_frame *__vm_cur_frame(vm_t *vm)
 {
-	return *frame->ip++;
+	return &vm->frames[vm->frame_cnt - 1];
 }
 
 static inline int __frame_instr_offset(const struct vm_call_frame *frame)
@@ -892,18 +1364,14 @@ static inline int __frame_instr_offset(const struct vm_call_frame *frame)
 	return (int)(frame->ip - frame->closure->fn->chunk.code.data);
 }
 
-static void __vm_str_concat(vm_t *vm)
+static inline uint32_t __code_read_idx_ext(const uint8_t *ip)
 {
-	const lox_str_t *b_str = OBJECT_AS_STRING(__vm_pop_const(vm));
-	const lox_str_t *a_str = OBJECT_AS_STRING(__vm_pop_const(vm));
-	lox_str_t *concat_str = object_str_concat(a_str, b_str);
-
-	__vm_push_const(vm, VAL_CREATE_OBJ(concat_str));
+	return *((uint32_t *)ip) & EXT_CODE_MASK;
 }
 
-static void __vm_discard(vm_t *vm, uint32_t discard_cnt)
+static inline int16_t __code_read_jump_offset(const uint8_t *ip)
 {
-	list_pop_bulk(&vm->stack, discard_cnt);
+	return *((int16_t *)ip);
 }
 
 static bool __vm_call_val(vm_t *vm, lox_val_t callee, uint8_t call_arity)
@@ -924,7 +1392,7 @@ static bool __vm_call_val(vm_t *vm, lox_val_t callee, uint8_t call_arity)
 				return false;
 			}
 
-			if (list_size(&vm->frames) == CALL_FRAMES_MAX) {
+			if (vm->frame_cnt == CALL_FRAMES_MAX) {
 				__vm_runtime_error(
 					vm,
 					"Stack overflow. Recursion depth of %d was reached",
@@ -932,15 +1400,24 @@ static bool __vm_call_val(vm_t *vm, lox_val_t callee, uint8_t call_arity)
 				return false;
 			}
 
+			if (!__vm_has_stack_room(vm,
+						 vm->stack_top - call_arity,
+						 closure->fn)) {
+				__vm_runtime_error(
+					vm,
+					"Stack overflow. No stack left for the locals of the call");
+				return false;
+			}
+
 			return __vm_call(vm, closure);
 		}
 
 		case OBJ_CLASS: {
 			lox_class_t *cls = OBJECT_AS_CLASS(callee);
 
-			__vm_pop_const(vm);
-			__vm_push_const(
-				vm, VAL_CREATE_OBJ(object_instance_new(cls)));
+			vm->stack_top -= call_arity;
+			vm->stack_top[-1] =
+				VAL_CREATE_OBJ(object_instance_new(cls));
 
 			return true;
 		}
@@ -950,9 +1427,7 @@ static bool __vm_call_val(vm_t *vm, lox_val_t callee, uint8_t call_arity)
 
 			lox_val_t res = native->fn(
 				call_arity,
-				call_arity ? list_peek_offset(&vm->stack,
-							      call_arity - 1) :
-					     NULL);
+				call_arity ? vm->stack_top - call_arity : NULL);
 
 			if (VAL_IS_ERR(res)) {
 				lox_val_t str = val_to_string(res);
@@ -960,8 +1435,8 @@ static bool __vm_call_val(vm_t *vm, lox_val_t callee, uint8_t call_arity)
 				return false;
 			}
 
-			__vm_discard(vm, call_arity + 1);
-			__vm_push_const(vm, res);
+			vm->stack_top -= call_arity;
+			vm->stack_top[-1] = res;
 
 			return true;
 		}
@@ -978,20 +1453,68 @@ static bool __vm_call_val(vm_t *vm, lox_val_t callee, uint8_t call_arity)
 
 static bool __vm_call(vm_t *vm, lox_closure_t *closure)
 {
-	struct vm_call_frame frame = {
+	vm->frames[vm->frame_cnt++] = (struct vm_call_frame){
 		.closure = closure,
 		.ip = closure->fn->chunk.code.data,
-		.stack_snapshot = list_size(&vm->stack) - closure->fn->arity,
+		.slots = vm->stack_top - closure->fn->arity,
 	};
-	list_push(&vm->frames, &frame);
 
 	return true;
 }
 
-static lox_upval_t *__vm_capture_upval(vm_t *vm, size_t idx)
+/**
+ * @brief whether a function's locals, and room for its temporaries, fit on
+ * the stack from the given frame slots
+ */
+static inline bool __vm_has_stack_room(vm_t *vm, const lox_val_t *slots,
+				       const lox_fn_t *fn)
+{
+	return (size_t)(vm->stack + STACK_MAX - slots) >=
+	       (size_t)fn->max_slots + STACK_FRAME_SLOTS;
+}
+
+static inline bool __vm_can_reuse_frame(vm_t *vm, lox_val_t callee,
+					uint8_t arity)
+{
+	return OBJECT_IS_CLOSURE(callee) &&
+	       OBJECT_AS_CLOSURE(callee)->fn->arity == arity &&
+	       __vm_has_stack_room(vm, __vm_cur_frame(vm)->slots,
+				   OBJECT_AS_CLOSURE(callee)->fn);
+}
+
+/**
+ * @brief reuses the current frame for a call in tail position. The callee
+ * and its arguments are moved down over the frame's window
+ */
+static void __vm_reuse_frame(vm_t *vm, lox_closure_t *closure, uint8_t arity)
 {
-	list_t *stack = &vm->stack;
-	lox_val_t *slot = list_get(stack, idx);
+	struct vm_call_frame *frame = __vm_cur_frame(vm);
+	lox_val_t *callee = vm->stack_top - arity - 1;
+
+	if (frame->captured) {
+		__vm_close_upvalues(vm, frame->slots - 1);
+		frame->captured = false;
+	}
+	memmove(frame->slots - 1, callee, sizeof(lox_val_t) * (arity + 1));
+
+	vm->stack_top = frame->slots + arity;
+	frame->closure = closure;
+	frame->ip = closure->fn->chunk.code.data;
+}
+
+/**
+ * @brief captures a slot of the current frame. Slots captured before are
+ * found through the slot table, new upvalues are linked into the open list,
+ * which is sorted by slot. Only the current frame's open upvalues can be
+ * above the slot, so the walk is bounded by its captures
+ */
+static lox_upval_t *__vm_capture_upval(vm_t *vm, lox_val_t *slot)
+{
+	lox_upval_t **slot_upval = &vm->slot_upvals[slot - vm->stack];
+
+	if (*slot_upval) {
+		return *slot_upval;
+	}
 
 	lox_upval_t *upval = vm->open_upvals;
 	lox_upval_t **next_upval = &vm->open_upvals;
@@ -1001,26 +1524,357 @@ static lox_upval_t *__vm_capture_upval(vm_t *vm, size_t idx)
 		upval = upval->next;
 	}
 
-	if (upval != NULL && upval->location == slot) {
-		return upval;
-	}
-
 	lox_upval_t *new_upval = object_upval_new(slot);
 	new_upval->next = upval;
 	*next_upval = new_upval;
+	*slot_upval = new_upval;
+	__vm_cur_frame(vm)->captured = true;
 
 	return new_upval;
 }
 
-static void __vm_close_upvalues(vm_t *vm, size_t frame_idx)
+static void __vm_close_upvalues(vm_t *vm, lox_val_t *last)
 {
-	lox_val_t *last = list_get(&vm->stack, frame_idx);
-
 	while (vm->open_upvals != NULL && vm->open_upvals->location >= last) {
 		lox_upval_t *upval = vm->open_upvals;
+
+		vm->slot_upvals[upval->location - vm->stack] = NULL;
 		upval->closed = *upval->location;
 		upval->location = &upval->closed;
 
 		vm->open_upvals = upval->next;
 	}
-}
\ No newline at end of file
+}
+
+static inline bool __vm_prop_idx(chunk_t *chunk, struct prop_cache *cache,
+				 const lox_class_t *cls, uint32_t *idx)
+{
+	for (uint32_t entry = 0; entry < cache->cnt; entry++) {
+		if (cache->entries[entry].cls == cls) {
+			*idx = cache->entries[entry].idx;
+			return true;
+		}
+	}
+
+	return __vm_prop_cache_miss(chunk, cache, cls, idx);
+}
+
+static bool __vm_prop_cache_miss(chunk_t *chunk, struct prop_cache *cache,
+				 const lox_class_t *cls, uint32_t *idx)
+{
+	lox_str_t *prop_name =
+		OBJECT_AS_STRING(chunk_get_const(chunk, cache->name_idx));
+	lookup_var_t var = lookup_find_name(
+		&cls->field_lookup.table, prop_name->chars, prop_name->len);
+
+	if (!lookup_var_is_valid(var)) {
+		return false;
+	}
+
+	// megamorphic sites stop caching once every entry is taken
+	if (cache->cnt < PROP_CACHE_WAYS) {
+		cache->entries[cache->cnt++] = (struct prop_cache_entry){
+			.cls = cls,
+			.idx = var.idx,
+		};
+	}
+
+	*idx = var.idx;
+	return true;
+}
+
+#ifdef VM_JIT
+static inline bool __vm_jit_ready(lox_fn_t *fn)
+{
+	if (fn->native) {
+		return true;
+	}
+
+	// compilation is only attempted once, as the threshold is crossed
+	return fn->call_cnt < JIT_CALL_THRESHOLD &&
+	       ++fn->call_cnt == JIT_CALL_THRESHOLD && jit_compile(fn);
+}
+
+static bool __vm_call_native(vm_t *vm)
+{
+	size_t depth = vm->frame_cnt - 1;
+	lox_val_t *top;
+
+	// tail calls hand the reused frame back, to be run by its callee
+	do {
+		struct vm_call_frame *frame = __vm_cur_frame(vm);
+		lox_fn_t *fn = frame->closure->fn;
+
+		if (!__vm_jit_ready(fn)) {
+			return __vm_run(vm, depth) == INTERPRET_OK;
+		}
+
+		top = ((jit_fn)fn->native)(vm, frame->slots, vm->stack_top,
+					   (lox_val_t *)fn->chunk.consts.data);
+	} while (top == JIT_TAIL_CALL);
+
+	if (!top) {
+		return false;
+	}
+
+	vm->frame_cnt--;
+	vm->stack_top = top;
+
+	return true;
+}
+
+static bool __vm_jit_binary(op_code_t op, lox_val_t a, lox_val_t b,
+			    lox_val_t *res)
+{
+	switch (op) {
+	case OP_EQUAL:
+	case OP_EQUAL_NUM:
+	case OP_EQUAL_REG:
+		*res = VAL_CREATE_BOOL(val_equals(a, b));
+		return true;
+
+	case OP_NOT_EQUAL:
+	case OP_NOT_EQUAL_REG:
+		*res = VAL_CREATE_BOOL(!val_equals(a, b));
+		return true;
+
+	case OP_ADD:
+	case OP_ADD_STR:
+	case OP_ADD_NUM:
+	case OP_ADD_REG:
+		if (OBJECT_IS_STRING(a) && OBJECT_IS_STRING(b)) {
+			*res = VAL_CREATE_OBJ(object_str_concat(
+				OBJECT_AS_STRING(a), OBJECT_AS_STRING(b)));
+			return true;
+		}
+		break;
+
+	default:
+		break;
+	}
+
+	if (!VAL_IS_NUMBER(a) || !VAL_IS_NUMBER(b)) {
+		return false;
+	}
+
+	lox_num_t x = VAL_AS_NUMBER(a);
+	lox_num_t y = VAL_AS_NUMBER(b);
+
+	switch (op) {
+	case OP_ADD:
+	case OP_ADD_STR:
+	case OP_ADD_NUM:
+	case OP_ADD_REG:
+		*res = VAL_CREATE_NUMBER(x + y);
+		break;
+	case OP_SUBTRACT:
+	case OP_SUBTRACT_REG:
+		*res = VAL_CREATE_NUMBER(x - y);
+		break;
+	case OP_MULTIPLY:
+	case OP_MULTIPLY_REG:
+		*res = VAL_CREATE_NUMBER(x * y);
+		break;
+	case OP_DIVIDE:
+	case OP_DIVIDE_REG:
+		*res = VAL_CREATE_NUMBER(x / y);
+		break;
+	case OP_MOD:
+	case OP_MOD_REG:
+		*res = VAL_CREATE_NUMBER(fmod(x, y));
+		break;
+	case OP_GREATER:
+	case OP_GREATER_REG:
+		*res = VAL_CREATE_BOOL(x > y);
+		break;
+	case OP_LESS:
+	case OP_LESS_REG:
+		*res = VAL_CREATE_BOOL(x < y);
+		break;
+	case OP_GREATER_EQ:
+	case OP_GREATER_EQ_REG:
+		*res = VAL_CREATE_BOOL(x >= y);
+		break;
+	case OP_LESS_EQ:
+	case OP_LESS_EQ_REG:
+		*res = VAL_CREATE_BOOL(x <= y);
+		break;
+	default:
+		assert(("unknown jit binary op", 0));
+		return false;
+	}
+
+	return true;
+}
+
+lox_val_t *vm_jit_op(vm_t *vm, lox_val_t *sp, uint8_t *ip)
+{
+#define JIT_RUNTIME_ERROR(...)                                                 \
+	do {                                                                   \
+		__vm_runtime_error(vm, __VA_ARGS__);                           \
+		return NULL;                                                   \
+	} while (false)
+#define JIT_REG_OPERAND(operand)                                               \
+	((operand) & REG_CONST_FLAG ? consts[(operand) & ~REG_CONST_FLAG] :    \
+				      frame->slots[(operand)])
+
+	struct vm_call_frame *frame = __vm_cur_frame(vm);
+	lox_val_t *consts = (lox_val_t *)frame->closure->fn->chunk.consts.data;
+
+	// errors are reported against the line of the op
+	frame->ip = ip + 1;
+	vm->stack_top = sp;
+
+	switch (*ip) {
+	case OP_NEGATE:
+		if (!VAL_IS_NUMBER(sp[-1])) {
+			JIT_RUNTIME_ERROR("Operand must be a number");
+		}
+		sp[-1] = VAL_CREATE_NUMBER(-VAL_AS_NUMBER(sp[-1]));
+		return sp;
+
+	case OP_NOT:
+		sp[-1] = VAL_CREATE_BOOL(val_is_falsey(sp[-1]));
+		return sp;
+
+	case OP_ADD:
+	case OP_ADD_NUM:
+	case OP_ADD_STR:
+	case OP_SUBTRACT:
+	case OP_MULTIPLY:
+	case OP_DIVIDE:
+	case OP_MOD:
+	case OP_EQUAL:
+	case OP_EQUAL_NUM:
+	case OP_GREATER:
+	case OP_LESS:
+	case OP_GREATER_EQ:
+	case OP_LESS_EQ:
+	case OP_NOT_EQUAL:
+		if (!__vm_jit_binary(*ip, sp[-2], sp[-1], &sp[-2])) {
+			JIT_RUNTIME_ERROR("Operand types must match");
+		}
+		return sp - 1;
+
+	case OP_ADD_REG:
+	case OP_SUBTRACT_REG:
+	case OP_MULTIPLY_REG:
+	case OP_DIVIDE_REG:
+	case OP_MOD_REG:
+	case OP_EQUAL_REG:
+	case OP_GREATER_REG:
+	case OP_LESS_REG:
+	case OP_GREATER_EQ_REG:
+	case OP_LESS_EQ_REG:
+	case OP_NOT_EQUAL_REG: {
+		lox_val_t res;
+
+		if (!__vm_jit_binary(*ip, JIT_REG_OPERAND(ip[2]),
+				     JIT_REG_OPERAND(ip[3]), &res)) {
+			JIT_RUNTIME_ERROR("Operand types must match");
+		}
+
+		if (ip[1] == REG_DEST_PUSH) {
+			*sp++ = res;
+		} else {
+			frame->slots[ip[1]] = res;
+		}
+		return sp;
+	}
+
+	case OP_GLOBAL_DEFINE:
+	case OP_GLOBAL_DEFINE_LONG:
+		__vm_define_global(vm, &sp[-1],
+				   *ip == OP_GLOBAL_DEFINE ?
+					   ip[1] :
+					   __code_read_idx_ext(ip + 1));
+		return sp - 1;
+
+	case OP_GLOBAL_GET:
+	case OP_GLOBAL_GET_LONG: {
+		lox_val_t *val = __vm_get_global(
+			vm, *ip == OP_GLOBAL_GET ? ip[1] :
+						   __code_read_idx_ext(ip + 1));
+
+		if (!val) {
+			JIT_RUNTIME_ERROR("undefined global.");
+		}
+		*sp++ = *val;
+		return sp;
+	}
+
+	case OP_GLOBAL_SET:
+	case OP_GLOBAL_SET_LONG:
+	case OP_GLOBAL_SET_POP:
+		if (!__vm_set_global(vm,
+				     *ip == OP_GLOBAL_SET_LONG ?
+					     __code_read_idx_ext(ip + 1) :
+					     ip[1],
+				     &sp[-1])) {
+			JIT_RUNTIME_ERROR("Undefined global.");
+		}
+		return *ip == OP_GLOBAL_SET_POP ? sp - 1 : sp;
+
+	case OP_TAIL_CALL: {
+		uint8_t arg_cnt = ip[1];
+		lox_val_t callee = sp[-1 - arg_cnt];
+
+		frame->ip = ip + 2;
+		if (__vm_can_reuse_frame(vm, callee, arg_cnt)) {
+			__vm_reuse_frame(vm, OBJECT_AS_CLOSURE(callee), arg_cnt);
+			return JIT_TAIL_CALL;
+		}
+
+		if (!__vm_call_val(vm, callee, arg_cnt)) {
+			return NULL;
+		}
+		return vm->stack_top;
+	}
+
+	case OP_CALL: {
+		size_t depth = vm->frame_cnt;
+		uint8_t arg_cnt = ip[1];
+
+		frame->ip = ip + 2;
+		if (!__vm_call_val(vm, sp[-1 - arg_cnt], arg_cnt)) {
+			return NULL;
+		}
+
+		// natives and classes complete within the call
+		if (vm->frame_cnt == depth) {
+			return vm->stack_top;
+		}
+
+		lox_fn_t *fn = __vm_cur_frame(vm)->closure->fn;
+
+		if (__vm_jit_ready(fn) ? !__vm_call_native(vm) :
+					 __vm_run(vm, depth) != INTERPRET_OK) {
+			return NULL;
+		}
+		return vm->stack_top;
+	}
+
+	// only reached once an operand has failed the native number check
+	case OP_JUMP_IF_NOT_GREATER:
+	case OP_JUMP_IF_NOT_LESS:
+	case OP_JUMP_IF_NOT_GREATER_REG:
+	case OP_JUMP_IF_NOT_LESS_REG:
+	case OP_JUMP_IF_NOT_GREATER_EQ:
+	case OP_JUMP_IF_NOT_LESS_EQ:
+	case OP_JUMP_IF_NOT_GREATER_EQ_REG:
+	case OP_JUMP_IF_NOT_LESS_EQ_REG:
+		JIT_RUNTIME_ERROR("Operand types must match");
+
+	// only reached once a bound has failed the native number check
+	case OP_FOR_RANGE_INIT:
+		JIT_RUNTIME_ERROR("Range bounds must be numbers");
+
+	default:
+		assert(("op has no jit slow path", 0));
+		return NULL;
+	}
+
+#undef JIT_RUNTIME_ERROR
+#undef JIT_REG_OPERAND
+}
+#endif // VM_JIT
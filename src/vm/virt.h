@@ -15,23 +15,35 @@
 #define STACK_RESERVED_COUNT 1
 //! @brief stack main function/script index
 #define STACK_MAIN_IDX 0
+//! @brief number of value slots kept free above a call frame's locals for
+//! its temporaries
+#define STACK_FRAME_SLOTS (UINT8_MAX + 1)
+//! @brief number of value slots preallocated for the vm stack
+#define STACK_MAX (CALL_FRAMES_MAX * STACK_FRAME_SLOTS)
 
 //! @brief call frame for lox functions
 struct vm_call_frame {
 	lox_closure_t *closure;
 	uint8_t *ip;
-	size_t stack_snapshot;
+	lox_val_t *slots;
+	// set once a closure captures one of the frame slots
+	bool captured;
 };
 
 //! @brief vm struct
 typedef struct __vm {
-	list_t frames;
+	struct vm_call_frame *frames;
+	size_t frame_cnt;
 	struct state state;
 	list_t globals;
-	list_t stack;
+	lox_val_t *stack;
+	lox_val_t *stack_top;
 	lox_upval_t *open_upvals;
+	// the open upvalue of each stack slot, if it has been captured
+	lox_upval_t **slot_upvals;
 #ifdef DEBUG_BENCH
 	hashmap_t timings_map;
+	uint64_t *op_pair_cnts;
 #endif
 } vm_t;
 
@@ -58,6 +70,16 @@ vm_t vm_init();
  */
 enum vm_res vm_interpret(vm_t *vm, const char *src);
 
+/**
+ * @brief begins interpreting an already compiled main function, such as one
+ * loaded from an image
+ *
+ * @param vm the vm to interpret with
+ * @param fn the main function to run
+ * @return enum vm_res the vm result
+ */
+enum vm_res vm_interpret_fn(vm_t *vm, lox_fn_t *fn);
+
 /**
  * @brief frees the passed vm and its related objects
  *
@@ -3,6 +3,7 @@
 
 #include "util/map/test_map.h"
 #include "util/list/test_list.h"
+#include "util/mem/test_arena.h"
 #include "util/map/test_map.h"
 
 void print_num(void *val)
@@ -14,5 +15,6 @@ int main(int argc, const char *argv[])
 {
 	list_test_all();
 	map_test_all();
+	arena_test_all();
 	map_bench_all();
 }
@@ -0,0 +1,92 @@
+#include "test_arena.h"
+#include "util/mem/arena.h"
+#include "util/list/list.h"
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+void arena_test_all()
+{
+	arena_test_alloc();
+	arena_test_large_alloc();
+	arena_test_realloc();
+	arena_test_list();
+}
+
+void arena_test_alloc()
+{
+	arena_t arena = arena_new();
+	char *first = arena_alloc(&arena, 3);
+	char *second = arena_alloc(&arena, 5);
+
+	memcpy(first, "ab", 3);
+	memcpy(second, "cdef", 5);
+
+	assert(("Allocations overlap", strcmp(first, "ab") == 0));
+	assert(("Allocations overlap", strcmp(second, "cdef") == 0));
+	assert(("Allocation is not aligned",
+		(uintptr_t)second % _Alignof(max_align_t) == 0));
+
+	arena_free(&arena);
+	assert(("Arena still holds blocks", arena.head == NULL));
+}
+
+void arena_test_large_alloc()
+{
+	arena_t arena = arena_new();
+	char *small = arena_alloc(&arena, 16);
+	char *large = arena_alloc(&arena, ARENA_BLOCK_SZ * 2);
+
+	memset(small, 1, 16);
+	memset(large, 2, ARENA_BLOCK_SZ * 2);
+
+	assert(("Large allocation overwrote small one", small[15] == 1));
+	assert(("Large allocation is incomplete",
+		large[ARENA_BLOCK_SZ * 2 - 1] == 2));
+
+	arena_free(&arena);
+}
+
+void arena_test_realloc()
+{
+	arena_t arena = arena_new();
+	char *grown = arena_alloc(&arena, 8);
+
+	memcpy(grown, "grow me", 8);
+	char *in_place = arena_realloc(&arena, grown, 8, 64);
+
+	assert(("Last allocation was not grown in place", in_place == grown));
+
+	arena_alloc(&arena, 8);
+	char *moved = arena_realloc(&arena, in_place, 64, 128);
+
+	assert(("Buried allocation was grown in place", moved != in_place));
+	assert(("Contents were not kept", strcmp(moved, "grow me") == 0));
+
+	arena_free(&arena);
+}
+
+void arena_test_list()
+{
+	arena_t arena = arena_new();
+	list_t first = list_of_type_in(int, &arena);
+	list_t second = list_of_type_in(int, &arena);
+
+	for (int i = 0; i < 1000; i++) {
+		list_push(&first, &i);
+		list_push(&second, &i);
+	}
+
+	for (int i = 0; i < 1000; i++) {
+		assert(("List items were lost",
+			*(int *)list_get(&first, i) == i &&
+				*(int *)list_get(&second, i) == i));
+	}
+
+	list_free(&first);
+	assert(("List was not emptied", list_size(&first) == 0));
+
+	arena_free(&arena);
+}
@@ -0,0 +1,10 @@
+#ifndef __TEST_UTIL_ARENA_H__
+#define __TEST_UTIL_ARENA_H__
+
+void arena_test_all();
+void arena_test_alloc();
+void arena_test_large_alloc();
+void arena_test_realloc();
+void arena_test_list();
+
+#endif // __TEST_UTIL_ARENA_H__